@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "perceptron.h"
+#include "mlp.h"
+#include "threadpool.h"
+
+// Microbenchmarks of the perceptron and MLP hot paths, written to stdout as JSON so runs can be diffed between
+// releases (progress goes to stderr):
+//
+//   ./build.sh bench && ./bench > results.json
+//   ./bench --seconds 0.5 --widths 40,1024 --batches 1,64
+//
+// Every MLP is MNIST shaped (784 inputs, 10 outputs) with the hidden layer width swept, and trains on synthetic data.
+// The "latency" section times single images one call at a time (serially, and split neuron-wise across a spin pool),
+// and reports the percentiles of the per-call times.
+// FLOP counts take a multiply-add as 2 FLOPs and ignore activations; byte counts are the minimum memory traffic
+// (each weight matrix and input row streamed the number of times the algorithm has to touch it), so GB/s is a
+// lower bound on the bandwidth actually used.
+
+#define BENCH_INPUTS 784
+#define BENCH_OUTPUTS 10
+// Rows in the synthetic dataset, i.e. samples per timed repetition:
+#define BENCH_ROWS 512
+
+static const int default_widths[] = {40, 128, 512, 1024, 4096};
+static const int default_batches[] = {1, 16, 64, 256};
+
+// ////////////////////////////////////  //
+//  Timing and JSON output               //
+//  ///////////////////////////////////  //
+
+typedef struct bench_result_t {
+    const char *name;
+    int width;
+    int batch_size;
+    long samples;
+    double seconds;
+    // Per sample:
+    double flops;
+    double bytes;
+} bench_result_t;
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int result_count = 0;
+
+static void print_result(const bench_result_t *result) {
+    const double samples_per_second = result->samples / result->seconds;
+    printf("%s\n    {\"benchmark\": \"%s\", \"width\": %d, \"batch_size\": %d, \"samples\": %ld, \"seconds\": %.6f, "
+        "\"samples_per_second\": %.1f, \"gflops\": %.3f, \"gbps\": %.3f}",
+        result_count++ ? "," : "", result->name, result->width, result->batch_size, result->samples, result->seconds,
+        samples_per_second, samples_per_second * result->flops / 1e9, samples_per_second * result->bytes / 1e9);
+    fflush(stdout);
+    fprintf(stderr, "%-20s width %5d batch %4d: %12.1f samples/sec\n", result->name, result->width, result->batch_size, samples_per_second);
+}
+
+// Time repetitions of run (each one processing BENCH_ROWS samples) after a warm up, until at least min_seconds pass:
+static void bench(bench_result_t *result, double min_seconds, void (*run)(void *arg), void *arg) {
+    run(arg);
+
+    long repetitions = 0;
+    const double start = now_seconds();
+    double elapsed;
+    do {
+        run(arg);
+        repetitions++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < min_seconds);
+
+    result->samples = repetitions * BENCH_ROWS;
+    result->seconds = elapsed;
+    print_result(result);
+}
+
+// ////////////////////////////////////  //
+//  Benchmarks                           //
+//  ///////////////////////////////////  //
+
+typedef struct bench_state_t {
+    perceptron_t *perceptron;
+    multilayer_perceptron_t *mlp;
+    thread_pool_t *pool;
+    mlp_predict_workspace_t *predict_workspace;
+    int batch_size;
+
+    // Synthetic dataset of BENCH_ROWS rows, dimension values each:
+    int dimension;
+    real_t *features;
+    real_t *labels;
+    int *predictions;
+    mlp_inputs_t inputs;
+    mlp_labels_t label_rows;
+} bench_state_t;
+
+// Random features in [0, 1), and one-hot labels:
+static void init_bench_data(bench_state_t *state, int dimension) {
+    state->dimension = dimension;
+    state->features = malloc(sizeof(real_t) * BENCH_ROWS * dimension);
+    state->labels = malloc(sizeof(real_t) * BENCH_ROWS * BENCH_OUTPUTS);
+    state->predictions = malloc(sizeof(int) * BENCH_ROWS);
+    mlp_random_t random = mlp_random_take();
+    mlp_random_lanes_t lanes;
+    mlp_random_lanes(&lanes, mlp_random_next(&random), 0);
+    vector_random_uniform(&lanes, state->features, BENCH_ROWS * dimension, 0, 1);
+    memset(state->labels, 0, sizeof(real_t) * BENCH_ROWS * BENCH_OUTPUTS);
+    for (int i = 0; i < BENCH_ROWS; i++) {
+        state->labels[i * BENCH_OUTPUTS + mlp_random_below(&random, BENCH_OUTPUTS)] = 1;
+    }
+    state->inputs = mlp_real_inputs(state->features, dimension, dimension);
+    state->label_rows = mlp_real_labels(state->labels, BENCH_OUTPUTS, BENCH_OUTPUTS);
+}
+
+static void destroy_bench_data(bench_state_t *state) {
+    free(state->features);
+    free(state->labels);
+    free(state->predictions);
+}
+
+// Kept so the compiler can't drop the perceptron's result:
+static volatile double perceptron_sink;
+
+static void run_perceptron_feedforward(void *arg) {
+    bench_state_t *state = arg;
+    double sum = 0;
+    for (int i = 0; i < BENCH_ROWS; i++) {
+        sum += perceptron_feedforward(state->perceptron, state->features + (long)i * state->dimension);
+    }
+    perceptron_sink = sum;
+}
+
+static void run_mlp_feedforward(void *arg) {
+    bench_state_t *state = arg;
+    for (int i = 0; i < BENCH_ROWS; i++) {
+        mlp_feedforward(state->mlp, state->features + (long)i * state->dimension);
+    }
+}
+
+// mlp_backpropagate works from the activations of the last mlp_feedforward, so this times the backward pass alone,
+// against the activations of the dataset's last row:
+static void run_mlp_backpropagate(void *arg) {
+    bench_state_t *state = arg;
+    for (int i = 0; i < BENCH_ROWS; i++) {
+        mlp_backpropagate(state->mlp, state->features + (long)i * state->dimension, state->labels + i * BENCH_OUTPUTS, 1e-4);
+    }
+}
+
+// One epoch (the MLP is built with an epoch count of 1) over the dataset:
+static void run_train_mlp(void *arg) {
+    bench_state_t *state = arg;
+    train_mlp(state->mlp, BENCH_ROWS, state->dimension, (const real_t (*)[state->dimension])state->features,
+        BENCH_OUTPUTS, (const real_t (*)[BENCH_OUTPUTS])state->labels, 1e-4);
+}
+
+static void run_train_mlp_minibatch(void *arg) {
+    bench_state_t *state = arg;
+    train_mlp_minibatch(state->mlp, BENCH_ROWS, &state->inputs, &state->label_rows, 1e-4, state->batch_size);
+}
+
+// The dataset as consecutive predict calls of batch_size rows each:
+static void run_mlp_predict_batch(void *arg) {
+    bench_state_t *state = arg;
+    for (int i = 0; i < BENCH_ROWS; i += state->batch_size) {
+        const int count = (BENCH_ROWS - i < state->batch_size) ? BENCH_ROWS - i : state->batch_size;
+        const mlp_inputs_t rows = mlp_real_inputs(state->features + (long)i * state->dimension, state->dimension, state->dimension);
+        mlp_predict_batch_r(state->mlp, state->predict_workspace, count, &rows, NULL, state->predictions + i, state->pool);
+    }
+}
+
+static void bench_perceptron(int width, double min_seconds) {
+    bench_state_t state = {0};
+    init_bench_data(&state, width);
+    state.perceptron = init_perceptron(width, sign_activation_function, NULL, 1);
+
+    // One dot product of the weights with the input:
+    bench_result_t result = {.name = "perceptron_feedforward", .width = width, .batch_size = 1};
+    result.flops = 2.0 * width;
+    result.bytes = 2.0 * width * sizeof(real_t);
+    bench(&result, min_seconds, run_perceptron_feedforward, &state);
+
+    destroy_perceptron(state.perceptron);
+    destroy_bench_data(&state);
+}
+
+static void bench_mlp(int width, const int *batches, int batch_count, thread_pool_t *pool, double min_seconds) {
+    bench_state_t state = {0};
+    init_bench_data(&state, BENCH_INPUTS);
+    state.pool = pool;
+    state.mlp = init_mlp(BENCH_INPUTS, width, BENCH_OUTPUTS, relu_activation, derivative_relu_activation,
+        linear_activation, derivative_linear_activation, 1);
+    // Reused across calls, as a server would:
+    state.predict_workspace = init_mlp_predict_workspace(state.mlp, pool ? pool->thread_count : 1);
+
+    // Weights (W) and bytes of them, and bytes of one input row:
+    const double weights = (double)BENCH_INPUTS * width + (double)width * BENCH_OUTPUTS;
+    const double weight_bytes = weights * sizeof(real_t);
+    const double input_bytes = BENCH_INPUTS * sizeof(real_t);
+    // The output layer's transpose product carrying dL/dz back to the hidden layer:
+    const double backward_flops = 2.0 * width * BENCH_OUTPUTS;
+
+    // Forward: 2W, weights read once.
+    bench_result_t result = {.name = "mlp_feedforward", .width = width, .batch_size = 1};
+    result.flops = 2 * weights;
+    result.bytes = weight_bytes + input_bytes;
+    bench(&result, min_seconds, run_mlp_feedforward, &state);
+
+    // Backward: the backward product, and a 2W update that reads and writes every weight (fewer with dead ReLUs,
+    // whose rows are skipped).
+    result = (bench_result_t){.name = "mlp_backpropagate", .width = width, .batch_size = 1};
+    result.flops = backward_flops + 2 * weights;
+    result.bytes = 2 * weight_bytes + input_bytes;
+    bench(&result, min_seconds, run_mlp_backpropagate, &state);
+
+    // Per-sample training, forward then backward:
+    result = (bench_result_t){.name = "train_mlp", .width = width, .batch_size = 1};
+    result.flops = 4 * weights + backward_flops;
+    result.bytes = 3 * weight_bytes + input_bytes;
+    bench(&result, min_seconds, run_train_mlp, &state);
+
+    for (int b = 0; b < batch_count; b++) {
+        state.batch_size = batches[b];
+
+        // Per batch: weights read by the forward and backward products, gradients written by the gradient product,
+        // then both read and the weights written by the update; spread over the batch's samples.
+        if (batches[b] > 1) {
+            result = (bench_result_t){.name = "train_mlp_minibatch", .width = width, .batch_size = batches[b]};
+            result.flops = 4 * weights + backward_flops + 2 * weights / batches[b];
+            result.bytes = 5 * weight_bytes / batches[b] + input_bytes;
+            bench(&result, min_seconds, run_train_mlp_minibatch, &state);
+        }
+
+        // Each predict call reads the weights once per block of rows a thread works through:
+        result = (bench_result_t){.name = "mlp_predict_batch", .width = width, .batch_size = batches[b]};
+        result.flops = 2 * weights;
+        result.bytes = weight_bytes / batches[b] + input_bytes;
+        bench(&result, min_seconds, run_mlp_predict_batch, &state);
+    }
+
+    destroy_mlp_predict_workspace(state.predict_workspace);
+    destroy_mlp(state.mlp);
+    destroy_bench_data(&state);
+}
+
+// ////////////////////////////////////  //
+//  Single-sample latency                //
+//  ///////////////////////////////////  //
+
+// Most calls timed per latency benchmark (each one's time is kept, for the percentiles):
+#define LATENCY_MAX_CALLS 200000
+
+static int latency_count = 0;
+
+static int compare_seconds(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Time single-image calls one by one, after a warm up pass over the dataset, until min_seconds pass
+// (or LATENCY_MAX_CALLS are taken), and print the distribution:
+static void bench_latency_calls(const char *name, int width, int threads, bench_state_t *state, mlp_workspace_t *workspace,
+    spin_pool_t *pool, double *times, double min_seconds) {
+
+    for (int i = 0; i < BENCH_ROWS; i++) {
+        if (pool) {
+            mlp_feedforward_latency(state->mlp, workspace, &state->inputs, i, pool);
+        } else {
+            mlp_feedforward_row(state->mlp, workspace, &state->inputs, i);
+        }
+    }
+
+    long calls = 0;
+    double total = 0;
+    while (calls < LATENCY_MAX_CALLS && total < min_seconds) {
+        const long i = calls % BENCH_ROWS;
+        const double start = now_seconds();
+        if (pool) {
+            mlp_feedforward_latency(state->mlp, workspace, &state->inputs, i, pool);
+        } else {
+            mlp_feedforward_row(state->mlp, workspace, &state->inputs, i);
+        }
+        times[calls] = now_seconds() - start;
+        total += times[calls++];
+    }
+    qsort(times, calls, sizeof(double), compare_seconds);
+
+    const double p50 = times[(calls - 1) / 2] * 1e6;
+    const double p99 = times[(long)((calls - 1) * 0.99)] * 1e6;
+    const double max = times[calls - 1] * 1e6;
+    printf("%s\n    {\"benchmark\": \"%s\", \"width\": %d, \"threads\": %d, \"calls\": %ld, \"mean_us\": %.3f, "
+        "\"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f}",
+        latency_count++ ? "," : "", name, width, threads, calls, total / calls * 1e6, p50, p99, max);
+    fflush(stdout);
+    fprintf(stderr, "%-20s width %5d threads %2d: p50 %9.2fus, p99 %9.2fus\n", name, width, threads, p50, p99);
+}
+
+// One image at a time through the serial forward pass, then split neuron-wise across a spin pool:
+static void bench_latency(int width, spin_pool_t *pool, double min_seconds) {
+    bench_state_t state = {0};
+    init_bench_data(&state, BENCH_INPUTS);
+    state.mlp = init_mlp(BENCH_INPUTS, width, BENCH_OUTPUTS, relu_activation, derivative_relu_activation,
+        linear_activation, derivative_linear_activation, 1);
+    mlp_workspace_t *workspace = init_mlp_workspace(state.mlp);
+    double *times = malloc(sizeof(double) * LATENCY_MAX_CALLS);
+
+    bench_latency_calls("latency_serial", width, 1, &state, workspace, NULL, times, min_seconds);
+    bench_latency_calls("latency_neuron_parallel", width, pool->thread_count, &state, workspace, pool, times, min_seconds);
+
+    free(times);
+    destroy_mlp_workspace(workspace);
+    destroy_mlp(state.mlp);
+    destroy_bench_data(&state);
+}
+
+// ////////////////////////////////////  //
+//  Command line                         //
+//  ///////////////////////////////////  //
+
+// Parse a comma separated list of positive integers into values (up to max_count of them), returning the count:
+static int parse_list(const char *text, int *values, int max_count) {
+    int count = 0;
+    while (*text && count < max_count) {
+        char *end;
+        const long value = strtol(text, &end, 10);
+        if (end == text || value <= 0) {
+            return 0;
+        }
+        values[count++] = (int)value;
+        text = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+#define MAX_SWEEP 32
+
+static int usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--seconds <min seconds per benchmark>] [--widths <n,n,...>] [--batches <n,n,...>]\n", program);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+
+    double min_seconds = 0.25;
+    int widths[MAX_SWEEP];
+    int width_count = sizeof(default_widths) / sizeof(default_widths[0]);
+    memcpy(widths, default_widths, sizeof(default_widths));
+    int batches[MAX_SWEEP];
+    int batch_count = sizeof(default_batches) / sizeof(default_batches[0]);
+    memcpy(batches, default_batches, sizeof(default_batches));
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            min_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--widths") == 0 && i + 1 < argc) {
+            width_count = parse_list(argv[++i], widths, MAX_SWEEP);
+        } else if (strcmp(argv[i], "--batches") == 0 && i + 1 < argc) {
+            batch_count = parse_list(argv[++i], batches, MAX_SWEEP);
+        } else {
+            return usage(argv[0]);
+        }
+        if (width_count == 0 || batch_count == 0) {
+            return usage(argv[0]);
+        }
+    }
+
+    // Fixed seed, so every run times the same networks and data:
+    mlp_random_set_seed(1);
+    init_kernels();
+
+    const int thread_count = default_thread_count();
+    thread_pool_t *pool = init_thread_pool(thread_count);
+
+    printf("{\n  \"precision\": \"%s\",\n  \"isa\": \"%s\",\n  \"threads\": %d,\n  \"min_seconds\": %g,\n  \"results\": [",
+        REAL_NAME, kernels_isa_name(), thread_count, min_seconds);
+
+    for (int w = 0; w < width_count; w++) {
+        bench_perceptron(widths[w], min_seconds);
+    }
+    for (int w = 0; w < width_count; w++) {
+        bench_mlp(widths[w], batches, batch_count, pool, min_seconds);
+    }
+
+    printf("\n  ],\n  \"latency\": [");
+
+    // Spinning workers would steal cycles from the throughput benchmarks, so the spin pool only exists for these.
+    // Its workers are pinned to their own cores:
+    spin_pool_t *spin_pool = init_spin_pool(thread_count, 1);
+    for (int w = 0; w < width_count; w++) {
+        bench_latency(widths[w], spin_pool, min_seconds);
+    }
+    destroy_spin_pool(spin_pool);
+
+    printf("\n  ]\n}\n");
+
+    destroy_thread_pool(pool);
+    return 0;
+}
@@ -1,3 +1,23 @@
 #!/bin/bash
 
-gcc main.c perceptron.c -lm mlp.c -o main
+# ./build.sh               - double precision (float64) build
+# ./build.sh float32       - single precision build (weights, activations and datasets stored as float)
+# ./build.sh bench         - also build ./bench, the kernel/training microbenchmarks (JSON on stdout)
+# ./build.sh float32 bench - both of the above
+CFLAGS="-O2 -pthread"
+BENCH=0
+for arg in "$@"; do
+    if [ "$arg" == "float32" ]; then
+        CFLAGS="$CFLAGS -DMLP_FLOAT32"
+    elif [ "$arg" == "bench" ]; then
+        BENCH=1
+    fi
+done
+
+SOURCES="perceptron.c mlp.c kernels.c random.c gemm.c threadpool.c numa.c quant.c idx.c mnist.c pipeline.c profile.c server.c"
+
+gcc $CFLAGS main.c $SOURCES -lm -o main
+gcc -O2 convert_weights.c -o convert_weights
+if [ $BENCH == 1 ]; then
+    gcc $CFLAGS bench.c $SOURCES -lm -o bench
+fi
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Convert an MLP weights file (as written by save_mlp_weights) between float64 and float32.
+// Usage: ./convert_weights <input> <output> <float32|float64>
+//
+// The file is three ints (input, hidden1 and output counts) followed by every neuron's weights and bias.
+// The precision of the input is inferred from its size, the same way load_mlp_weights does.
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 4 || (strcmp(argv[3], "float32") != 0 && strcmp(argv[3], "float64") != 0)) {
+        printf("Usage: %s <input> <output> <float32|float64>\n", argv[0]);
+        return 1;
+    }
+    const size_t output_size = strcmp(argv[3], "float32") == 0 ? sizeof(float) : sizeof(double);
+
+    FILE *input = fopen(argv[1], "rb");
+    if (!input) {
+        perror("Failed to open input weights file");
+        return 1;
+    }
+
+    int structure[3];
+    if (fread(structure, sizeof(int), 3, input) != 3) {
+        fprintf(stderr, "Input weights file is truncated\n");
+        fclose(input);
+        return 1;
+    }
+    if (structure[0] <= 0 || structure[1] <= 0 || structure[2] <= 0) {
+        fprintf(stderr, "Input weights file has an invalid %d-%d-%d structure\n", structure[0], structure[1], structure[2]);
+        fclose(input);
+        return 1;
+    }
+    const long input_count = structure[0], hidden1_count = structure[1], output_count = structure[2];
+    const long value_count = hidden1_count * (input_count + 1) + output_count * (hidden1_count + 1);
+
+    fseek(input, 0, SEEK_END);
+    const long payload_size = ftell(input) - (long)sizeof(structure);
+    fseek(input, sizeof(structure), SEEK_SET);
+
+    size_t input_size;
+    if (payload_size == value_count * (long)sizeof(double)) {
+        input_size = sizeof(double);
+    } else if (payload_size == value_count * (long)sizeof(float)) {
+        input_size = sizeof(float);
+    } else {
+        fprintf(stderr, "Input file size does not match its %ld-%ld-%ld structure\n", input_count, hidden1_count, output_count);
+        fclose(input);
+        return 1;
+    }
+
+    FILE *output = fopen(argv[2], "wb");
+    if (!output) {
+        perror("Failed to open output weights file");
+        fclose(input);
+        return 1;
+    }
+    fwrite(structure, sizeof(int), 3, output);
+
+    for (long i = 0; i < value_count; i++) {
+        double value;
+        size_t read;
+        if (input_size == sizeof(float)) {
+            float f;
+            read = fread(&f, sizeof(float), 1, input);
+            value = f;
+        } else {
+            read = fread(&value, sizeof(double), 1, input);
+        }
+        if (read != 1) {
+            // The file changed size under us, or failed to read; don't leave a partial output behind:
+            fprintf(stderr, "Input weights file is truncated after %ld of %ld values\n", i, value_count);
+            fclose(input);
+            fclose(output);
+            remove(argv[2]);
+            return 1;
+        }
+
+        if (output_size == sizeof(float)) {
+            const float f = (float)value;
+            fwrite(&f, sizeof(float), 1, output);
+        } else {
+            fwrite(&value, sizeof(double), 1, output);
+        }
+    }
+
+    fclose(input);
+    fclose(output);
+
+    printf("Converted %ld %s values to %s\n", value_count, input_size == sizeof(float) ? "float32" : "float64", argv[3]);
+    return 0;
+}
@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "gemm.h"
+#include "kernels.h"
+#include "simd.h"
+
+// Register tile: each micro-kernel call produces GEMM_MR x GEMM_NR outputs,
+// where a row of GEMM_NR elements is one 64 byte cache line (two ymm / one zmm register):
+#define GEMM_MR 4
+#define GEMM_NR (64 / (int)sizeof(real_t))
+
+// Cache blocking: a GEMM_MC x GEMM_KC block of A is sized for L2, a GEMM_KC x GEMM_NR sliver of B for L1,
+// and a GEMM_KC x GEMM_NC panel of B for L3.
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 2048
+
+#define GEMM_ALIGNMENT 64
+
+// ////////////////////////////////////  //
+//             Micro-kernels             //
+//  ///////////////////////////////////  //
+
+// Each micro-kernel computes tile[r][c] = Σ_p packed_a[p][r] * packed_b[p][c] over kc steps,
+// where packed_a holds GEMM_MR rows of A and packed_b holds GEMM_NR columns of B, both interleaved by p.
+
+static void micro_kernel_scalar(int kc, const real_t *packed_a, const real_t *packed_b, real_t tile[GEMM_MR][GEMM_NR]) {
+    real_t acc[GEMM_MR][GEMM_NR] = {{0}};
+    for (int p = 0; p < kc; p++) {
+        for (int r = 0; r < GEMM_MR; r++) {
+            const real_t a = packed_a[p * GEMM_MR + r];
+            for (int c = 0; c < GEMM_NR; c++) {
+                acc[r][c] += a * packed_b[p * GEMM_NR + c];
+            }
+        }
+    }
+    memcpy(tile, acc, sizeof(acc));
+}
+
+#ifdef SIMD_X86
+
+__attribute__((target("avx2,fma")))
+static void micro_kernel_avx2(int kc, const real_t *packed_a, const real_t *packed_b, real_t tile[GEMM_MR][GEMM_NR]) {
+    // 4 rows x 2 ymm registers of accumulators:
+    v256_t c00 = v256_zero(), c01 = v256_zero();
+    v256_t c10 = v256_zero(), c11 = v256_zero();
+    v256_t c20 = v256_zero(), c21 = v256_zero();
+    v256_t c30 = v256_zero(), c31 = v256_zero();
+    for (int p = 0; p < kc; p++) {
+        const v256_t b0 = v256_load(packed_b);
+        const v256_t b1 = v256_load(packed_b + V256_LANES);
+        v256_t a;
+        a = v256_set1(packed_a[0]);
+        c00 = v256_fmadd(a, b0, c00);
+        c01 = v256_fmadd(a, b1, c01);
+        a = v256_set1(packed_a[1]);
+        c10 = v256_fmadd(a, b0, c10);
+        c11 = v256_fmadd(a, b1, c11);
+        a = v256_set1(packed_a[2]);
+        c20 = v256_fmadd(a, b0, c20);
+        c21 = v256_fmadd(a, b1, c21);
+        a = v256_set1(packed_a[3]);
+        c30 = v256_fmadd(a, b0, c30);
+        c31 = v256_fmadd(a, b1, c31);
+        packed_a += GEMM_MR;
+        packed_b += GEMM_NR;
+    }
+    v256_storeu(&tile[0][0], c00);
+    v256_storeu(&tile[0][V256_LANES], c01);
+    v256_storeu(&tile[1][0], c10);
+    v256_storeu(&tile[1][V256_LANES], c11);
+    v256_storeu(&tile[2][0], c20);
+    v256_storeu(&tile[2][V256_LANES], c21);
+    v256_storeu(&tile[3][0], c30);
+    v256_storeu(&tile[3][V256_LANES], c31);
+}
+
+__attribute__((target("avx512f")))
+static void micro_kernel_avx512(int kc, const real_t *packed_a, const real_t *packed_b, real_t tile[GEMM_MR][GEMM_NR]) {
+    // One zmm register covers a full GEMM_NR wide row of the tile:
+    v512_t c0 = v512_zero();
+    v512_t c1 = v512_zero();
+    v512_t c2 = v512_zero();
+    v512_t c3 = v512_zero();
+    for (int p = 0; p < kc; p++) {
+        const v512_t b = v512_load(packed_b);
+        c0 = v512_fmadd(v512_set1(packed_a[0]), b, c0);
+        c1 = v512_fmadd(v512_set1(packed_a[1]), b, c1);
+        c2 = v512_fmadd(v512_set1(packed_a[2]), b, c2);
+        c3 = v512_fmadd(v512_set1(packed_a[3]), b, c3);
+        packed_a += GEMM_MR;
+        packed_b += GEMM_NR;
+    }
+    v512_storeu(&tile[0][0], c0);
+    v512_storeu(&tile[1][0], c1);
+    v512_storeu(&tile[2][0], c2);
+    v512_storeu(&tile[3][0], c3);
+}
+
+#endif
+
+typedef void (*micro_kernel_t)(int kc, const real_t *packed_a, const real_t *packed_b, real_t tile[GEMM_MR][GEMM_NR]);
+
+static micro_kernel_t select_micro_kernel(void) {
+    switch (kernels_isa()) {
+#ifdef SIMD_X86
+    case ISA_AVX512:
+        return micro_kernel_avx512;
+    case ISA_AVX2:
+        return micro_kernel_avx2;
+#endif
+    default:
+        return micro_kernel_scalar;
+    }
+}
+
+// ////////////////////////////////////  //
+//                Packing                //
+//  ///////////////////////////////////  //
+
+// Packing buffers are per thread and allocated on first use, so gemm() can be called concurrently
+// and does not allocate in steady state. They hang off a thread-specific key, whose destructor frees them
+// when the thread exits (pool workers come and go with their pools):
+typedef struct packing_buffers_t {
+    real_t *packed_a;
+    real_t *packed_b;
+} packing_buffers_t;
+
+static pthread_key_t packing_key;
+static pthread_once_t packing_once = PTHREAD_ONCE_INIT;
+
+static void destroy_packing_buffers(void *arg) {
+    packing_buffers_t *buffers = arg;
+    free(buffers->packed_a);
+    free(buffers->packed_b);
+    free(buffers);
+}
+
+static void create_packing_key(void) {
+    pthread_key_create(&packing_key, destroy_packing_buffers);
+}
+
+static packing_buffers_t *packing_buffers(void) {
+    pthread_once(&packing_once, create_packing_key);
+    packing_buffers_t *buffers = pthread_getspecific(packing_key);
+    if (!buffers) {
+        buffers = malloc(sizeof(*buffers));
+        buffers->packed_a = aligned_alloc(GEMM_ALIGNMENT, (size_t)GEMM_MC * GEMM_KC * sizeof(real_t));
+        buffers->packed_b = aligned_alloc(GEMM_ALIGNMENT, (size_t)GEMM_KC * GEMM_NC * sizeof(real_t));
+        pthread_setspecific(packing_key, buffers);
+    }
+    return buffers;
+}
+
+// Element (i, j) of op(X), where X is stored row-major with row stride ld:
+static inline const real_t *op_element(gemm_transpose_t trans, const real_t *x, int ld, int i, int j) {
+    return (trans == GEMM_NO_TRANS) ? x + (size_t)i * ld + j : x + (size_t)j * ld + i;
+}
+
+// Copy an mc x kc block of op(A) into GEMM_MR row slivers, zero padding the final sliver.
+// Element (r, p) of a sliver lands at sliver[p * GEMM_MR + r]:
+static void pack_a(gemm_transpose_t trans, const real_t *a, int lda, int row, int col, int mc, int kc, real_t *packed) {
+    // Distance between consecutive p (columns of op(A)) in memory:
+    const size_t step = (trans == GEMM_NO_TRANS) ? 1 : (size_t)lda;
+    for (int ir = 0; ir < mc; ir += GEMM_MR) {
+        const int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+        for (int r = 0; r < GEMM_MR; r++) {
+            if (r < mr) {
+                const real_t *src = op_element(trans, a, lda, row + ir + r, col);
+                for (int p = 0; p < kc; p++) {
+                    packed[p * GEMM_MR + r] = src[p * step];
+                }
+            } else {
+                for (int p = 0; p < kc; p++) {
+                    packed[p * GEMM_MR + r] = 0.0;
+                }
+            }
+        }
+        packed += (size_t)kc * GEMM_MR;
+    }
+}
+
+// Copy a kc x nc panel of op(B) into GEMM_NR column slivers, zero padding the final sliver.
+// Element (p, c) of a sliver lands at sliver[p * GEMM_NR + c]:
+static void pack_b(gemm_transpose_t trans, const real_t *b, int ldb, int row, int col, int kc, int nc, real_t *packed) {
+    // Distance between consecutive c (columns of op(B)) in memory:
+    const size_t step = (trans == GEMM_NO_TRANS) ? 1 : (size_t)ldb;
+    for (int jr = 0; jr < nc; jr += GEMM_NR) {
+        const int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+        for (int p = 0; p < kc; p++) {
+            const real_t *src = op_element(trans, b, ldb, row + p, col + jr);
+            int c = 0;
+            for (; c < nr; c++) {
+                packed[c] = src[c * step];
+            }
+            for (; c < GEMM_NR; c++) {
+                packed[c] = 0.0;
+            }
+            packed += GEMM_NR;
+        }
+    }
+}
+
+// ////////////////////////////////////  //
+//                 GEMM                  //
+//  ///////////////////////////////////  //
+
+void gemm(gemm_transpose_t trans_a, gemm_transpose_t trans_b, int m, int n, int k,
+    real_t alpha, const real_t *a, int lda, const real_t *b, int ldb, real_t beta, real_t *c, int ldc) {
+
+    // Apply beta up front, so the blocked loops below only ever accumulate into C:
+    for (int i = 0; i < m; i++) {
+        real_t *c_row = c + (size_t)i * ldc;
+        if (beta == 0.0) {
+            memset(c_row, 0, sizeof(real_t) * n);
+        } else if (beta != 1.0) {
+            for (int j = 0; j < n; j++) {
+                c_row[j] *= beta;
+            }
+        }
+    }
+
+    if (alpha == 0.0 || k == 0) {
+        return;
+    }
+
+    const micro_kernel_t micro_kernel = select_micro_kernel();
+    packing_buffers_t *buffers = packing_buffers();
+    real_t *packed_a = buffers->packed_a;
+    real_t *packed_b = buffers->packed_b;
+    real_t tile[GEMM_MR][GEMM_NR];
+
+    for (int jc = 0; jc < n; jc += GEMM_NC) {
+        const int nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+
+        for (int pc = 0; pc < k; pc += GEMM_KC) {
+            const int kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+
+            // The packed B panel is reused by every block of A below:
+            pack_b(trans_b, b, ldb, pc, jc, kc, nc, packed_b);
+
+            for (int ic = 0; ic < m; ic += GEMM_MC) {
+                const int mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+
+                pack_a(trans_a, a, lda, ic, pc, mc, kc, packed_a);
+
+                for (int jr = 0; jr < nc; jr += GEMM_NR) {
+                    const int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+
+                    for (int ir = 0; ir < mc; ir += GEMM_MR) {
+                        const int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+
+                        micro_kernel(kc, packed_a + (size_t)ir * kc, packed_b + (size_t)jr * kc, tile);
+
+                        // Accumulate the (possibly partial) tile into C:
+                        for (int r = 0; r < mr; r++) {
+                            real_t *c_row = c + (size_t)(ic + ir + r) * ldc + jc + jr;
+                            for (int col = 0; col < nr; col++) {
+                                c_row[col] += alpha * tile[r][col];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "real.h"
+
+// General matrix-matrix multiply on row-major matrices:
+// C[m][n] = alpha * op(A)[m][k] * op(B)[k][n] + beta * C[m][n]
+// where op(X) is X or its transpose, and lda/ldb/ldc are the row strides (in elements) of the stored matrices.
+//
+// The product is computed in cache-sized blocks: panels of A and B are packed into contiguous buffers once per block,
+// and a register-tiled micro-kernel (GEMM_MR x GEMM_NR outputs held in registers) streams through them.
+// The micro-kernel is chosen at runtime alongside the other vector kernels (see kernels.h).
+
+typedef enum {
+    GEMM_NO_TRANS,
+    GEMM_TRANS
+} gemm_transpose_t;
+
+void gemm(gemm_transpose_t trans_a, gemm_transpose_t trans_b, int m, int n, int k,
+    real_t alpha, const real_t *a, int lda, const real_t *b, int ldb, real_t beta, real_t *c, int ldc);
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "idx.h"
+
+static uint32_t read_big_endian(const unsigned char *bytes) {
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+}
+
+static int idx_element_size(int type) {
+    switch (type) {
+    case IDX_UBYTE:
+    case IDX_BYTE:
+        return 1;
+    case IDX_SHORT:
+        return 2;
+    case IDX_INT:
+    case IDX_FLOAT:
+        return 4;
+    case IDX_DOUBLE:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+idx_file_t *open_idx(const char *filename) {
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror(filename);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < 4) {
+        fprintf(stderr, "%s: Not an IDX file\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping stays valid after the descriptor is closed:
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(filename);
+        return NULL;
+    }
+
+    const unsigned char *header = (const unsigned char *)map;
+    const int type = header[2];
+    const int dimension_count = header[3];
+    const int element_size = idx_element_size(type);
+    const size_t header_size = 4 + 4 * (size_t)dimension_count;
+
+    if (header[0] != 0 || header[1] != 0 || element_size == 0 || dimension_count < 1 || dimension_count > IDX_MAX_DIMENSIONS ||
+        (size_t)st.st_size < header_size) {
+        fprintf(stderr, "%s: Invalid IDX header\n", filename);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    // Init and zeroise:
+    idx_file_t *idx = (idx_file_t *)malloc(sizeof(*idx));
+    memset(idx, 0, sizeof(*idx));
+
+    idx->map = map;
+    idx->map_size = st.st_size;
+    idx->type = (idx_type_t)type;
+    idx->element_size = element_size;
+    idx->dimension_count = dimension_count;
+
+    size_t element_count = 1;
+    size_t row_size = 1;
+    for (int d = 0; d < dimension_count; d++) {
+        const uint32_t dimension = read_big_endian(header + 4 + 4 * d);
+        if (dimension > INT32_MAX || (dimension > 0 && element_count > SIZE_MAX / element_size / dimension)) {
+            element_count = SIZE_MAX;
+            break;
+        }
+        idx->dimensions[d] = (int)dimension;
+        element_count *= dimension;
+        if (d > 0) {
+            row_size *= dimension;
+        }
+    }
+
+    // The payload must be exactly what the header describes, so a truncated download is caught here and not mid-epoch:
+    if (element_count == SIZE_MAX || row_size > INT32_MAX || header_size + element_count * element_size != (size_t)st.st_size) {
+        fprintf(stderr, "%s: IDX payload does not match its header\n", filename);
+        munmap(map, st.st_size);
+        free(idx);
+        return NULL;
+    }
+
+    idx->count = idx->dimensions[0];
+    idx->row_size = (int)row_size;
+    idx->data = header + header_size;
+
+    return idx;
+}
+
+void close_idx(idx_file_t *idx) {
+    if (!idx) {
+        return;
+    }
+    munmap(idx->map, idx->map_size);
+    free(idx);
+}
@@ -0,0 +1,50 @@
+#ifndef IDX_H
+#define IDX_H
+
+#include <stddef.h>
+
+// Read-only, zero-copy view of an IDX file (the format MNIST ships in).
+//
+// The file is mmap'd rather than read, so opening is O(1) and pages are only faulted in (and only kept resident)
+// as the data is touched. The header is a 4 byte magic (two zero bytes, an element type code and the number of
+// dimensions) followed by one big-endian uint32 per dimension; the elements follow immediately.
+
+typedef enum {
+    IDX_UBYTE = 0x08,
+    IDX_BYTE = 0x09,
+    IDX_SHORT = 0x0B,
+    IDX_INT = 0x0C,
+    IDX_FLOAT = 0x0D,
+    IDX_DOUBLE = 0x0E
+} idx_type_t;
+
+#define IDX_MAX_DIMENSIONS 4
+
+typedef struct idx_file_t {
+    void *map;
+    size_t map_size;
+
+    idx_type_t type;
+    int element_size;
+    int dimension_count;
+    int dimensions[IDX_MAX_DIMENSIONS];
+
+    // The first dimension indexes the items (images, labels);
+    // the rest are flattened into one row of row_size elements:
+    int count;
+    int row_size;
+
+    // First element, directly inside the mapping (elements wider than a byte are still big-endian):
+    const void *data;
+} idx_file_t;
+
+// Map and validate an IDX file. Returns NULL (after printing why) if it can't be opened or is malformed.
+idx_file_t *open_idx(const char *filename);
+void close_idx(idx_file_t *idx);
+
+// Row i of a ubyte file:
+static inline const unsigned char *idx_row(const idx_file_t *idx, int i) {
+    return (const unsigned char *)idx->data + (size_t)i * idx->row_size;
+}
+
+#endif
@@ -0,0 +1,913 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "kernels.h"
+
+#include "simd.h"
+
+// ////////////////////////////////////  //
+//                Scalar                 //
+//  ///////////////////////////////////  //
+
+static real_t dot_scalar(const real_t *a, const real_t *b, int n) {
+    real_t sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void axpy_scalar(real_t alpha, const real_t *x, real_t *y, int n) {
+    for (int i = 0; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+static void widen_u8_scalar(real_t alpha, const unsigned char *x, real_t *y, int n) {
+    for (int i = 0; i < n; i++) {
+        y[i] = alpha * x[i];
+    }
+}
+
+static real_t sparse_dot_scalar(const real_t *values, const int *columns, const real_t *y, int n) {
+    real_t sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        sum += values[i] * y[columns[i]];
+    }
+    return sum;
+}
+
+static void sparse_axpy_scalar(real_t alpha, const real_t *values, const int *columns, real_t *y, int n) {
+    for (int i = 0; i < n; i++) {
+        y[columns[i]] += alpha * values[i];
+    }
+}
+
+// The same functions as perceptron.c, one element at a time (these also finish the tails of the vector versions):
+static inline real_t activate_element(activation_type_t type, real_t x) {
+    switch (type) {
+    case ACTIVATION_RELU:
+        return x > 0 ? x : 0;
+    case ACTIVATION_SIGMOID:
+        return 1.0 / (1.0 + exp(-x));
+    case ACTIVATION_STEP:
+        return x < 0 ? 0 : 1;
+    case ACTIVATION_SIGN:
+        return x < 0 ? -1 : 1;
+    default:
+        return x;
+    }
+}
+
+static inline real_t derivative_element(activation_type_t type, real_t a) {
+    switch (type) {
+    case ACTIVATION_LINEAR:
+        return 1;
+    case ACTIVATION_RELU:
+        return a > 0 ? 1 : 0;
+    case ACTIVATION_SIGMOID:
+        return a * (1.0 - a);
+    default:
+        return 0;
+    }
+}
+
+static void activate_scalar(activation_type_t type, real_t *x, int n) {
+    for (int i = 0; i < n; i++) {
+        x[i] = activate_element(type, x[i]);
+    }
+}
+
+static void activation_derivative_scalar(activation_type_t type, const real_t *a, real_t *dLdz, int n) {
+    for (int i = 0; i < n; i++) {
+        dLdz[i] *= derivative_element(type, a[i]);
+    }
+}
+
+static real_t max_scalar(const real_t *x, int n) {
+    real_t max = x[0];
+    for (int i = 1; i < n; i++) {
+        max = x[i] > max ? x[i] : max;
+    }
+    return max;
+}
+
+// Subtracting the largest value first keeps every exponent <= 0, so nothing overflows:
+static void softmax_scalar(real_t *x, int n) {
+    const real_t max = max_scalar(x, n);
+    real_t sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        x[i] = exp(x[i] - max);
+        sum += x[i];
+    }
+    const real_t scale = 1.0 / sum;
+    for (int i = 0; i < n; i++) {
+        x[i] *= scale;
+    }
+}
+
+static void momentum_scalar(real_t *w, const real_t *g, real_t *velocity, int n, real_t learning_rate, real_t momentum, int nesterov) {
+    for (int i = 0; i < n; i++) {
+        velocity[i] = momentum * velocity[i] + g[i];
+        w[i] -= learning_rate * (nesterov ? g[i] + momentum * velocity[i] : velocity[i]);
+    }
+}
+
+static void adam_scalar(real_t *w, const real_t *g, real_t *m, real_t *v, int n, real_t step_size, real_t beta1, real_t beta2, real_t epsilon) {
+    for (int i = 0; i < n; i++) {
+        m[i] = beta1 * m[i] + (1 - beta1) * g[i];
+        v[i] = beta2 * v[i] + (1 - beta2) * g[i] * g[i];
+        w[i] -= step_size * m[i] / (sqrt(v[i]) + epsilon);
+    }
+}
+
+// The random kernels compute low + (high - low) * u in double with a single rounding (an FMA, or fma() here) before
+// narrowing to real_t, so every ISA produces exactly the same values from the same lanes:
+static double random_lane_unit(mlp_random_lanes_t *lanes, int l) {
+    mlp_random_t lane = {{lanes->s[0][l], lanes->s[1][l], lanes->s[2][l], lanes->s[3][l]}};
+    const uint64_t result = mlp_random_next(&lane);
+    for (int w = 0; w < 4; w++) {
+        lanes->s[w][l] = lane.s[w];
+    }
+    // The top 52 bits as the mantissa of a double in [1, 2), which the vector versions can build without a
+    // 64-bit integer conversion:
+    const uint64_t bits = (result >> 12) | 0x3FF0000000000000ULL;
+    double unit;
+    memcpy(&unit, &bits, sizeof(unit));
+    return unit - 1.0;
+}
+
+static void random_uniform_scalar(mlp_random_lanes_t *lanes, real_t *x, int n, real_t low, real_t high) {
+    const double scale = (double)high - low;
+    for (int i = 0; i < n; i += MLP_RANDOM_LANES) {
+        // Every lane steps, even past the end, as the vector versions' do:
+        for (int l = 0; l < MLP_RANDOM_LANES; l++) {
+            const double unit = random_lane_unit(lanes, l);
+            if (i + l < n) {
+                x[i + l] = (real_t)fma(scale, unit, low);
+            }
+        }
+    }
+}
+
+// Taylor coefficients 1/k! of e^r, used by the vector exp below:
+static const double exp_taylor[] = {
+    1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320,
+    1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600
+};
+
+#ifdef SIMD_X86
+
+// ////////////////////////////////////  //
+//                 SSE2                  //
+//  ///////////////////////////////////  //
+
+__attribute__((target("sse2")))
+static real_t dot_sse2(const real_t *a, const real_t *b, int n) {
+    v128_t acc0 = v128_zero();
+    v128_t acc1 = v128_zero();
+    int i = 0;
+    for (; i + 2 * V128_LANES <= n; i += 2 * V128_LANES) {
+        acc0 = v128_add(acc0, v128_mul(v128_loadu(a + i), v128_loadu(b + i)));
+        acc1 = v128_add(acc1, v128_mul(v128_loadu(a + i + V128_LANES), v128_loadu(b + i + V128_LANES)));
+    }
+    real_t sum = v128_reduce_add(v128_add(acc0, acc1));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("sse2")))
+static void axpy_sse2(real_t alpha, const real_t *x, real_t *y, int n) {
+    const v128_t va = v128_set1(alpha);
+    int i = 0;
+    for (; i + V128_LANES <= n; i += V128_LANES) {
+        v128_storeu(y + i, v128_add(v128_loadu(y + i), v128_mul(va, v128_loadu(x + i))));
+    }
+    for (; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+// ////////////////////////////////////  //
+//               AVX2 + FMA              //
+//  ///////////////////////////////////  //
+
+__attribute__((target("avx2,fma")))
+static real_t dot_avx2(const real_t *a, const real_t *b, int n) {
+    // Four independent accumulators hide the FMA latency:
+    v256_t acc0 = v256_zero();
+    v256_t acc1 = v256_zero();
+    v256_t acc2 = v256_zero();
+    v256_t acc3 = v256_zero();
+    int i = 0;
+    for (; i + 4 * V256_LANES <= n; i += 4 * V256_LANES) {
+        acc0 = v256_fmadd(v256_loadu(a + i), v256_loadu(b + i), acc0);
+        acc1 = v256_fmadd(v256_loadu(a + i + V256_LANES), v256_loadu(b + i + V256_LANES), acc1);
+        acc2 = v256_fmadd(v256_loadu(a + i + 2 * V256_LANES), v256_loadu(b + i + 2 * V256_LANES), acc2);
+        acc3 = v256_fmadd(v256_loadu(a + i + 3 * V256_LANES), v256_loadu(b + i + 3 * V256_LANES), acc3);
+    }
+    for (; i + V256_LANES <= n; i += V256_LANES) {
+        acc0 = v256_fmadd(v256_loadu(a + i), v256_loadu(b + i), acc0);
+    }
+    real_t sum = v256_reduce_add(v256_add(v256_add(acc0, acc1), v256_add(acc2, acc3)));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void axpy_avx2(real_t alpha, const real_t *x, real_t *y, int n) {
+    const v256_t va = v256_set1(alpha);
+    int i = 0;
+    for (; i + 2 * V256_LANES <= n; i += 2 * V256_LANES) {
+        v256_storeu(y + i, v256_fmadd(va, v256_loadu(x + i), v256_loadu(y + i)));
+        v256_storeu(y + i + V256_LANES, v256_fmadd(va, v256_loadu(x + i + V256_LANES), v256_loadu(y + i + V256_LANES)));
+    }
+    for (; i + V256_LANES <= n; i += V256_LANES) {
+        v256_storeu(y + i, v256_fmadd(va, v256_loadu(x + i), v256_loadu(y + i)));
+    }
+    for (; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+__attribute__((target("avx2")))
+static void widen_u8_avx2(real_t alpha, const unsigned char *x, real_t *y, int n) {
+    const v256_t va = v256_set1(alpha);
+    int i = 0;
+    for (; i + V256_LANES <= n; i += V256_LANES) {
+        v256_storeu(y + i, v256_mul(va, v256_loadu_u8(x + i)));
+    }
+    for (; i < n; i++) {
+        y[i] = alpha * x[i];
+    }
+}
+
+// e^x per lane: x = n * ln2 + r with |r| <= ln2 / 2, so e^x = 2^n * e^r, with e^r from its Taylor series:
+__attribute__((target("avx2,fma")))
+static inline v256_t exp_avx2(v256_t x) {
+    x = v256_min(v256_max(x, v256_set1(-EXP_LIMIT)), v256_set1(EXP_LIMIT));
+    const v256_t n = v256_round(v256_mul(x, v256_set1(M_LOG2E)));
+    const v256_t r = v256_fnmadd(n, v256_set1(EXP_LN2_LO), v256_fnmadd(n, v256_set1(EXP_LN2_HI), x));
+    v256_t p = v256_set1(exp_taylor[EXP_DEGREE]);
+    for (int k = EXP_DEGREE - 1; k >= 0; k--) {
+        p = v256_fmadd(p, r, v256_set1(exp_taylor[k]));
+    }
+    return v256_mul(p, v256_pow2i(n));
+}
+
+__attribute__((target("avx2,fma")))
+static inline v256_t activate_v256(activation_type_t type, v256_t x) {
+    const v256_t one = v256_set1(1.0);
+    switch (type) {
+    case ACTIVATION_RELU:
+        return v256_max(x, v256_zero());
+    case ACTIVATION_SIGMOID:
+        return v256_div(one, v256_add(one, exp_avx2(v256_sub(v256_zero(), x))));
+    case ACTIVATION_STEP:
+        return v256_and(v256_cmp(x, v256_zero(), _CMP_NLT_UQ), one);
+    case ACTIVATION_SIGN:
+        return v256_blendv(one, v256_set1(-1.0), v256_cmp(x, v256_zero(), _CMP_LT_OQ));
+    default:
+        return x;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void activate_avx2(activation_type_t type, real_t *x, int n) {
+    if (type == ACTIVATION_LINEAR) {
+        return;
+    }
+    int i = 0;
+    for (; i + V256_LANES <= n; i += V256_LANES) {
+        v256_storeu(x + i, activate_v256(type, v256_loadu(x + i)));
+    }
+    for (; i < n; i++) {
+        x[i] = activate_element(type, x[i]);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void activation_derivative_avx2(activation_type_t type, const real_t *a, real_t *dLdz, int n) {
+    if (type == ACTIVATION_LINEAR) {
+        return;
+    }
+    const v256_t one = v256_set1(1.0);
+    int i = 0;
+    for (; i + V256_LANES <= n; i += V256_LANES) {
+        const v256_t va = v256_loadu(a + i);
+        const v256_t vd = v256_loadu(dLdz + i);
+        if (type == ACTIVATION_RELU) {
+            v256_storeu(dLdz + i, v256_and(vd, v256_cmp(va, v256_zero(), _CMP_GT_OQ)));
+        } else if (type == ACTIVATION_SIGMOID) {
+            v256_storeu(dLdz + i, v256_mul(vd, v256_mul(va, v256_sub(one, va))));
+        } else {
+            v256_storeu(dLdz + i, v256_zero());
+        }
+    }
+    for (; i < n; i++) {
+        dLdz[i] *= derivative_element(type, a[i]);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void softmax_avx2(real_t *x, int n) {
+    const real_t max = max_scalar(x, n);
+    const v256_t vmax = v256_set1(max);
+    v256_t acc = v256_zero();
+    int i = 0;
+    for (; i + V256_LANES <= n; i += V256_LANES) {
+        const v256_t e = exp_avx2(v256_sub(v256_loadu(x + i), vmax));
+        v256_storeu(x + i, e);
+        acc = v256_add(acc, e);
+    }
+    real_t sum = v256_reduce_add(acc);
+    for (; i < n; i++) {
+        x[i] = exp(x[i] - max);
+        sum += x[i];
+    }
+    const real_t scale = 1.0 / sum;
+    const v256_t vscale = v256_set1(scale);
+    for (i = 0; i + V256_LANES <= n; i += V256_LANES) {
+        v256_storeu(x + i, v256_mul(v256_loadu(x + i), vscale));
+    }
+    for (; i < n; i++) {
+        x[i] *= scale;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void momentum_avx2(real_t *w, const real_t *g, real_t *velocity, int n, real_t learning_rate, real_t momentum, int nesterov) {
+    const v256_t vlr = v256_set1(learning_rate);
+    const v256_t vmu = v256_set1(momentum);
+    int i = 0;
+    for (; i + V256_LANES <= n; i += V256_LANES) {
+        const v256_t vg = v256_loadu(g + i);
+        const v256_t vv = v256_fmadd(vmu, v256_loadu(velocity + i), vg);
+        const v256_t step = nesterov ? v256_fmadd(vmu, vv, vg) : vv;
+        v256_storeu(velocity + i, vv);
+        v256_storeu(w + i, v256_fnmadd(vlr, step, v256_loadu(w + i)));
+    }
+    momentum_scalar(w + i, g + i, velocity + i, n - i, learning_rate, momentum, nesterov);
+}
+
+__attribute__((target("avx2,fma")))
+static void adam_avx2(real_t *w, const real_t *g, real_t *m, real_t *v, int n, real_t step_size, real_t beta1, real_t beta2, real_t epsilon) {
+    const v256_t vstep = v256_set1(step_size);
+    const v256_t vb1 = v256_set1(beta1);
+    const v256_t vb2 = v256_set1(beta2);
+    const v256_t vc1 = v256_set1(1 - beta1);
+    const v256_t vc2 = v256_set1(1 - beta2);
+    const v256_t veps = v256_set1(epsilon);
+    int i = 0;
+    for (; i + V256_LANES <= n; i += V256_LANES) {
+        const v256_t vg = v256_loadu(g + i);
+        const v256_t vm = v256_fmadd(vb1, v256_loadu(m + i), v256_mul(vc1, vg));
+        const v256_t vv = v256_fmadd(vb2, v256_loadu(v + i), v256_mul(vc2, v256_mul(vg, vg)));
+        v256_storeu(m + i, vm);
+        v256_storeu(v + i, vv);
+        const v256_t update = v256_div(vm, v256_add(v256_sqrt(vv), veps));
+        v256_storeu(w + i, v256_fnmadd(vstep, update, v256_loadu(w + i)));
+    }
+    adam_scalar(w + i, g + i, m + i, v + i, n - i, step_size, beta1, beta2, epsilon);
+}
+
+__attribute__((target("avx2,fma")))
+static real_t sparse_dot_avx2(const real_t *values, const int *columns, const real_t *y, int n) {
+    v256_t acc0 = v256_zero();
+    v256_t acc1 = v256_zero();
+    int i = 0;
+    for (; i + 2 * V256_LANES <= n; i += 2 * V256_LANES) {
+        acc0 = v256_fmadd(v256_loadu(values + i), v256_gather(y, columns + i), acc0);
+        acc1 = v256_fmadd(v256_loadu(values + i + V256_LANES), v256_gather(y, columns + i + V256_LANES), acc1);
+    }
+    real_t sum = v256_reduce_add(v256_add(acc0, acc1));
+    for (; i < n; i++) {
+        sum += values[i] * y[columns[i]];
+    }
+    return sum;
+}
+
+// One step of four xoshiro256++ lanes (state words s[0..3]), as uniform doubles in [0, 1):
+__attribute__((target("avx2")))
+static inline __m256d random_unit_avx2(__m256i s[4]) {
+    const __m256i sum = _mm256_add_epi64(s[0], s[3]);
+    const __m256i result = _mm256_add_epi64(_mm256_or_si256(_mm256_slli_epi64(sum, 23), _mm256_srli_epi64(sum, 41)), s[0]);
+    const __m256i t = _mm256_slli_epi64(s[1], 17);
+    s[2] = _mm256_xor_si256(s[2], s[0]);
+    s[3] = _mm256_xor_si256(s[3], s[1]);
+    s[1] = _mm256_xor_si256(s[1], s[2]);
+    s[0] = _mm256_xor_si256(s[0], s[3]);
+    s[2] = _mm256_xor_si256(s[2], t);
+    s[3] = _mm256_or_si256(_mm256_slli_epi64(s[3], 45), _mm256_srli_epi64(s[3], 19));
+    const __m256i bits = _mm256_or_si256(_mm256_srli_epi64(result, 12), _mm256_set1_epi64x(0x3FF0000000000000LL));
+    return _mm256_sub_pd(_mm256_castsi256_pd(bits), _mm256_set1_pd(1.0));
+}
+
+// Narrow (if need be) and store eight doubles:
+__attribute__((target("avx2")))
+static inline void random_store_avx2(real_t *x, __m256d a, __m256d b) {
+#ifdef MLP_FLOAT32
+    _mm_storeu_ps(x, _mm256_cvtpd_ps(a));
+    _mm_storeu_ps(x + 4, _mm256_cvtpd_ps(b));
+#else
+    _mm256_storeu_pd(x, a);
+    _mm256_storeu_pd(x + 4, b);
+#endif
+}
+
+// The eight lanes as two halves of four:
+__attribute__((target("avx2,fma")))
+static void random_uniform_avx2(mlp_random_lanes_t *lanes, real_t *x, int n, real_t low, real_t high) {
+    __m256i lower[4], upper[4];
+    for (int w = 0; w < 4; w++) {
+        lower[w] = _mm256_loadu_si256((const __m256i *)&lanes->s[w][0]);
+        upper[w] = _mm256_loadu_si256((const __m256i *)&lanes->s[w][4]);
+    }
+    const __m256d vlow = _mm256_set1_pd(low);
+    const __m256d vscale = _mm256_set1_pd((double)high - low);
+    for (int i = 0; i < n; i += MLP_RANDOM_LANES) {
+        const __m256d a = _mm256_fmadd_pd(vscale, random_unit_avx2(lower), vlow);
+        const __m256d b = _mm256_fmadd_pd(vscale, random_unit_avx2(upper), vlow);
+        if (i + MLP_RANDOM_LANES <= n) {
+            random_store_avx2(x + i, a, b);
+        } else {
+            real_t tail[MLP_RANDOM_LANES];
+            random_store_avx2(tail, a, b);
+            memcpy(x + i, tail, sizeof(real_t) * (n - i));
+        }
+    }
+    for (int w = 0; w < 4; w++) {
+        _mm256_storeu_si256((__m256i *)&lanes->s[w][0], lower[w]);
+        _mm256_storeu_si256((__m256i *)&lanes->s[w][4], upper[w]);
+    }
+}
+
+// ////////////////////////////////////  //
+//                AVX-512                //
+//  ///////////////////////////////////  //
+
+__attribute__((target("avx512f")))
+static real_t dot_avx512(const real_t *a, const real_t *b, int n) {
+    v512_t acc0 = v512_zero();
+    v512_t acc1 = v512_zero();
+    int i = 0;
+    for (; i + 2 * V512_LANES <= n; i += 2 * V512_LANES) {
+        acc0 = v512_fmadd(v512_loadu(a + i), v512_loadu(b + i), acc0);
+        acc1 = v512_fmadd(v512_loadu(a + i + V512_LANES), v512_loadu(b + i + V512_LANES), acc1);
+    }
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        acc0 = v512_fmadd(v512_loadu(a + i), v512_loadu(b + i), acc0);
+    }
+    // Masked loads pick up the tail without a scalar loop:
+    if (i < n) {
+        const v512_mask_t mask = (v512_mask_t)((1u << (n - i)) - 1);
+        acc1 = v512_fmadd(v512_maskz_loadu(mask, a + i), v512_maskz_loadu(mask, b + i), acc1);
+    }
+    return v512_reduce_add(v512_add(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+static void axpy_avx512(real_t alpha, const real_t *x, real_t *y, int n) {
+    const v512_t va = v512_set1(alpha);
+    int i = 0;
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        v512_storeu(y + i, v512_fmadd(va, v512_loadu(x + i), v512_loadu(y + i)));
+    }
+    if (i < n) {
+        const v512_mask_t mask = (v512_mask_t)((1u << (n - i)) - 1);
+        v512_t vy = v512_maskz_loadu(mask, y + i);
+        vy = v512_fmadd(va, v512_maskz_loadu(mask, x + i), vy);
+        v512_mask_storeu(y + i, mask, vy);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void widen_u8_avx512(real_t alpha, const unsigned char *x, real_t *y, int n) {
+    const v512_t va = v512_set1(alpha);
+    int i = 0;
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        v512_storeu(y + i, v512_mul(va, v512_loadu_u8(x + i)));
+    }
+    // A masked byte load would need AVX-512BW, so the (short) tail is scalar:
+    for (; i < n; i++) {
+        y[i] = alpha * x[i];
+    }
+}
+
+// As exp_avx2, with the 2^n scaling done by scalef:
+__attribute__((target("avx512f")))
+static inline v512_t exp_avx512(v512_t x) {
+    x = v512_min(v512_max(x, v512_set1(-EXP_LIMIT)), v512_set1(EXP_LIMIT));
+    const v512_t n = v512_round(v512_mul(x, v512_set1(M_LOG2E)));
+    const v512_t r = v512_fnmadd(n, v512_set1(EXP_LN2_LO), v512_fnmadd(n, v512_set1(EXP_LN2_HI), x));
+    v512_t p = v512_set1(exp_taylor[EXP_DEGREE]);
+    for (int k = EXP_DEGREE - 1; k >= 0; k--) {
+        p = v512_fmadd(p, r, v512_set1(exp_taylor[k]));
+    }
+    return v512_scalef(p, n);
+}
+
+__attribute__((target("avx512f")))
+static inline v512_t activate_v512(activation_type_t type, v512_t x) {
+    const v512_t one = v512_set1(1.0);
+    switch (type) {
+    case ACTIVATION_RELU:
+        return v512_max(x, v512_zero());
+    case ACTIVATION_SIGMOID:
+        return v512_div(one, v512_add(one, exp_avx512(v512_sub(v512_zero(), x))));
+    case ACTIVATION_STEP:
+        return v512_maskz_mov(v512_cmp_mask(x, v512_zero(), _CMP_NLT_UQ), one);
+    case ACTIVATION_SIGN:
+        return v512_mask_blend(v512_cmp_mask(x, v512_zero(), _CMP_LT_OQ), one, v512_set1(-1.0));
+    default:
+        return x;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void activate_avx512(activation_type_t type, real_t *x, int n) {
+    if (type == ACTIVATION_LINEAR) {
+        return;
+    }
+    int i = 0;
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        v512_storeu(x + i, activate_v512(type, v512_loadu(x + i)));
+    }
+    if (i < n) {
+        const v512_mask_t mask = (v512_mask_t)((1u << (n - i)) - 1);
+        v512_mask_storeu(x + i, mask, activate_v512(type, v512_maskz_loadu(mask, x + i)));
+    }
+}
+
+__attribute__((target("avx512f")))
+static inline v512_t activation_derivative_v512(activation_type_t type, v512_t a, v512_t dLdz) {
+    switch (type) {
+    case ACTIVATION_RELU:
+        return v512_maskz_mov(v512_cmp_mask(a, v512_zero(), _CMP_GT_OQ), dLdz);
+    case ACTIVATION_SIGMOID:
+        return v512_mul(dLdz, v512_mul(a, v512_sub(v512_set1(1.0), a)));
+    default:
+        return v512_zero();
+    }
+}
+
+__attribute__((target("avx512f")))
+static void activation_derivative_avx512(activation_type_t type, const real_t *a, real_t *dLdz, int n) {
+    if (type == ACTIVATION_LINEAR) {
+        return;
+    }
+    int i = 0;
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        v512_storeu(dLdz + i, activation_derivative_v512(type, v512_loadu(a + i), v512_loadu(dLdz + i)));
+    }
+    if (i < n) {
+        const v512_mask_t mask = (v512_mask_t)((1u << (n - i)) - 1);
+        v512_mask_storeu(dLdz + i, mask, activation_derivative_v512(type, v512_maskz_loadu(mask, a + i), v512_maskz_loadu(mask, dLdz + i)));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void softmax_avx512(real_t *x, int n) {
+    const v512_t vmax = v512_set1(max_scalar(x, n));
+    v512_t acc = v512_zero();
+    int i = 0;
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        const v512_t e = exp_avx512(v512_sub(v512_loadu(x + i), vmax));
+        v512_storeu(x + i, e);
+        acc = v512_add(acc, e);
+    }
+    if (i < n) {
+        const v512_mask_t mask = (v512_mask_t)((1u << (n - i)) - 1);
+        const v512_t e = v512_maskz_mov(mask, exp_avx512(v512_sub(v512_maskz_loadu(mask, x + i), vmax)));
+        v512_mask_storeu(x + i, mask, e);
+        acc = v512_add(acc, e);
+    }
+    const v512_t vscale = v512_set1(1.0 / v512_reduce_add(acc));
+    for (i = 0; i + V512_LANES <= n; i += V512_LANES) {
+        v512_storeu(x + i, v512_mul(v512_loadu(x + i), vscale));
+    }
+    if (i < n) {
+        const v512_mask_t mask = (v512_mask_t)((1u << (n - i)) - 1);
+        v512_mask_storeu(x + i, mask, v512_mul(v512_maskz_loadu(mask, x + i), vscale));
+    }
+}
+
+__attribute__((target("avx512f")))
+static inline void momentum_v512(real_t *w, const real_t *g, real_t *velocity, v512_mask_t mask,
+    v512_t vlr, v512_t vmu, int nesterov) {
+    const v512_t vg = v512_maskz_loadu(mask, g);
+    const v512_t vv = v512_fmadd(vmu, v512_maskz_loadu(mask, velocity), vg);
+    const v512_t step = nesterov ? v512_fmadd(vmu, vv, vg) : vv;
+    v512_mask_storeu(velocity, mask, vv);
+    v512_mask_storeu(w, mask, v512_fnmadd(vlr, step, v512_maskz_loadu(mask, w)));
+}
+
+__attribute__((target("avx512f")))
+static void momentum_avx512(real_t *w, const real_t *g, real_t *velocity, int n, real_t learning_rate, real_t momentum, int nesterov) {
+    const v512_t vlr = v512_set1(learning_rate);
+    const v512_t vmu = v512_set1(momentum);
+    const v512_mask_t all = (v512_mask_t)~0u;
+    int i = 0;
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        momentum_v512(w + i, g + i, velocity + i, all, vlr, vmu, nesterov);
+    }
+    if (i < n) {
+        momentum_v512(w + i, g + i, velocity + i, (v512_mask_t)((1u << (n - i)) - 1), vlr, vmu, nesterov);
+    }
+}
+
+__attribute__((target("avx512f")))
+static inline void adam_v512(real_t *w, const real_t *g, real_t *m, real_t *v, v512_mask_t mask,
+    v512_t vstep, v512_t vb1, v512_t vb2, v512_t veps) {
+    const v512_t one = v512_set1(1.0);
+    const v512_t vg = v512_maskz_loadu(mask, g);
+    const v512_t vm = v512_fmadd(vb1, v512_maskz_loadu(mask, m), v512_mul(v512_sub(one, vb1), vg));
+    const v512_t vv = v512_fmadd(vb2, v512_maskz_loadu(mask, v), v512_mul(v512_sub(one, vb2), v512_mul(vg, vg)));
+    v512_mask_storeu(m, mask, vm);
+    v512_mask_storeu(v, mask, vv);
+    const v512_t update = v512_div(vm, v512_add(v512_sqrt(vv), veps));
+    v512_mask_storeu(w, mask, v512_fnmadd(vstep, update, v512_maskz_loadu(mask, w)));
+}
+
+__attribute__((target("avx512f")))
+static void adam_avx512(real_t *w, const real_t *g, real_t *m, real_t *v, int n, real_t step_size, real_t beta1, real_t beta2, real_t epsilon) {
+    const v512_t vstep = v512_set1(step_size);
+    const v512_t vb1 = v512_set1(beta1);
+    const v512_t vb2 = v512_set1(beta2);
+    const v512_t veps = v512_set1(epsilon);
+    const v512_mask_t all = (v512_mask_t)~0u;
+    int i = 0;
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        adam_v512(w + i, g + i, m + i, v + i, all, vstep, vb1, vb2, veps);
+    }
+    if (i < n) {
+        adam_v512(w + i, g + i, m + i, v + i, (v512_mask_t)((1u << (n - i)) - 1), vstep, vb1, vb2, veps);
+    }
+}
+
+__attribute__((target("avx512f")))
+static real_t sparse_dot_avx512(const real_t *values, const int *columns, const real_t *y, int n) {
+    v512_t acc0 = v512_zero();
+    v512_t acc1 = v512_zero();
+    int i = 0;
+    for (; i + 2 * V512_LANES <= n; i += 2 * V512_LANES) {
+        acc0 = v512_fmadd(v512_loadu(values + i), v512_gather(y, columns + i), acc0);
+        acc1 = v512_fmadd(v512_loadu(values + i + V512_LANES), v512_gather(y, columns + i + V512_LANES), acc1);
+    }
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        acc0 = v512_fmadd(v512_loadu(values + i), v512_gather(y, columns + i), acc0);
+    }
+    real_t sum = v512_reduce_add(v512_add(acc0, acc1));
+    for (; i < n; i++) {
+        sum += values[i] * y[columns[i]];
+    }
+    return sum;
+}
+
+// The columns of one row are distinct, so the lanes of a scatter never collide:
+__attribute__((target("avx512f")))
+static void sparse_axpy_avx512(real_t alpha, const real_t *values, const int *columns, real_t *y, int n) {
+    const v512_t va = v512_set1(alpha);
+    int i = 0;
+    for (; i + V512_LANES <= n; i += V512_LANES) {
+        v512_scatter(y, columns + i, v512_fmadd(va, v512_loadu(values + i), v512_gather(y, columns + i)));
+    }
+    for (; i < n; i++) {
+        y[columns[i]] += alpha * values[i];
+    }
+}
+
+// As random_unit_avx2, with all eight lanes in one register and a native rotate:
+__attribute__((target("avx512f")))
+static inline __m512d random_unit_avx512(__m512i s[4]) {
+    const __m512i result = _mm512_add_epi64(_mm512_rol_epi64(_mm512_add_epi64(s[0], s[3]), 23), s[0]);
+    const __m512i t = _mm512_slli_epi64(s[1], 17);
+    s[2] = _mm512_xor_si512(s[2], s[0]);
+    s[3] = _mm512_xor_si512(s[3], s[1]);
+    s[1] = _mm512_xor_si512(s[1], s[2]);
+    s[0] = _mm512_xor_si512(s[0], s[3]);
+    s[2] = _mm512_xor_si512(s[2], t);
+    s[3] = _mm512_rol_epi64(s[3], 45);
+    const __m512i bits = _mm512_or_si512(_mm512_srli_epi64(result, 12), _mm512_set1_epi64(0x3FF0000000000000LL));
+    return _mm512_sub_pd(_mm512_castsi512_pd(bits), _mm512_set1_pd(1.0));
+}
+
+__attribute__((target("avx512f")))
+static inline void random_store_avx512(real_t *x, __m512d v) {
+#ifdef MLP_FLOAT32
+    _mm256_storeu_ps(x, _mm512_cvtpd_ps(v));
+#else
+    _mm512_storeu_pd(x, v);
+#endif
+}
+
+__attribute__((target("avx512f")))
+static void random_uniform_avx512(mlp_random_lanes_t *lanes, real_t *x, int n, real_t low, real_t high) {
+    __m512i s[4];
+    for (int w = 0; w < 4; w++) {
+        s[w] = _mm512_loadu_si512(lanes->s[w]);
+    }
+    const __m512d vlow = _mm512_set1_pd(low);
+    const __m512d vscale = _mm512_set1_pd((double)high - low);
+    for (int i = 0; i < n; i += MLP_RANDOM_LANES) {
+        const __m512d v = _mm512_fmadd_pd(vscale, random_unit_avx512(s), vlow);
+        if (i + MLP_RANDOM_LANES <= n) {
+            random_store_avx512(x + i, v);
+        } else {
+            real_t tail[MLP_RANDOM_LANES];
+            random_store_avx512(tail, v);
+            memcpy(x + i, tail, sizeof(real_t) * (n - i));
+        }
+    }
+    for (int w = 0; w < 4; w++) {
+        _mm512_storeu_si512(lanes->s[w], s[w]);
+    }
+}
+
+#endif
+
+// ////////////////////////////////////  //
+//               Dispatch                //
+//  ///////////////////////////////////  //
+
+static const char *isa_names[] = {"scalar", "sse2", "avx2", "avx512"};
+static kernel_isa_t selected_isa = ISA_SCALAR;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// Until init_kernels() runs, the kernel pointers refer to these stubs, which select the real implementation
+// on first use and forward the call. Several threads may get here at once, so the selection runs under pthread_once:
+static real_t dot_resolve(const real_t *a, const real_t *b, int n) {
+    init_kernels();
+    return vector_dot(a, b, n);
+}
+
+static void axpy_resolve(real_t alpha, const real_t *x, real_t *y, int n) {
+    init_kernels();
+    vector_axpy(alpha, x, y, n);
+}
+
+static void widen_u8_resolve(real_t alpha, const unsigned char *x, real_t *y, int n) {
+    init_kernels();
+    vector_widen_u8(alpha, x, y, n);
+}
+
+real_t (*vector_dot)(const real_t *a, const real_t *b, int n) = dot_resolve;
+void (*vector_axpy)(real_t alpha, const real_t *x, real_t *y, int n) = axpy_resolve;
+static real_t sparse_dot_resolve(const real_t *values, const int *columns, const real_t *y, int n) {
+    init_kernels();
+    return sparse_dot(values, columns, y, n);
+}
+
+static void activate_resolve(activation_type_t type, real_t *x, int n) {
+    init_kernels();
+    vector_activate(type, x, n);
+}
+
+static void activation_derivative_resolve(activation_type_t type, const real_t *a, real_t *dLdz, int n) {
+    init_kernels();
+    vector_activation_derivative(type, a, dLdz, n);
+}
+
+static void softmax_resolve(real_t *x, int n) {
+    init_kernels();
+    vector_softmax(x, n);
+}
+
+static void momentum_resolve(real_t *w, const real_t *g, real_t *velocity, int n, real_t learning_rate, real_t momentum, int nesterov) {
+    init_kernels();
+    optimizer_momentum(w, g, velocity, n, learning_rate, momentum, nesterov);
+}
+
+static void adam_resolve(real_t *w, const real_t *g, real_t *m, real_t *v, int n, real_t step_size, real_t beta1, real_t beta2, real_t epsilon) {
+    init_kernels();
+    optimizer_adam(w, g, m, v, n, step_size, beta1, beta2, epsilon);
+}
+
+static void sparse_axpy_resolve(real_t alpha, const real_t *values, const int *columns, real_t *y, int n) {
+    init_kernels();
+    sparse_axpy(alpha, values, columns, y, n);
+}
+
+static void random_uniform_resolve(mlp_random_lanes_t *lanes, real_t *x, int n, real_t low, real_t high) {
+    init_kernels();
+    vector_random_uniform(lanes, x, n, low, high);
+}
+
+void (*vector_widen_u8)(real_t alpha, const unsigned char *x, real_t *y, int n) = widen_u8_resolve;
+real_t (*sparse_dot)(const real_t *values, const int *columns, const real_t *y, int n) = sparse_dot_resolve;
+void (*sparse_axpy)(real_t alpha, const real_t *values, const int *columns, real_t *y, int n) = sparse_axpy_resolve;
+void (*vector_activate)(activation_type_t type, real_t *x, int n) = activate_resolve;
+void (*vector_activation_derivative)(activation_type_t type, const real_t *a, real_t *dLdz, int n) = activation_derivative_resolve;
+void (*vector_softmax)(real_t *x, int n) = softmax_resolve;
+void (*optimizer_momentum)(real_t *w, const real_t *g, real_t *velocity, int n, real_t learning_rate, real_t momentum, int nesterov) = momentum_resolve;
+void (*optimizer_adam)(real_t *w, const real_t *g, real_t *m, real_t *v, int n, real_t step_size, real_t beta1, real_t beta2, real_t epsilon) = adam_resolve;
+void (*vector_random_uniform)(mlp_random_lanes_t *lanes, real_t *x, int n, real_t low, real_t high) = random_uniform_resolve;
+
+static kernel_isa_t detect_isa(void) {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return ISA_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return ISA_SSE2;
+    }
+#endif
+    return ISA_SCALAR;
+}
+
+static void select_kernels(void) {
+
+    kernel_isa_t isa = detect_isa();
+
+    // Allow the selection to be capped (never raised above what the CPU reports):
+    const char *cap = getenv("MLP_ISA");
+    if (cap) {
+        for (int i = ISA_SCALAR; i <= ISA_AVX512; i++) {
+            if (strcmp(cap, isa_names[i]) == 0 && (kernel_isa_t)i < isa) {
+                isa = (kernel_isa_t)i;
+            }
+        }
+    }
+
+    selected_isa = isa;
+    switch (isa) {
+#ifdef SIMD_X86
+    case ISA_AVX512:
+        vector_dot = dot_avx512;
+        vector_axpy = axpy_avx512;
+        vector_widen_u8 = widen_u8_avx512;
+        sparse_dot = sparse_dot_avx512;
+        sparse_axpy = sparse_axpy_avx512;
+        vector_activate = activate_avx512;
+        vector_activation_derivative = activation_derivative_avx512;
+        vector_softmax = softmax_avx512;
+        optimizer_momentum = momentum_avx512;
+        optimizer_adam = adam_avx512;
+        vector_random_uniform = random_uniform_avx512;
+        break;
+    case ISA_AVX2:
+        vector_dot = dot_avx2;
+        vector_axpy = axpy_avx2;
+        vector_widen_u8 = widen_u8_avx2;
+        sparse_dot = sparse_dot_avx2;
+        sparse_axpy = sparse_axpy_scalar;
+        vector_activate = activate_avx2;
+        vector_activation_derivative = activation_derivative_avx2;
+        vector_softmax = softmax_avx2;
+        optimizer_momentum = momentum_avx2;
+        optimizer_adam = adam_avx2;
+        vector_random_uniform = random_uniform_avx2;
+        break;
+    case ISA_SSE2:
+        vector_dot = dot_sse2;
+        vector_axpy = axpy_sse2;
+        vector_widen_u8 = widen_u8_scalar;
+        sparse_dot = sparse_dot_scalar;
+        sparse_axpy = sparse_axpy_scalar;
+        vector_activate = activate_scalar;
+        vector_activation_derivative = activation_derivative_scalar;
+        vector_softmax = softmax_scalar;
+        optimizer_momentum = momentum_scalar;
+        optimizer_adam = adam_scalar;
+        vector_random_uniform = random_uniform_scalar;
+        break;
+#endif
+    default:
+        vector_dot = dot_scalar;
+        vector_axpy = axpy_scalar;
+        vector_widen_u8 = widen_u8_scalar;
+        sparse_dot = sparse_dot_scalar;
+        sparse_axpy = sparse_axpy_scalar;
+        vector_activate = activate_scalar;
+        vector_activation_derivative = activation_derivative_scalar;
+        vector_softmax = softmax_scalar;
+        optimizer_momentum = momentum_scalar;
+        optimizer_adam = adam_scalar;
+        vector_random_uniform = random_uniform_scalar;
+        break;
+    }
+}
+
+void init_kernels(void) {
+    pthread_once(&kernels_once, select_kernels);
+}
+
+kernel_isa_t kernels_isa(void) {
+    init_kernels();
+    return selected_isa;
+}
+
+const char *kernels_isa_name(void) {
+    return isa_names[kernels_isa()];
+}
@@ -0,0 +1,80 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "real.h"
+#include "random.h"
+
+// Vectorised inner loops shared by the perceptron and MLP code.
+//
+// Each kernel has a scalar, SSE2, AVX2+FMA and AVX-512 implementation. The widest one the running CPU
+// supports is selected the first time any kernel is called (or explicitly via init_kernels()), so a single
+// binary built without -march can be shipped to a mixed fleet. The selection happens once per process.
+// Call init_kernels() before starting any threads: the kernel pointers are plain globals, read without locks.
+// The MLP_ISA environment variable (scalar, sse2, avx2, avx512) caps the selection, which is handy when
+// comparing results between machines.
+
+typedef enum {
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_AVX2,
+    ISA_AVX512
+} kernel_isa_t;
+
+// Returns Σ a[i] * b[i] for i in [0, n):
+extern real_t (*vector_dot)(const real_t *a, const real_t *b, int n);
+
+// y[i] += alpha * x[i] for i in [0, n):
+extern void (*vector_axpy)(real_t alpha, const real_t *x, real_t *y, int n);
+
+// y[i] = alpha * x[i] for i in [0, n), widening uint8 values (e.g. raw pixels) to real_t with the scale fused in.
+// SSE2 has no byte widening loads, so the SSE2 selection uses the scalar version of this one.
+extern void (*vector_widen_u8)(real_t alpha, const unsigned char *x, real_t *y, int n);
+
+// Sparse versions of dot and axpy, for a vector x stored as n nonzero values and their (distinct) column indices:
+// Σ values[i] * y[columns[i]], and y[columns[i]] += alpha * values[i].
+// Gathers need AVX2 and scatters AVX-512, so below that these fall back to scalar loops.
+extern real_t (*sparse_dot)(const real_t *values, const int *columns, const real_t *y, int n);
+extern void (*sparse_axpy)(real_t alpha, const real_t *values, const int *columns, real_t *y, int n);
+
+// Activation functions with a vector implementation. Layers built from any other function pointer are
+// ACTIVATION_CUSTOM, and call it element by element instead (see activation_type() in perceptron.h):
+typedef enum {
+    ACTIVATION_CUSTOM,
+    ACTIVATION_LINEAR,
+    ACTIVATION_RELU,
+    ACTIVATION_SIGMOID,
+    ACTIVATION_STEP,
+    ACTIVATION_SIGN
+} activation_type_t;
+
+// x[i] = f(x[i]) for i in [0, n). The sigmoid uses a polynomial exp, accurate to a few ulp.
+// SSE2 has no rounding instruction to build it from, so the SSE2 selection uses the scalar versions of these two.
+extern void (*vector_activate)(activation_type_t type, real_t *x, int n);
+
+// dLdz[i] *= f'(z[i]) for i in [0, n), where the derivative is taken from the activated output a[i] = f(z[i]).
+// Step and sign have no useful derivative, so they zero dLdz:
+extern void (*vector_activation_derivative)(activation_type_t type, const real_t *a, real_t *dLdz, int n);
+
+// x = softmax(x) over [0, n): e^(x[i] - max) / Σ e^(x[j] - max), with the same exp as vector_activate.
+extern void (*vector_softmax)(real_t *x, int n);
+
+// Optimizer updates of n parameters w given their gradient g, each fused into a single pass over w, g and the
+// optimizer's state (see mlp_optimizer_t in mlp.h). SSE2 uses the scalar versions of these two.
+// Momentum:  velocity = momentum * velocity + g, then w -= learning_rate * velocity,
+//            or with nesterov set, w -= learning_rate * (g + momentum * velocity).
+// Adam:      m = beta1 * m + (1 - beta1) * g, v = beta2 * v + (1 - beta2) * g^2, then w -= step_size * m / (sqrt(v) + epsilon),
+//            where the caller folds the bias corrections into step_size and epsilon.
+extern void (*optimizer_momentum)(real_t *w, const real_t *g, real_t *velocity, int n, real_t learning_rate, real_t momentum, int nesterov);
+extern void (*optimizer_adam)(real_t *w, const real_t *g, real_t *m, real_t *v, int n, real_t step_size, real_t beta1, real_t beta2, real_t epsilon);
+
+// x[i] = low + (high - low) * u[i] for i in [0, n), with u[i] uniform in [0, 1) (52 random bits) from the lanes, which
+// all step together: element i comes from lane i % MLP_RANDOM_LANES (see random.h). The same lanes give the same values
+// on every ISA. Float32 builds round the double result, so an x[i] can come out as high itself.
+// SSE2 uses the scalar version, which needs fma() from libm.
+extern void (*vector_random_uniform)(mlp_random_lanes_t *lanes, real_t *x, int n, real_t low, real_t high);
+
+void init_kernels(void);
+kernel_isa_t kernels_isa(void);
+const char *kernels_isa_name(void);
+
+#endif
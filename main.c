@@ -2,10 +2,15 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "perceptron.h"
 #include "mlp.h"
+#include "quant.h"
 #include "mnist.h"
+#include "server.h"
 
 #define RED "\x1b[31m"
 #define GREEN "\x1b[32m"
@@ -22,11 +27,11 @@ typedef struct {
 void model_x_gt_9(void) {
 
     // Modelling x > 9:
-    const double training_features[][1] = {
+    const real_t training_features[][1] = {
         {0}, {1}, {2}, {3}, {4}, {5}, {6}, {7}, {8}, {9},
         {10}, {11}, {12}, {13}, {14}, {15}, {16}, {17}, {18}, {19}
     };
-    const double training_labels[] = {
+    const real_t training_labels[] = {
         -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
          1,  1,  1,  1,  1,  1,  1,  1,  1,  1
         };
@@ -77,7 +82,7 @@ void model_x_gt_9(void) {
     // Predict and check:
     int c = 1;
     for (int i = -15; i <= 14; i++) {
-        const double prediction_features[] = {i};
+        const real_t prediction_features[] = {i};
         double prediction = perceptron_feedforward(p, prediction_features);
         double expected_value = i > 9 ? 1 : -1;
         //printf("[ %02d/30 %s ]: Input:%d Expected:%0.0f Prediction:%0.0f\n", c++, expected_value == prediction ? "SUCCESS" : "FAILURE", i, expected_value, prediction);
@@ -97,8 +102,8 @@ void model_linear(void) {
     const int point_lower_bound = -20;
     const int point_upper_bound = 20;
 
-    double training_features[feature_count][2];
-    double training_labels[feature_count];
+    real_t training_features[feature_count][2];
+    real_t training_labels[feature_count];
 
     printf("\n");
     printf("[ %sDETAILS%s ]\n", YELLOW, RESET);
@@ -119,12 +124,13 @@ void model_linear(void) {
     printf("\n\n");
 
     printf("[ %sGENERATE TRAINING DATA%s ]\n", YELLOW, RESET);
+    mlp_random_t random = mlp_random_take();
     for (int i = 0; i < feature_count; i++) {
 
         // x co-ord:
-        training_features[i][0] = point_lower_bound + rand() % (point_upper_bound - point_lower_bound + 1);
+        training_features[i][0] = point_lower_bound + (int)mlp_random_below(&random, point_upper_bound - point_lower_bound + 1);
         // y co-ord:
-        training_features[i][1] = point_lower_bound + rand() % (point_upper_bound - point_lower_bound + 1);
+        training_features[i][1] = point_lower_bound + (int)mlp_random_below(&random, point_upper_bound - point_lower_bound + 1);
 
         // Model linear seperation using
         // y = x/2 + 5, if we are above the line, fire
@@ -155,13 +161,13 @@ void model_linear(void) {
     const int predict_count = 20;
     for (int i = 1; i <= predict_count; i++) {
 
-        double predict_features[2];
+        real_t predict_features[2];
         int predict_feature_label;
 
         // x co-ord:
-        predict_features[0] = point_lower_bound + rand() % (point_upper_bound - point_lower_bound + 1);
+        predict_features[0] = point_lower_bound + (int)mlp_random_below(&random, point_upper_bound - point_lower_bound + 1);
         // y co-ord:
-        predict_features[1] = point_lower_bound + rand() % (point_upper_bound - point_lower_bound + 1);
+        predict_features[1] = point_lower_bound + (int)mlp_random_below(&random, point_upper_bound - point_lower_bound + 1);
 
         // Generate result:
         int y = (predict_features[0] / 2) + 5;
@@ -184,10 +190,10 @@ void model_linear(void) {
 void model_AND(void) {
 
     // Modelling logical AND:
-    const double training_features[][2] = {
+    const real_t training_features[][2] = {
         {0, 0}, {0, 1}, {1, 0}, {1, 1}
     };
-    const double training_labels[] = {
+    const real_t training_labels[] = {
         0, 0, 0, 1
     };
     int feature_count = sizeof(training_features) / sizeof(training_features[0]);
@@ -242,10 +248,10 @@ void model_AND(void) {
 
 void model_4x2_mlp(void) {
 
-    const double training_features[][1] = {
+    const real_t training_features[][1] = {
         {4}
     };
-    const double training_labels[][1] = {
+    const real_t training_labels[][1] = {
         {8}
     };
     int feature_count = sizeof(training_features) / sizeof(training_features[0]);
@@ -289,14 +295,14 @@ void model_4x2_mlp(void) {
     printf("\n\n");
 
     printf("[ %sTRAINING RESULTS%s ]\n", YELLOW, RESET);
-    printf("Hidden node weight: %f bias: %f\n", mlp->p_hidden1[0]->weights[0], mlp->p_hidden1[0]->bias_weight);
-    printf("Output node weight: %f bias: %f\n", mlp->p_output[0]->weights[0], mlp->p_output[0]->bias_weight);
+    printf("Hidden node weight: %f bias: %f\n", mlp_layer_row(&mlp->hidden1, 0)[0], mlp->hidden1.biases[0]);
+    printf("Output node weight: %f bias: %f\n", mlp_layer_row(&mlp->output, 0)[0], mlp->output.biases[0]);
 
     printf("\n\n");
 
     printf("[ %sPREDICTION%s ]\n", YELLOW, RESET);
     
-    const double prediction_features[] = {4};
+    const real_t prediction_features[] = {4};
     mlp_feedforward(mlp, prediction_features);
 
     // Round up to 2 decimal places:
@@ -313,11 +319,11 @@ void model_4x2_mlp(void) {
 
 void model_x2_mlp(void) {
 
-    const double training_features[][1] = {
+    const real_t training_features[][1] = {
         {1}, {2}, {3}, {4},
         {5}, {6}, {7}, {8}
     };
-    const double training_labels[][1] = {
+    const real_t training_labels[][1] = {
         {2}, {4}, {6}, {8},
         {10}, {12}, {14}, {16}
     };
@@ -363,15 +369,15 @@ void model_x2_mlp(void) {
     printf("\n\n");
 
     printf("[ %sTRAINING RESULTS%s ]\n", YELLOW, RESET);
-    printf("Hidden node weight: %f bias: %f\n", mlp->p_hidden1[0]->weights[0], mlp->p_hidden1[0]->bias_weight);
-    printf("Output node weight: %f bias: %f\n", mlp->p_output[0]->weights[0], mlp->p_output[0]->bias_weight);
+    printf("Hidden node weight: %f bias: %f\n", mlp_layer_row(&mlp->hidden1, 0)[0], mlp->hidden1.biases[0]);
+    printf("Output node weight: %f bias: %f\n", mlp_layer_row(&mlp->output, 0)[0], mlp->output.biases[0]);
 
     printf("\n\n");
 
     printf("[ %sPREDICTION%s ]\n", YELLOW, RESET);
 
     for (double i = 0.0; i <= 20; i++) {
-        const double prediction_features[] = {i};
+        const real_t prediction_features[] = {i};
         mlp_feedforward(mlp, prediction_features);
 
         // Round up to 2 decimal places:
@@ -389,11 +395,11 @@ void model_x2_mlp(void) {
 
 void model_x2plus1_mlp(void) {
 
-    const double training_features[][1] = {
+    const real_t training_features[][1] = {
         {1}, {2}, {3}, {4},
         {5}, {6}, {7}, {8}
     };
-    const double training_labels[][1] = {
+    const real_t training_labels[][1] = {
         {3}, {5}, {7}, {9},
         {11}, {13}, {15}, {17}
     };
@@ -439,15 +445,15 @@ void model_x2plus1_mlp(void) {
     printf("\n\n");
 
     printf("[ %sTRAINING RESULTS%s ]\n", YELLOW, RESET);
-    printf("Hidden node weight: %f bias: %f\n", mlp->p_hidden1[0]->weights[0], mlp->p_hidden1[0]->bias_weight);
-    printf("Output node weight: %f bias: %f\n", mlp->p_output[0]->weights[0], mlp->p_output[0]->bias_weight);
+    printf("Hidden node weight: %f bias: %f\n", mlp_layer_row(&mlp->hidden1, 0)[0], mlp->hidden1.biases[0]);
+    printf("Output node weight: %f bias: %f\n", mlp_layer_row(&mlp->output, 0)[0], mlp->output.biases[0]);
 
     printf("\n\n");
 
     printf("[ %sPREDICTION%s ]\n", YELLOW, RESET);
 
     for (double i = 0.0; i <= 20; i++) {
-        const double prediction_features[] = {i};
+        const real_t prediction_features[] = {i};
         mlp_feedforward(mlp, prediction_features);
 
         // Round up to 2 decimal places:
@@ -466,10 +472,10 @@ void model_x2plus1_mlp(void) {
 void model_XOR(void) {
 
     // Modelling logical XOR:
-    const double training_features[][2] = {
+    const real_t training_features[][2] = {
         {0, 0}, {0, 1}, {1, 0}, {1, 1}
     };
-    const double training_labels[][1] = {
+    const real_t training_labels[][1] = {
         {0}, {1}, {1}, {0}
     };
     int feature_count = sizeof(training_features) / sizeof(training_features[0]);
@@ -508,9 +514,9 @@ void model_XOR(void) {
     printf("\n\n");
 
     printf("[ %sTRAINING RESULTS%s ]\n", YELLOW, RESET);
-    printf("Hidden node 0 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp->p_hidden1[0]->weights[0], mlp->p_hidden1[0]->weights[1], mlp->p_hidden1[0]->bias_weight);
-    printf("Hidden node 1 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp->p_hidden1[1]->weights[0], mlp->p_hidden1[1]->weights[1], mlp->p_hidden1[1]->bias_weight);
-    printf("Output node 0 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp->p_output[0]->weights[0], mlp->p_output[0]->weights[1], mlp->p_output[0]->bias_weight);
+    printf("Hidden node 0 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp_layer_row(&mlp->hidden1, 0)[0], mlp_layer_row(&mlp->hidden1, 0)[1], mlp->hidden1.biases[0]);
+    printf("Hidden node 1 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp_layer_row(&mlp->hidden1, 1)[0], mlp_layer_row(&mlp->hidden1, 1)[1], mlp->hidden1.biases[1]);
+    printf("Output node 0 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp_layer_row(&mlp->output, 0)[0], mlp_layer_row(&mlp->output, 0)[1], mlp->output.biases[0]);
 
     printf("\n\n");
 
@@ -538,11 +544,11 @@ void model_2dout(void) {
     const int hidden_count = 12;
     const int epoch_count = 50000;
 
-    const double training_features[][2] = {
+    const real_t training_features[][2] = {
         {1, 1}, {2, 2}, {3, 3}, {4, 4},
         {1, 4}, {2, 4}, {3, 5}, {4, 5}
     };
-    const double training_labels[][2] = {
+    const real_t training_labels[][2] = {
         {2, 4}, {4, 8}, {6, 12}, {8, 16},
         {5, 10}, {6, 12}, {8, 16}, {9, 18}
     };
@@ -550,8 +556,10 @@ void model_2dout(void) {
     int feature_dimension = sizeof(training_features[0]) / sizeof(training_features[0][0]);
     int label_dimension = sizeof(training_labels[0]) / sizeof(training_labels[0][0]);
 
+    // The outputs are unbounded regression targets, so the output layer is linear: a ReLU output that starts
+    // below zero gets no gradient and never recovers.
     multilayer_perceptron_t *mlp = init_mlp(2, 12, 2, relu_activation, derivative_relu_activation, 
-        relu_activation, derivative_relu_activation, epoch_count);
+        linear_activation, derivative_linear_activation, epoch_count);
 
     printf("\n");
 
@@ -564,7 +572,7 @@ void model_2dout(void) {
     printf("Input: A 2 dimensional input vector, x\n");
     printf("\t- x_1: Input value 1\n");
     printf("\t- x_2: Input value 2\n");
-    printf("Activation: ReLU\n");
+    printf("Activation: ReLU (hidden), Linear (output)\n");
     printf("Loss Function: Mean Squared Error + Gradient Descent + Back Propagation \n");
 
     printf("Training Strategy:\n");
@@ -586,20 +594,20 @@ void model_2dout(void) {
 
     printf("[ %sTRAINING RESULTS%s ]\n", YELLOW, RESET);
     for (int i = 0; i < hidden_count; i++) {
-        printf("Hidden node %d x_1 weight: %f x_2 weight: %f bias: %f\n", i, mlp->p_hidden1[i]->weights[0], mlp->p_hidden1[i]->weights[1], mlp->p_hidden1[i]->bias_weight);
+        printf("Hidden node %d x_1 weight: %f x_2 weight: %f bias: %f\n", i, mlp_layer_row(&mlp->hidden1, i)[0], mlp_layer_row(&mlp->hidden1, i)[1], mlp->hidden1.biases[i]);
     }
-    printf("Output node 0 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp->p_output[0]->weights[0], mlp->p_output[0]->weights[1], mlp->p_output[0]->bias_weight);
-    printf("Output node 1 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp->p_output[1]->weights[0], mlp->p_output[1]->weights[1], mlp->p_output[1]->bias_weight);
+    printf("Output node 0 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp_layer_row(&mlp->output, 0)[0], mlp_layer_row(&mlp->output, 0)[1], mlp->output.biases[0]);
+    printf("Output node 1 x_1 weight: %f x_2 weight: %f bias: %f\n", mlp_layer_row(&mlp->output, 1)[0], mlp_layer_row(&mlp->output, 1)[1], mlp->output.biases[1]);
 
     printf("\n\n");
 
     printf("[ %sPREDICTION%s ]\n", YELLOW, RESET);
 
-    const double testing_features[][2] = {
+    const real_t testing_features[][2] = {
         {2, 3}, {8, 2}, {8, 4}, {5, 1},
         {10, 10}, {20, 10}, {1, 1}, {8, 8}
     };
-    const double testing_labels[][2] = {
+    const real_t testing_labels[][2] = {
         {5, 10}, {10, 20}, {12, 24}, {6, 12},
         {20, 40}, {30, 60}, {2, 4}, {16, 32}
     };
@@ -623,40 +631,78 @@ void model_2dout(void) {
     return;
 }
 
-void onehot_encode(const int *labels, int num_labels, int num_classes, double one_hot[][10]) {
+// The images of a split as network inputs: the raw pixels, normalised from 0-255 down to [0, 1] by the first layer as it reads them:
+mlp_inputs_t mnist_inputs(const mnist_split_t *split) {
+    return mlp_byte_inputs(split->pixels, split->feature_count, split->feature_count, 1.0 / 255.0);
+}
 
-    // Zeroise:
-    memset(one_hot, 0, num_labels * num_classes * sizeof(double));
+// The labels of a split as class indices for the softmax output, straight from the mapped label bytes (never one-hot encoded):
+mlp_labels_t mnist_labels(const mnist_split_t *split) {
+    return mlp_class_labels(split->label_values, MNIST_CLASS_COUNT);
+}
 
-    // Set the appropriate index in each one-hot vector to 1
-    for (int i = 0; i < num_labels; i++) {
-        if (labels[i] >= 0 && labels[i] < num_classes) {
-            one_hot[i][labels[i]] = 1.0;
-        } else {
-            printf("Invalid label %d at index %d\n", labels[i], i);
-        }
+// The MNIST network: 784 pixels, a ReLU hidden layer and a softmax over the 10 digits, trained by cross-entropy:
+multilayer_perceptron_t *init_mnist_mlp(int feature_dimension, int hidden_count, int label_dimension, int epoch_count) {
+    multilayer_perceptron_t *mlp = init_mlp(feature_dimension, hidden_count, label_dimension, relu_activation, derivative_relu_activation, 
+    linear_activation, derivative_linear_activation, epoch_count);
+    mlp->loss = MLP_LOSS_SOFTMAX_CROSS_ENTROPY;
+    return mlp;
+}
+
+// The network saved by mnist_train, for inference: model.mlpm mapped in place, or if there is none, the legacy
+// weights.bin (which convert_weights reads and writes) loaded into a network of the structure it records.
+// *source names the file it came from. Returns NULL after printing why if neither can be loaded:
+static multilayer_perceptron_t *load_mnist_mlp(const char **source) {
+    if (access("model.mlpm", F_OK) == 0) {
+        *source = "model.mlpm";
+        return map_mlp_model("model.mlpm", 1);
     }
+
+    *source = "weights.bin";
+    FILE *file = fopen("weights.bin", "rb");
+    int structure[3];
+    const int found = file && fread(structure, sizeof(int), 3, file) == 3;
+    if (file) {
+        fclose(file);
+    }
+    if (!found) {
+        printf("No trained model found, run mnist_train first.\n");
+        return NULL;
+    }
+    if (structure[0] <= 0 || structure[1] <= 0 || structure[2] <= 0) {
+        fprintf(stderr, "weights.bin has an invalid structure\n");
+        return NULL;
+    }
+    multilayer_perceptron_t *mlp = init_mnist_mlp(structure[0], structure[1], structure[2], 0);
+    if (load_mlp_weights(mlp, "weights.bin") != 0) {
+        // Never run inference on the random weights it was initialised with:
+        destroy_mlp(mlp);
+        return NULL;
+    }
+    return mlp;
 }
 
 void mnist_train(void) {
 
-    // Use the included mnist.h functions to load the dataset as this is not the interesting part of our problem.
-    // After calling the following loader function, the following variables exist in the global namespace:
-    // train image : train_image[60000][784] (type: double, normalized, flattened)
-    // train label : train_label[60000] (type: int)
-    // test image : test_image[10000][784] (type: double, normalized, flattened)
-    // test label : test_label[10000] (type: int)
-    const int training_size = 60000;
-    const int epoch_count = 30;
-    const double learning_rate = 0.0001;
+    // Use the mnist.h loader to map the dataset as this is not the interesting part of our problem.
+    // The training split gives count images of feature_count raw uint8 pixels (flattened), and one uint8 label each.
+    const mnist_split_t *train_set = mnist_train_set();
+    const int training_size = train_set->count;
+    // Adam converges in a handful of epochs where plain SGD (at lr 1e-4) needed around thirty:
+    const int epoch_count = 5;
+    const double learning_rate = 0.001;
+    const int thread_count = default_thread_count();
+    // The batch is the same however many threads share it (each takes a slice), so the model trained doesn't depend
+    // on the machine:
+    const int batch_size = 32;
     
-    const int feature_dimension = 784;
+    const int feature_dimension = train_set->feature_count;
     const int hidden_count = 40;
     const int label_dimension = 10;
-    load_mnist();
 
-    multilayer_perceptron_t *mlp = init_mlp(feature_dimension, hidden_count, label_dimension, relu_activation, derivative_relu_activation, 
-    relu_activation, derivative_relu_activation, epoch_count);
+    multilayer_perceptron_t *mlp = init_mnist_mlp(feature_dimension, hidden_count, label_dimension, epoch_count);
+    const mlp_optimizer_t optimizer = mlp_adam_optimizer(0.9, 0.999, 1e-8);
+    mlp_set_optimizer(mlp, &optimizer);
 
     printf("\n");
 
@@ -664,11 +710,13 @@ void mnist_train(void) {
     printf("Model: mnist_train\n");
     printf("Aim: Train a feed forward neural network to model the handwritten MNIST dataset\n");
     printf("Architecture: 748 Input Nodes, %d Hidden Nodes, 10 Output Nodes.\n", hidden_count);
-    printf("Hidden Activation: ReLU, Output Activation: ReLU\n");
-    printf("Loss Function: Mean Squared Error + Gradient Descent + Back Propagation \n");
+    printf("Hidden Activation: ReLU, Output Activation: Softmax\n");
+    printf("Loss Function: Cross-Entropy + Adam + Back Propagation\n");
     printf("\n");
     printf("Training Size (n): %d\n", training_size);
     printf("Epoch Count: %d\n", epoch_count);
+    printf("Batch Size: %d\n", batch_size);
+    printf("Threads: %d\n", thread_count);
 
     printf("\n\n");
 
@@ -676,30 +724,30 @@ void mnist_train(void) {
     printf("Model execution starting now ...\n");
     printf("Training %d epochs now.\n", epoch_count);
 
-    // One-hot encode the labels into a 10 dimensional vector
-    // A value of 3 gets encoded to [0, 0, 0, 1, 0, 0, 0, 0, 0, 0]
-    double train_label_onehot[training_size][label_dimension];
-    onehot_encode(train_label, training_size, label_dimension, train_label_onehot);
-
-    // One-hot encoded labels::
-    // for (int i = 0; i < training_size; i++) {
-    //     printf("%d\n", train_label[i]);
-    //     printf("One-hot encoded label: ");
-    //     for (int j = 0; j < label_dimension; j++) {
-    //         printf("%f ", train_label_onehot[i][j]);
-    //     }
-    //     printf("\n");
-    // }
-
-    train_mlp(mlp, training_size, feature_dimension, train_image, label_dimension, train_label_onehot, learning_rate);
+    thread_pool_t *pool = init_thread_pool(thread_count);
+    const mlp_inputs_t train_features = mnist_inputs(train_set);
+    // The digit labels are used as class indices directly, so no one-hot matrix is ever built:
+    const mlp_labels_t train_labels = mnist_labels(train_set);
+    // Batches are shuffled and gathered by a background pipeline thread while the pool trains on the previous one.
+    // With MLP_NUMA=1 the rows are split across the nodes up front instead, which the pipeline would undo by
+    // gathering every batch on its own thread (and so onto one node), so they are trained on in order:
+    if (pool->numa) {
+        train_mlp_parallel(mlp, training_size, &train_features, &train_labels, learning_rate, batch_size, pool);
+    } else {
+        mlp_random_t shuffle_random = mlp_random_take();
+        train_mlp_pipelined(mlp, training_size, &train_features, &train_labels, learning_rate, batch_size,
+            mlp_random_next(&shuffle_random), pool);
+    }
+    destroy_thread_pool(pool);
 
     printf("\n\n");
 
     printf("[ %sSAVING WEIGHTS%s ]\n", YELLOW, RESET);
-    printf("Saving Model Weights to weights.bin\n");
+    printf("Saving Model Weights to weights.bin, and the model to model.mlpm\n");
     printf("\n\n");
     
     save_mlp_weights(mlp, "weights.bin");
+    save_mlp_model(mlp, "model.mlpm");
     destroy_mlp(mlp);
 
     printf("[ %sCOMPLETE%s ]\n", YELLOW, RESET);
@@ -708,24 +756,180 @@ void mnist_train(void) {
     return;
 }
 
-void mnist_test(void) {
+// Percentage of images whose highest scoring output matches the label:
+double mnist_accuracy(const multilayer_perceptron_t *mlp, const mnist_split_t *split, thread_pool_t *pool) {
+    const int count = split->count;
+    const unsigned char *labels = split->label_values;
+    const mlp_inputs_t features = mnist_inputs(split);
+    int *predictions = malloc(sizeof(int) * count);
+    mlp_predict_batch(mlp, count, &features, NULL, predictions, pool);
+
+    int success_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (labels[i] == predictions[i]) {
+            success_count++;
+        }
+    }
+    free(predictions);
+    return ((double)success_count / count) * 100;
+}
+
+void mnist_train_hogwild(void) {
 
-    // Use the included mnist.h functions to load the dataset as this is not the interesting part of our problem.
-    // After calling the following loader function, the following variables exist in the global namespace:
-    // train image : train_image[60000][784] (type: double, normalized, flattened)
-    // train label : train_label[60000] (type: int)
-    // test image : test_image[10000][784] (type: double, normalized, flattened)
-    // test label : test_label[10000] (type: int)
-    const int testing_size = 10000;
-    const int epoch_count = 0;
+    // Same model and dataset as mnist_train, trained with lock-free asynchronous SGD instead.
+    // Run with MLP_THREADS=1 for the single-threaded per-sample baseline.
+    const mnist_split_t *train_set = mnist_train_set();
+    const int training_size = train_set->count;
+    const int epoch_count = 30;
+    const double learning_rate = 0.0001;
+    const int thread_count = default_thread_count();
     
-    const int feature_dimension = 784;
+    const int feature_dimension = train_set->feature_count;
     const int hidden_count = 40;
     const int label_dimension = 10;
-    load_mnist();
 
-    multilayer_perceptron_t *mlp = init_mlp(feature_dimension, hidden_count, label_dimension, relu_activation, derivative_relu_activation, 
-    relu_activation, derivative_relu_activation, epoch_count);
+    multilayer_perceptron_t *mlp = init_mnist_mlp(feature_dimension, hidden_count, label_dimension, epoch_count);
+
+    printf("\n");
+
+    printf("[ %sDETAILS%s ]\n", YELLOW, RESET);
+    printf("Model: mnist_train_hogwild\n");
+    printf("Aim: Train a feed forward neural network on MNIST with asynchronous lock-free (Hogwild) SGD\n");
+    printf("Architecture: 748 Input Nodes, %d Hidden Nodes, 10 Output Nodes.\n", hidden_count);
+    printf("Hidden Activation: ReLU, Output Activation: Softmax\n");
+    printf("Loss Function: Cross-Entropy + Gradient Descent + Back Propagation \n");
+    printf("\n");
+    printf("Training Size (n): %d\n", training_size);
+    printf("Epoch Count: %d\n", epoch_count);
+    printf("Threads: %d\n", thread_count);
+
+    printf("\n\n");
+
+    printf("[ %sTRAINING%s ]\n", YELLOW, RESET);
+    printf("Model execution starting now ...\n");
+    printf("Training %d epochs now.\n", epoch_count);
+
+    mlp_train_stats_t stats;
+    thread_pool_t *pool = init_thread_pool(thread_count);
+    // Most pixels are 0, so the images are also encoded as CSR once up front; the first layer then only visits
+    // the nonzero pixels of each (sparse enough) image:
+    mlp_inputs_t train_features = mnist_inputs(train_set);
+    mlp_sparse_inputs_t *train_sparse = encode_sparse_inputs(&train_features, training_size, MLP_SPARSE_DENSITY, pool);
+    train_features.sparse = train_sparse;
+    const mlp_labels_t train_labels = mnist_labels(train_set);
+    train_mlp_hogwild(mlp, training_size, &train_features, &train_labels, learning_rate, pool, &stats);
+    destroy_sparse_inputs(train_sparse);
+
+    printf("\n\n");
+
+    printf("[ %sTRAINING RESULTS%s ]\n", YELLOW, RESET);
+    printf("Samples trained: %ld\n", stats.samples);
+    printf("Training time: %0.2fs\n", stats.seconds);
+    printf("Throughput: %0.0f samples/sec\n", stats.samples_per_second);
+    printf("Test set accuracy: %0.2f%%\n", mnist_accuracy(mlp, mnist_test_set(), pool));
+
+    printf("\n\n");
+
+    destroy_thread_pool(pool);
+    destroy_mlp(mlp);
+
+    printf("[ %sCOMPLETE%s ]\n", YELLOW, RESET);
+    printf("\n\n");
+
+    return;
+}
+
+void mnist_train_deep(void) {
+
+    // A deeper, narrower network than mnist_train's 784-40-10 for fewer multiply-adds per image (about 27k against 32k),
+    // trained a mini-batch at a time out of a single preallocated arena:
+    const mnist_split_t *train_set = mnist_train_set();
+    const mnist_split_t *test_set = mnist_test_set();
+    const int training_size = train_set->count;
+    const int epoch_count = 5;
+    const double learning_rate = 0.001;
+    const int batch_size = 32;
+
+    const int sizes[] = {train_set->feature_count, 32, 32, 32, 10};
+    const activation_type_t activations[] = {ACTIVATION_RELU, ACTIVATION_RELU, ACTIVATION_RELU, ACTIVATION_LINEAR};
+    const int layer_count = sizeof(activations) / sizeof(activations[0]);
+    const mlp_optimizer_t optimizer = mlp_adam_optimizer(0.9, 0.999, 1e-8);
+    mlp_network_t *network = init_mlp_network(layer_count, sizes, activations, MLP_LOSS_SOFTMAX_CROSS_ENTROPY,
+        &optimizer, batch_size, epoch_count, NULL);
+
+    printf("\n");
+
+    printf("[ %sDETAILS%s ]\n", YELLOW, RESET);
+    printf("Model: mnist_train_deep\n");
+    printf("Aim: Train a deeper, narrower feed forward neural network on the MNIST dataset\n");
+    printf("Architecture: 748 Input Nodes, 3 x 32 Hidden Nodes, 10 Output Nodes.\n");
+    printf("Hidden Activation: ReLU, Output Activation: Softmax\n");
+    printf("Loss Function: Cross-Entropy + Adam + Back Propagation\n");
+    printf("\n");
+    printf("Training Size (n): %d\n", training_size);
+    printf("Epoch Count: %d\n", epoch_count);
+    printf("Batch Size: %d\n", batch_size);
+    printf("Arena: %0.1f KiB\n", network->arena_size / 1024.0);
+
+    printf("\n\n");
+
+    printf("[ %sTRAINING%s ]\n", YELLOW, RESET);
+    printf("Model execution starting now ...\n");
+    printf("Training %d epochs now.\n", epoch_count);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const mlp_inputs_t train_features = mnist_inputs(train_set);
+    const mlp_labels_t train_labels = mnist_labels(train_set);
+    train_mlp_network(network, training_size, &train_features, &train_labels, learning_rate);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    int *predictions = malloc(sizeof(int) * test_set->count);
+    const mlp_inputs_t test_features = mnist_inputs(test_set);
+    mlp_network_predict(network, test_set->count, &test_features, NULL, predictions);
+    int success_count = 0;
+    for (int i = 0; i < test_set->count; i++) {
+        if (test_set->label_values[i] == predictions[i]) {
+            success_count++;
+        }
+    }
+    free(predictions);
+
+    printf("\n\n");
+
+    printf("[ %sTRAINING RESULTS%s ]\n", YELLOW, RESET);
+    printf("Training time: %0.2fs (%0.0f samples/sec)\n", seconds, (double)training_size * epoch_count / seconds);
+    printf("Test set accuracy: %0.2f%%\n", ((double)success_count / test_set->count) * 100);
+
+    printf("\n\n");
+
+    destroy_mlp_network(network);
+
+    printf("[ %sCOMPLETE%s ]\n", YELLOW, RESET);
+    printf("\n\n");
+
+    return;
+}
+
+void mnist_test(void) {
+
+    // Only the test split is mapped; the training files are never opened.
+    const mnist_split_t *test_set = mnist_test_set();
+    const int testing_size = test_set->count;
+
+    // The trained model is mapped straight from the file written by mnist_train, and used in place (or read from
+    // weights.bin, where that's all there is):
+    struct timespec start, end;
+    const char *source;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    multilayer_perceptron_t *mlp = load_mnist_mlp(&source);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!mlp) {
+        return;
+    }
+    const double load_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    const int hidden_count = mlp->p_hidden1_count;
 
     printf("\n");
 
@@ -733,47 +937,40 @@ void mnist_test(void) {
     printf("Model: mnist_test\n");
     printf("Aim: Test a feed forward neural network on previously unseen MNIST dataset handwritten digits.\n");
     printf("Architecture: 748 Input Nodes, %d Hidden Nodes, 10 Output Nodes.\n", hidden_count);
-    printf("Hidden Activation: ReLU, Output Activation: ReLU\n");
-    printf("Loss Function: Mean Squared Error + Gradient Descent + Back Propagation \n");
+    printf("Hidden Activation: ReLU, Output Activation: Softmax\n");
+    printf("Loss Function: Cross-Entropy + Gradient Descent + Back Propagation \n");
     printf("\n");
     printf("Testing Size (n): %d\n", testing_size);
 
     printf("\n\n");
 
     printf("[ %sLOADING WEIGHTS%s ]\n", YELLOW, RESET);
-    printf("Loading Model Weights from weights.bin\n");
+    printf("Loaded %s in %0.3fms\n", source, load_seconds * 1000);
     printf("\n\n");
-
-    load_mlp_weights(mlp, "weights.bin");
     
     // printf("[ %sPREDICTION%s ]\n", YELLOW, RESET);
 
-    double test_label_onehot[testing_size][label_dimension];
-    onehot_encode(test_label, testing_size, label_dimension, test_label_onehot);
-    
+    // Predict the whole test set in one batched, multi-threaded pass.
+    // Each prediction is the index of the highest scoring output (the most probable digit):
+    int *predictions = malloc(sizeof(int) * testing_size);
+    thread_pool_t *pool = init_thread_pool(default_thread_count());
+    const mlp_inputs_t test_features = mnist_inputs(test_set);
+    mlp_predict_batch(mlp, testing_size, &test_features, NULL, predictions, pool);
+    destroy_thread_pool(pool);
+
     int success_count = 0;
-    int prediction = -1;
     for (int i = 0; i < testing_size; i++) {
-        
-        mlp_feedforward(mlp, test_image[i]);
-        
-        // Undo the onehot encoding:
-        prediction = -1;
-        for (int j = 0; j < label_dimension; j++) {
-            if (round(mlp->p_output_output[j]) > prediction) {
-                prediction = j;
-            }
-        }
 
-        if (test_label[i] == prediction) {
+        if (test_set->label_values[i] == predictions[i]) {
             success_count++;
         }
 
         // printf("[ %s%02d/%02d %s%s ]: Input Image: %d Expected: %d Prediction: %d\n", 
-        //     (test_label[i] == prediction) ? GREEN : RED, i + 1, testing_size,
-        //     (test_label[i] == prediction) ? "SUCCESS" : "FAILURE", RESET,
-        //     i + 1, test_label[i], prediction);
+        //     (test_set->label_values[i] == predictions[i]) ? GREEN : RED, i + 1, testing_size,
+        //     (test_set->label_values[i] == predictions[i]) ? "SUCCESS" : "FAILURE", RESET,
+        //     i + 1, test_set->label_values[i], predictions[i]);
     }
+    free(predictions);
 
     printf("[ %sPREDICTION RESULTS%s ]\n", YELLOW, RESET);
     printf("Testing set size: %d\n", testing_size);
@@ -785,6 +982,235 @@ void mnist_test(void) {
     return;
 }
 
+// A positive integer setting from the environment, or fallback when it's unset or malformed:
+static long env_setting(const char *name, long fallback) {
+    const char *value = getenv(name);
+    char *end;
+    const long parsed = value ? strtol(value, &end, 10) : 0;
+    return (value && *end == '\0' && parsed > 0) ? parsed : fallback;
+}
+
+void mnist_serve(void) {
+
+    // Serve the model written by mnist_train to local clients (see server.h, and mnist_client for one).
+    // MLP_SOCKET sets the socket path, MLP_BATCH the largest micro-batch and MLP_LATENCY_US how long a request
+    // may wait for one to fill:
+    const char *source;
+    multilayer_perceptron_t *mlp = load_mnist_mlp(&source);
+    if (!mlp) {
+        return;
+    }
+
+    server_config_t config;
+    config.socket_path = getenv("MLP_SOCKET") ? getenv("MLP_SOCKET") : "mlp.sock";
+    config.max_batch = (int)env_setting("MLP_BATCH", 64);
+    config.max_latency_seconds = env_setting("MLP_LATENCY_US", 200) / 1e6;
+    config.byte_scale = (real_t)(1.0 / 255.0);
+
+    thread_pool_t *pool = init_thread_pool(default_thread_count());
+    run_inference_server(mlp, &config, pool);
+    destroy_thread_pool(pool);
+    destroy_mlp(mlp);
+}
+
+// Read exactly size bytes, or return -1 if the connection ends first:
+static int read_fully(int fd, void *buffer, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        const ssize_t received = read(fd, (char *)buffer + done, size - done);
+        if (received <= 0) {
+            return -1;
+        }
+        done += received;
+    }
+    return 0;
+}
+
+static int write_fully(int fd, const void *buffer, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        const ssize_t sent = write(fd, (const char *)buffer + done, size - done);
+        if (sent <= 0) {
+            return -1;
+        }
+        done += sent;
+    }
+    return 0;
+}
+
+void mnist_client(void) {
+
+    // Send the test set to a running mnist_serve, keeping MLP_WINDOW requests in flight (like that many clients
+    // each waiting on one prediction), then print the accuracy and the server's own counters:
+    const mnist_split_t *test_set = mnist_test_set();
+    const int testing_size = test_set->count;
+    const int window = (int)env_setting("MLP_WINDOW", 32);
+    const char *socket_path = getenv("MLP_SOCKET") ? getenv("MLP_SOCKET") : "mlp.sock";
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        printf("Couldn't connect to %s, start mnist_serve first.\n", socket_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    const size_t request_size = sizeof(server_request_t) + test_set->feature_count;
+    unsigned char *request = malloc(request_size);
+    float outputs[256];
+    int success_count = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int sent = 0, received = 0;
+    while (received < testing_size) {
+        if (sent < testing_size && sent - received < window) {
+            const server_request_t header = {SERVER_OP_PREDICT, (uint32_t)sent};
+            memcpy(request, &header, sizeof(header));
+            memcpy(request + sizeof(header), mnist_image(test_set, sent), test_set->feature_count);
+            if (write_fully(fd, request, request_size) < 0) {
+                break;
+            }
+            sent++;
+            continue;
+        }
+        server_response_t response;
+        if (read_fully(fd, &response, sizeof(response)) < 0 || response.size > sizeof(outputs) ||
+            read_fully(fd, outputs, response.size) < 0) {
+            break;
+        }
+        // The id comes back from the server, so check it is one of ours before using it as an index:
+        if (response.op != SERVER_OP_PREDICT || response.id >= (uint32_t)testing_size) {
+            fprintf(stderr, "Unexpected response (op %u, id %u) from %s\n", (unsigned)response.op, (unsigned)response.id, socket_path);
+            break;
+        }
+        if (response.label == test_set->label_values[response.id]) {
+            success_count++;
+        }
+        received++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    free(request);
+
+    printf("\n");
+    printf("[ %sPREDICTION RESULTS%s ]\n", YELLOW, RESET);
+    printf("Testing set size: %d (%d in flight)\n", testing_size, window);
+    printf("Responses: %d in %0.3fs (%0.0f/sec)\n", received, seconds, seconds > 0 ? received / seconds : 0.0);
+    printf("Success count: %d\n", success_count);
+    printf("Success rate: %0.2f%%\n", ((double)success_count / testing_size) * 100);
+
+    const server_request_t stats_request = {SERVER_OP_STATS, 0};
+    server_response_t response;
+    server_stats_t stats;
+    if (received == testing_size && write_fully(fd, &stats_request, sizeof(stats_request)) == 0 &&
+        read_fully(fd, &response, sizeof(response)) == 0 && response.size == sizeof(stats) && read_fully(fd, &stats, sizeof(stats)) == 0) {
+        printf("\n");
+        printf("[ %sSERVER STATS%s ]\n", YELLOW, RESET);
+        printf("Requests: %llu in %llu batches (mean batch %0.1f)\n", (unsigned long long)stats.requests,
+            (unsigned long long)stats.batches, stats.mean_batch_size);
+        printf("Uptime: %0.1fs (%0.0f requests/sec)\n", stats.uptime_seconds, stats.requests_per_second);
+        printf("Latency: p50 %0.0fus, p99 %0.0fus, max %0.0fus\n", stats.p50_latency_us, stats.p99_latency_us, stats.max_latency_us);
+    } else {
+        printf("The connection to the server was lost.\n");
+    }
+    close(fd);
+}
+
+void mnist_quantize(void) {
+
+    // Post-training int8 quantization of the weights saved by mnist_train.
+    // The int8 model runs straight off the raw uint8 pixels, so input_scale is 1/255 (the normalisation mnist.h applies).
+    const mnist_split_t *train_set = mnist_train_set();
+    const mnist_split_t *test_set = mnist_test_set();
+    const int testing_size = test_set->count;
+    const int calibration_size = train_set->count < 1000 ? train_set->count : 1000;
+
+    const char *source;
+    multilayer_perceptron_t *mlp = load_mnist_mlp(&source);
+    if (!mlp) {
+        return;
+    }
+    const int feature_dimension = mlp->input_count;
+    const int hidden_count = mlp->p_hidden1_count;
+    const int label_dimension = mlp->p_output_count;
+
+    printf("\n");
+
+    printf("[ %sDETAILS%s ]\n", YELLOW, RESET);
+    printf("Model: mnist_quantize\n");
+    printf("Aim: Quantize a trained MNIST network to int8 and compare it against the %s original.\n", REAL_NAME);
+    printf("Architecture: 748 Input Nodes, %d Hidden Nodes, 10 Output Nodes.\n", hidden_count);
+    printf("Calibration Size: %d\n", calibration_size);
+    printf("Testing Size (n): %d\n", testing_size);
+    printf("Int8 Kernel: %s\n", quantized_kernel_name());
+
+    printf("\n\n");
+
+    printf("[ %sLOADING WEIGHTS%s ]\n", YELLOW, RESET);
+    printf("Loaded Model Weights from %s\n", source);
+    printf("\n\n");
+
+    const mlp_inputs_t calibration_features = mnist_inputs(train_set);
+    mlp_quantized_t *q = quantize_mlp(mlp, calibration_size, &calibration_features, calibration_features.byte_scale);
+
+    int *predictions = malloc(sizeof(int) * testing_size);
+    int *quantized_predictions = malloc(sizeof(int) * testing_size);
+    thread_pool_t *pool = init_thread_pool(default_thread_count());
+    struct timespec start, end;
+
+    const mlp_inputs_t test_features = mnist_inputs(test_set);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    mlp_predict_batch(mlp, testing_size, &test_features, NULL, predictions, pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    quantized_predict_batch(q, testing_size, test_set->pixels, feature_dimension, NULL, quantized_predictions, pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double quantized_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    destroy_thread_pool(pool);
+
+    int success_count = 0;
+    int quantized_success_count = 0;
+    int agreement_count = 0;
+    for (int i = 0; i < testing_size; i++) {
+        success_count += (test_set->label_values[i] == predictions[i]);
+        quantized_success_count += (test_set->label_values[i] == quantized_predictions[i]);
+        agreement_count += (predictions[i] == quantized_predictions[i]);
+    }
+    free(predictions);
+    free(quantized_predictions);
+
+    const long weight_count = (long)feature_dimension * hidden_count + hidden_count + (long)hidden_count * label_dimension + label_dimension;
+    const long quantized_size = (long)feature_dimension * hidden_count + (long)hidden_count * label_dimension + 2 * sizeof(float) * (hidden_count + label_dimension);
+
+    printf("[ %sPREDICTION RESULTS%s ]\n", YELLOW, RESET);
+    printf("%s success rate: %0.2f%% (%0.0f images/sec)\n", REAL_NAME, ((double)success_count / testing_size) * 100, testing_size / seconds);
+    printf("int8 success rate: %0.2f%% (%0.0f images/sec)\n", ((double)quantized_success_count / testing_size) * 100, testing_size / quantized_seconds);
+    printf("Predictions in agreement: %0.2f%%\n", ((double)agreement_count / testing_size) * 100);
+    printf("Weights size: %ld bytes %s, %ld bytes int8\n", weight_count * (long)sizeof(real_t), REAL_NAME, quantized_size);
+
+    printf("\n\n");
+
+    printf("[ %sSAVING WEIGHTS%s ]\n", YELLOW, RESET);
+    printf("Saving Quantized Weights to weights.q8.bin\n");
+    printf("\n\n");
+
+    save_quantized_mlp(q, "weights.q8.bin");
+    destroy_quantized_mlp(q);
+    destroy_mlp(mlp);
+
+    printf("[ %sCOMPLETE%s ]\n", YELLOW, RESET);
+    printf("\n\n");
+
+    return;
+}
+
 // Array of model mappings
 ModelMapping modelMappings[] = {
     // Single Perceptrons:
@@ -800,14 +1226,23 @@ ModelMapping modelMappings[] = {
     {"model_2dout", "A multi-layer perceptron, outputing a 2d vector", model_2dout},
     // Realworld Dataset:
     {"mnist_train", "Train a 784-15-10 NN on the MNIST dataset", mnist_train},
-    {"mnist_test", "Test a 784-15-10 NN on the MNIST dataset", mnist_test}
+    {"mnist_train_hogwild", "Train a 784-40-10 NN on the MNIST dataset with lock-free asynchronous SGD", mnist_train_hogwild},
+    {"mnist_train_deep", "Train a 784-32-32-32-10 NN on the MNIST dataset, out of a single preallocated arena", mnist_train_deep},
+    {"mnist_test", "Test a 784-15-10 NN on the MNIST dataset", mnist_test},
+    {"mnist_quantize", "Quantize the trained MNIST NN to int8 and compare accuracy and speed", mnist_quantize},
+    {"mnist_serve", "Serve the trained MNIST NN on a Unix socket, micro-batching requests", mnist_serve},
+    {"mnist_client", "Send the MNIST test set to a running mnist_serve and report accuracy and latency", mnist_client}
     
 };
 
 int main(int argc, char *argv[]) {
 
-    // Random Seed:
-    srand(time(NULL)); 
+    // Random Seed: $MLP_SEED repeats a run, otherwise every run is different:
+    const char *seed = getenv("MLP_SEED");
+    mlp_random_set_seed(seed ? strtoull(seed, NULL, 0) : (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32));
+
+    // Select the kernels now, before any model starts a thread pool that would race to do it:
+    init_kernels();
 
     if (argc < 2) {
         printf("Usage: %s <modelName>\n", argv[0]);
@@ -828,6 +1263,7 @@ int main(int argc, char *argv[]) {
     }
 
     if (selectedFunction != NULL) {
+        printf("Random seed: %llu (set MLP_SEED to repeat this run)\n", (unsigned long long)mlp_random_seed());
         selectedFunction();
     } else {
         printf("Invalid model name: %s\n", modelName);
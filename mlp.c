@@ -1,4 +1,385 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "mlp.h"
+#include "kernels.h"
+#include "gemm.h"
+#include "threadpool.h"
+#include "pipeline.h"
+
+// ////////////////////////////////////  //
+//                Layers                 //
+//  ///////////////////////////////////  //
+
+// Bytes taken by count real_ts, rounded up to a whole number of MLP_ALIGNMENT blocks:
+static size_t aligned_size(size_t count) {
+    return (sizeof(real_t) * count + MLP_ALIGNMENT - 1) / MLP_ALIGNMENT * MLP_ALIGNMENT;
+}
+
+// Aligned allocation of count real_ts:
+static real_t *alloc_aligned(size_t count) {
+    return aligned_alloc(MLP_ALIGNMENT, aligned_size(count));
+}
+
+// Fill in the shape of a layer input_count -> output_count, leaving its memory to the caller:
+static void shape_layer(mlp_layer_t *layer, int input_count, int output_count, 
+    double (*activation_function)(double), double (*derivative_activation_function)(double)) {
+
+    // Pad each row out to a whole number of aligned blocks:
+    const int row_block = MLP_ALIGNMENT / sizeof(real_t);
+
+    layer->input_count = input_count;
+    layer->output_count = output_count;
+    layer->stride = (input_count + row_block - 1) / row_block * row_block;
+    layer->activation_function = activation_function;
+    layer->derivative_activation_function = derivative_activation_function;
+    layer->activation = activation_type(activation_function, derivative_activation_function);
+    layer->weights = NULL;
+    layer->biases = NULL;
+    layer->state = NULL;
+}
+
+// Size in elements of the weight matrix (including row padding):
+static size_t layer_weight_count(const mlp_layer_t *layer) {
+    return (size_t)layer->output_count * layer->stride;
+}
+
+// Size in elements of the weights and biases together (including padding), which are contiguous:
+static size_t layer_parameter_count(const mlp_layer_t *layer) {
+    const int row_block = MLP_ALIGNMENT / sizeof(real_t);
+    return layer_weight_count(layer) + (size_t)(layer->output_count + row_block - 1) / row_block * row_block;
+}
+
+// Allocate a zeroised layer shaped input_count -> output_count:
+static void alloc_layer(mlp_layer_t *layer, int input_count, int output_count, 
+    double (*activation_function)(double), double (*derivative_activation_function)(double)) {
+
+    shape_layer(layer, input_count, output_count, activation_function, derivative_activation_function);
+    const size_t count = layer_parameter_count(layer);
+
+    // One allocation for the whole layer: the weight matrix, followed by the biases.
+    // Zeroise so the row padding never contributes to a dot product:
+    layer->weights = alloc_aligned(count);
+    memset(layer->weights, 0, sizeof(real_t) * count);
+    layer->biases = layer->weights + (size_t)output_count * layer->stride;
+}
+
+// Elements drawn per piece when a layer's initialisation is split across a pool:
+#define INIT_GRAIN 16384
+
+typedef struct {
+    mlp_layer_t *layer;
+    mlp_init_t init;
+    real_t limit;
+    uint64_t seed;
+} layer_init_t;
+
+static void init_rows_range(void *arg, long begin, long end) {
+    const layer_init_t *job = (const layer_init_t *)arg;
+    mlp_layer_t *layer = job->layer;
+    for (long k = begin; k < end; k++) {
+        mlp_random_lanes_t lanes;
+        mlp_random_lanes(&lanes, job->seed, k);
+        vector_random_uniform(&lanes, mlp_layer_row(layer, (int)k), layer->input_count, -job->limit, job->limit);
+        if (job->init == MLP_INIT_UNIFORM) {
+            vector_random_uniform(&lanes, &layer->biases[k], 1, -job->limit, job->limit);
+        } else {
+            layer->biases[k] = 0;
+        }
+    }
+}
+
+void mlp_init_layer_weights(mlp_layer_t *layer, mlp_init_t init, thread_pool_t *pool) {
+    layer_init_t job;
+    job.layer = layer;
+    job.init = init;
+    job.limit = init == MLP_INIT_HE ? sqrt(6.0 / layer->input_count) :
+        init == MLP_INIT_XAVIER ? sqrt(6.0 / (layer->input_count + layer->output_count)) : 0.01;
+    // Row k draws from sub-stream k of a seed taken from the layer's own stream:
+    mlp_random_t random = mlp_random_take();
+    job.seed = mlp_random_next(&random);
+
+    if (pool) {
+        const long grain = INIT_GRAIN / layer->stride;
+        thread_pool_parallel_for(pool, layer->output_count, grain, init_rows_range, &job);
+    } else {
+        init_rows_range(&job, 0, layer->output_count);
+    }
+}
+
+static void init_layer(mlp_layer_t *layer, int input_count, int output_count, 
+    double (*activation_function)(double), double (*derivative_activation_function)(double)) {
+
+    alloc_layer(layer, input_count, output_count, activation_function, derivative_activation_function);
+
+    // Randomly set the starting weights on a value between -1 and 1 (scaled down):
+    mlp_init_layer_weights(layer, MLP_INIT_UNIFORM, NULL);
+}
+
+static void destroy_layer(mlp_layer_t *layer) {
+    // Biases share the weight allocation:
+    free(layer->weights);
+    free(layer->state);
+    layer->weights = NULL;
+    layer->biases = NULL;
+    layer->state = NULL;
+}
+
+// Apply the layer's activation function to n weighted sums in place:
+static void layer_activate(const mlp_layer_t *layer, real_t z[], size_t n) {
+    if (layer->activation != ACTIVATION_CUSTOM) {
+        vector_activate(layer->activation, z, (int)n);
+        return;
+    }
+    for (size_t k = 0; k < n; k++) {
+        z[k] = layer->activation_function(z[k]);
+    }
+}
+
+// dL/dz[k] *= f'(z[k]) for n activated outputs a[k] = f(z[k]):
+static void layer_activation_derivative(const mlp_layer_t *layer, const real_t a[], real_t dLdz[], size_t n) {
+    if (layer->activation != ACTIVATION_CUSTOM) {
+        vector_activation_derivative(layer->activation, a, dLdz, (int)n);
+        return;
+    }
+    // Inference-only layers may have no derivative; nothing passes back through them:
+    if (!layer->derivative_activation_function) {
+        memset(dLdz, 0, sizeof(real_t) * n);
+        return;
+    }
+    for (size_t k = 0; k < n; k++) {
+        dLdz[k] *= layer->derivative_activation_function(a[k]);
+    }
+}
+
+// Activate neurons [start, end) of the layer against the same input vector:
+static void layer_feedforward_slice(const mlp_layer_t *layer, const real_t input[], real_t output[], int start, int end) {
+    for (int k = start; k < end; k++) {
+        output[k] = layer->biases[k] + vector_dot(input, mlp_layer_row(layer, k), layer->input_count);
+    }
+    layer_activate(layer, output + start, end - start);
+}
+
+// Activate every neuron in the layer against the same input vector:
+static void layer_feedforward(const mlp_layer_t *layer, const real_t input[], real_t output[]) {
+    layer_feedforward_slice(layer, input, output, 0, layer->output_count);
+}
+
+// Turn each of count rows of output_count output layer values into probabilities, when the network ends in a softmax:
+static void output_softmax(mlp_loss_t loss, real_t output[], int count, int output_count) {
+    if (loss != MLP_LOSS_SOFTMAX_CROSS_ENTROPY) {
+        return;
+    }
+    for (int b = 0; b < count; b++) {
+        vector_softmax(output + (size_t)b * output_count, output_count);
+    }
+}
+
+// dL/dz of the output layer for a sample with activated outputs a, against row i of the labels, before f'(z):
+// Mean squared error: dL/dz = f'(z) * (a - y), and f'(z) is applied afterwards (over whole batches at once).
+// Softmax + cross-entropy: dL/dz = p - y exactly, as the softmax Jacobian cancels against the log, so no f'(z).
+// A class label is a one-hot y, so a only needs 1 taken off at the label's index:
+static void output_error(const mlp_labels_t *labels, long i, const real_t a[], real_t dLdz[], int count) {
+    if (labels->classes) {
+        memcpy(dLdz, a, sizeof(real_t) * count);
+        dLdz[labels->classes[i]] -= 1;
+        return;
+    }
+    const real_t *y = labels->values + (size_t)i * labels->stride;
+    for (int k = 0; k < count; k++) {
+        dLdz[k] = a[k] - y[k];
+    }
+}
+
+// Loss of a sample with count activated outputs a against row i of the labels, as minimised by training:
+// 1/2 Σ(a - y)^2 for mean squared error, or -Σ y log(p) for softmax + cross-entropy (-log(p) of the label's class).
+static double sample_loss(mlp_loss_t loss_type, const mlp_labels_t *labels, long i, const real_t a[], int count) {
+    double loss = 0;
+    if (loss_type == MLP_LOSS_SOFTMAX_CROSS_ENTROPY) {
+        // Probabilities that underflowed to 0 are clamped, so a confidently wrong sample gives a large loss rather than inf:
+        if (labels->classes) {
+            return -log(fmax(a[labels->classes[i]], 1e-30));
+        }
+        const real_t *y = labels->values + (size_t)i * labels->stride;
+        for (int k = 0; k < count; k++) {
+            loss -= y[k] * log(fmax(a[k], 1e-30));
+        }
+        return loss;
+    }
+    for (int k = 0; k < count; k++) {
+        const double error = a[k] - (labels->classes ? (k == labels->classes[i]) : labels->values[(size_t)i * labels->stride + k]);
+        loss += 0.5 * error * error;
+    }
+    return loss;
+}
+
+// ////////////////////////////////////  //
+//             Input Rows                //
+//  ///////////////////////////////////  //
+
+// Rows [first, first + count) of the inputs as a real_t matrix, with its row stride in *stride.
+// Real rows are used in place. Byte rows are widened and scaled into scratch (count x dimension) first, a sample or
+// a batch at a time: the full dataset only ever streams through memory as bytes, and the widened copy is small enough
+// to stay in cache while every neuron of the first layer reads it.
+static const real_t *input_rows(const mlp_inputs_t *inputs, long first, int count, real_t *scratch, int *stride) {
+    if (!inputs->bytes) {
+        *stride = inputs->stride;
+        return inputs->features + (size_t)first * inputs->stride;
+    }
+    for (int b = 0; b < count; b++) {
+        vector_widen_u8(inputs->byte_scale, inputs->bytes + (size_t)(first + b) * inputs->stride,
+            scratch + (size_t)b * inputs->dimension, inputs->dimension);
+    }
+    *stride = inputs->dimension;
+    return scratch;
+}
+
+// The CSR encoding to use for row i, or NULL if the inputs have none or the row is too dense to benefit:
+static const mlp_sparse_inputs_t *sparse_row(const mlp_inputs_t *inputs, long i) {
+    const mlp_sparse_inputs_t *sparse = inputs->sparse;
+    if (sparse && i < sparse->count && sparse->row_offsets[i + 1] - sparse->row_offsets[i] <= sparse->dense_limit) {
+        return sparse;
+    }
+    return NULL;
+}
+
+// Value j of input row i, scaled to real_t:
+static real_t input_value(const mlp_inputs_t *inputs, long i, int j) {
+    if (inputs->bytes) {
+        return inputs->byte_scale * inputs->bytes[(size_t)i * inputs->stride + j];
+    }
+    return inputs->features[(size_t)i * inputs->stride + j];
+}
+
+// Rows encoded per piece, when the encoding is spread across a pool:
+#define SPARSE_ENCODE_GRAIN 256
+
+typedef struct {
+    const mlp_inputs_t *inputs;
+    mlp_sparse_inputs_t *sparse;
+} sparse_encode_t;
+
+// First pass: each row's nonzero count goes in row_offsets[i + 1], ready for the prefix sum:
+static void count_nonzeros_range(void *arg, long begin, long end) {
+    const sparse_encode_t *encode = (const sparse_encode_t *)arg;
+    for (long i = begin; i < end; i++) {
+        long nonzeros = 0;
+        for (int j = 0; j < encode->inputs->dimension; j++) {
+            nonzeros += input_value(encode->inputs, i, j) != 0.0;
+        }
+        encode->sparse->row_offsets[i + 1] = nonzeros;
+    }
+}
+
+// Second pass: every row's offset is known, so rows fill in their own slices independently:
+static void fill_nonzeros_range(void *arg, long begin, long end) {
+    const sparse_encode_t *encode = (const sparse_encode_t *)arg;
+    mlp_sparse_inputs_t *sparse = encode->sparse;
+    for (long i = begin; i < end; i++) {
+        long n = sparse->row_offsets[i];
+        for (int j = 0; j < encode->inputs->dimension; j++) {
+            const real_t value = input_value(encode->inputs, i, j);
+            if (value != 0.0) {
+                sparse->columns[n] = j;
+                sparse->values[n] = value;
+                n++;
+            }
+        }
+    }
+}
+
+mlp_sparse_inputs_t *encode_sparse_inputs(const mlp_inputs_t *inputs, int count, double density, thread_pool_t *pool) {
+
+    // Init and zeroise:
+    mlp_sparse_inputs_t *sparse = (mlp_sparse_inputs_t *)malloc(sizeof(*sparse));
+    memset(sparse, 0, sizeof(*sparse));
+    sparse->count = count;
+    sparse->dimension = inputs->dimension;
+    sparse->dense_limit = (int)(density * inputs->dimension);
+    sparse->row_offsets = malloc(sizeof(long) * ((size_t)count + 1));
+
+    // Two passes: count the nonzeros to size the arrays exactly, then fill them in.
+    // Values are stored scaled, so the sparse kernels never need to know whether the source was bytes:
+    sparse_encode_t encode = {inputs, sparse};
+    if (pool) {
+        thread_pool_parallel_for(pool, count, SPARSE_ENCODE_GRAIN, count_nonzeros_range, &encode);
+    } else {
+        count_nonzeros_range(&encode, 0, count);
+    }
+    sparse->row_offsets[0] = 0;
+    for (int i = 0; i < count; i++) {
+        sparse->row_offsets[i + 1] += sparse->row_offsets[i];
+    }
+    const long nonzeros = sparse->row_offsets[count];
+
+    sparse->columns = malloc(sizeof(int) * (nonzeros ? nonzeros : 1));
+    sparse->values = alloc_aligned(nonzeros ? nonzeros : 1);
+    if (pool) {
+        thread_pool_parallel_for(pool, count, SPARSE_ENCODE_GRAIN, fill_nonzeros_range, &encode);
+    } else {
+        fill_nonzeros_range(&encode, 0, count);
+    }
+
+    return sparse;
+}
+
+void destroy_sparse_inputs(mlp_sparse_inputs_t *sparse) {
+    free(sparse->row_offsets);
+    free(sparse->columns);
+    free(sparse->values);
+    free(sparse);
+}
+
+// Activate every neuron in the layer for a whole batch of input rows at once:
+// output[b][k] = f(Σ_j input[b][j] * w[k][j] + bias[k])
+// The weighted sums are a single matrix product, input * W^T.
+static void layer_feedforward_batch(const mlp_layer_t *layer, int batch_size, const real_t *input, int input_stride, real_t *output) {
+    gemm(GEMM_NO_TRANS, GEMM_TRANS, batch_size, layer->output_count, layer->input_count,
+        1.0, input, input_stride, layer->weights, layer->stride, 0.0, output, layer->output_count);
+
+    for (int b = 0; b < batch_size; b++) {
+        vector_axpy(1.0, layer->biases, output + (size_t)b * layer->output_count, layer->output_count);
+    }
+    // The output rows are packed, so the whole batch is activated in one go:
+    layer_activate(layer, output, (size_t)batch_size * layer->output_count);
+}
+
+// Accumulate the weight and bias gradients of a layer over a batch:
+// dL/dw[k][j] = Σ_b dL/dz[b][k] * input[b][j], which is dLdz^T * input,
+// dL/db[k] = Σ_b dL/dz[b][k]
+static void layer_gradient_batch(const mlp_layer_t *layer, mlp_layer_t *gradient, int batch_size, 
+    const real_t *dLdz, const real_t *input, int input_stride) {
+
+    gemm(GEMM_TRANS, GEMM_NO_TRANS, layer->output_count, layer->input_count, batch_size,
+        1.0, dLdz, layer->output_count, input, input_stride, 0.0, gradient->weights, gradient->stride);
+
+    memset(gradient->biases, 0, sizeof(real_t) * layer->output_count);
+    for (int b = 0; b < batch_size; b++) {
+        vector_axpy(1.0, dLdz + (size_t)b * layer->output_count, gradient->biases, layer->output_count);
+    }
+}
+
+// ////////////////////////////////////  //
+//            Create/Destroy             //
+//  ///////////////////////////////////  //
+
+// The per-network state that follows the layers, for a network built by init_mlp or map_mlp_model:
+static void init_mlp_scratch(multilayer_perceptron_t *mlp) {
+
+    // Init the arrays that hold the output of each stage (to be passed as input into the next stage),
+    // and the dL/dz scratch used by backpropagation:
+    mlp->workspace = init_mlp_workspace(mlp);
+    mlp->p_hidden1_output = mlp->workspace->hidden1_output;
+    mlp->p_output_output = mlp->workspace->output_output;
+
+    if (getenv("MLP_PROFILE")) {
+        mlp_enable_profile(mlp, stderr);
+    }
+}
 
 multilayer_perceptron_t *init_mlp(int p_input_count, int p_hidden1_count, int p_output_count, 
     double (*hidden1_activation_function)(double), double (*hidden1_derivative_activation_function)(double), 
@@ -15,70 +396,155 @@ multilayer_perceptron_t *init_mlp(int p_input_count, int p_hidden1_count, int p_
     // Perceptron properties:
     mlp->p_hidden1_count = p_hidden1_count;
     mlp->p_output_count = p_output_count;
+    mlp->loss = MLP_LOSS_MSE;
+    mlp->optimizer = mlp_sgd_optimizer();
 
-    // Init the perceptrons:
-    mlp->p_hidden1 = malloc(mlp->p_hidden1_count * sizeof(perceptron_t*));
-    mlp->p_output = malloc(mlp->p_output_count * sizeof(perceptron_t*));
+    // Init the layers:
+    init_layer(&mlp->hidden1, mlp->input_count, mlp->p_hidden1_count, hidden1_activation_function, hidden1_derivative_activation_function);
+    init_layer(&mlp->output, mlp->p_hidden1_count, mlp->p_output_count, output_activation_function, output_derivative_activation_function);
 
-    for (int i = 0; i < mlp->p_hidden1_count; i++) {
-        mlp->p_hidden1[i] = init_perceptron(mlp->input_count, hidden1_activation_function, hidden1_derivative_activation_function, 1);
-    }
+    init_mlp_scratch(mlp);
+    return mlp;
+}
 
-    for (int i = 0; i < mlp->p_output_count; i++) {
-        mlp->p_output[i] = init_perceptron(mlp->p_hidden1_count, output_activation_function, output_derivative_activation_function, 1);
+// Optimizer state vectors kept per parameter:
+static int optimizer_state_count(mlp_optimizer_type_t type) {
+    switch (type) {
+    case MLP_OPTIMIZER_MOMENTUM:
+    case MLP_OPTIMIZER_NESTEROV:
+        return 1;
+    case MLP_OPTIMIZER_ADAM:
+        return 2;
+    default:
+        return 0;
     }
+}
+
+static void alloc_optimizer_state(mlp_layer_t *layer, mlp_optimizer_type_t type) {
+    free(layer->state);
+    layer->state = NULL;
 
-    // Init the arrays that hold the output of each stage (to be passed as input into the next stage):
-    mlp->p_hidden1_output = (double *)malloc(sizeof(double) * mlp->p_hidden1_count);
-    memset(mlp->p_hidden1_output, 0, sizeof(double) * mlp->p_hidden1_count);
+    const size_t count = layer_parameter_count(layer) * optimizer_state_count(type);
+    if (count) {
+        layer->state = alloc_aligned(count);
+        memset(layer->state, 0, sizeof(real_t) * count);
+    }
+}
 
-    mlp->p_output_output = (double *)malloc(sizeof(double) * mlp->p_output_count);
-    memset(mlp->p_output_output, 0, sizeof(double) * mlp->p_output_count);
+void mlp_set_optimizer(multilayer_perceptron_t *mlp, const mlp_optimizer_t *optimizer) {
+    mlp->optimizer = *optimizer;
+    mlp->optimizer.step = 0;
+    alloc_optimizer_state(&mlp->hidden1, optimizer->type);
+    alloc_optimizer_state(&mlp->output, optimizer->type);
+}
 
-    return mlp;
+void mlp_enable_profile(multilayer_perceptron_t *mlp, FILE *log) {
+    destroy_mlp_profile(mlp->profile);
+    mlp->profile = init_mlp_profile(log);
+    mlp->workspace->profile = mlp->profile;
 }
 
 void destroy_mlp(multilayer_perceptron_t *mlp) {
 
-    free(mlp->p_hidden1_output);
-    free(mlp->p_output_output);
+    destroy_mlp_workspace(mlp->workspace);
+    destroy_mlp_profile(mlp->profile);
 
-    for (int i = 0; i < mlp->p_hidden1_count; i++) {
-        destroy_perceptron(mlp->p_hidden1[i]);
+    // Mapped weights belong to the mapping:
+    if (mlp->model_map) {
+        mlp->hidden1.weights = NULL;
+        mlp->output.weights = NULL;
+        munmap(mlp->model_map, mlp->model_map_size);
     }
-    free(mlp->p_hidden1);
-
-    for (int i = 0; i < mlp->p_output_count; i++) {
-        destroy_perceptron(mlp->p_output[i]);
-    }
-    free(mlp->p_output);
+    destroy_layer(&mlp->hidden1);
+    destroy_layer(&mlp->output);
     
     free(mlp);
 }
 
+mlp_workspace_t *init_mlp_workspace(const multilayer_perceptron_t *mlp) {
+
+    mlp_workspace_t *workspace = (mlp_workspace_t *)malloc(sizeof(*workspace));
+    memset(workspace, 0, sizeof(*workspace));
+
+    workspace->input_row = alloc_aligned(mlp->input_count);
+    workspace->hidden1_output = alloc_aligned(mlp->p_hidden1_count);
+    workspace->output_output = alloc_aligned(mlp->p_output_count);
+    workspace->hidden1_dLdz = alloc_aligned(mlp->p_hidden1_count);
+    workspace->output_dLdz = alloc_aligned(mlp->p_output_count);
+    workspace->hidden1_active = (int *)malloc(sizeof(int) * mlp->p_hidden1_count);
+
+    memset(workspace->hidden1_output, 0, sizeof(real_t) * mlp->p_hidden1_count);
+    memset(workspace->output_output, 0, sizeof(real_t) * mlp->p_output_count);
+
+    return workspace;
+}
+
+void destroy_mlp_workspace(mlp_workspace_t *workspace) {
+    free(workspace->input_row);
+    free(workspace->hidden1_output);
+    free(workspace->output_output);
+    free(workspace->hidden1_dLdz);
+    free(workspace->output_dLdz);
+    free(workspace->hidden1_active);
+    free(workspace);
+}
+
 // Helper function to add binary classifier logic to an mlp:
 double step_function(double x) {
     return x > 0.5 ? 1 : 0;
 }
 
-void mlp_feedforward(multilayer_perceptron_t *mlp, const double training_features[mlp->input_count]) {
+static void train_sgd(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate);
+
+void mlp_feedforward(multilayer_perceptron_t *mlp, const real_t training_features[mlp->input_count]) {
+    mlp_feedforward_r(mlp, mlp->workspace, training_features);
+}
+
+void mlp_feedforward_r(const multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const real_t training_features[]) {
+    const mlp_inputs_t inputs = mlp_real_inputs(training_features, mlp->input_count, mlp->input_count);
+    mlp_feedforward_row(mlp, workspace, &inputs, 0);
+}
+
+void mlp_feedforward_row(const multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const mlp_inputs_t *inputs, long i) {
     
     // Activate hidden layer:
-    for (int k = 0; k < mlp->p_hidden1_count; k++) {
-        // Pass in the complete set of training features as input to each perceptron in the hidden layer and capture the activated output
-        mlp->p_hidden1_output[k] = perceptron_feedforward(mlp->p_hidden1[k], training_features);
-        // printf("\t\tHidden1[%d]: %f\n", k, mlp->p_hidden1_output[k]);
+    // Pass in the complete set of training features as input to each neuron in the hidden layer and capture the activated output
+    const mlp_sparse_inputs_t *sparse = sparse_row(inputs, i);
+    if (sparse) {
+        // Only the nonzero inputs contribute to the weighted sums:
+        const long start = sparse->row_offsets[i];
+        const int nonzeros = (int)(sparse->row_offsets[i + 1] - start);
+        for (int k = 0; k < mlp->p_hidden1_count; k++) {
+            workspace->hidden1_output[k] = mlp->hidden1.biases[k] + sparse_dot(sparse->values + start, sparse->columns + start, mlp_layer_row(&mlp->hidden1, k), nonzeros);
+        }
+        layer_activate(&mlp->hidden1, workspace->hidden1_output, mlp->p_hidden1_count);
+    } else {
+        int stride;
+        const real_t *training_features = input_rows(inputs, i, 1, workspace->input_row, &stride);
+        mlp_profile_phase(workspace->profile, MLP_PHASE_FETCH);
+        layer_feedforward(&mlp->hidden1, training_features, workspace->hidden1_output);
     }
 
     // Activate output layer:
-    for (int k = 0; k < mlp->p_output_count; k++) {
-        // Pass in the output of the hidden layer as input to each perceptron in the output layer and capture the activated output:
-        mlp->p_output_output[k] = perceptron_feedforward(mlp->p_output[k], mlp->p_hidden1_output);
-        // printf("\t\tOutput[%d]: %f\n", k, mlp->p_output_output[k]);
-    }
+    // Pass in the output of the hidden layer as input to each neuron in the output layer and capture the activated output:
+    layer_feedforward(&mlp->output, workspace->hidden1_output, workspace->output_output);
+    output_softmax(mlp->loss, workspace->output_output, 1, mlp->p_output_count);
+    mlp_profile_phase(workspace->profile, MLP_PHASE_FORWARD);
+}
+
+void mlp_backpropagate(multilayer_perceptron_t *mlp, const real_t training_features[], const real_t training_labels[], double learning_rate) {
+    mlp_backpropagate_r(mlp, mlp->workspace, training_features, training_labels, learning_rate);
+}
+
+void mlp_backpropagate_r(multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const real_t training_features[], const real_t training_labels[], double learning_rate) {
+    const mlp_inputs_t inputs = mlp_real_inputs(training_features, mlp->input_count, mlp->input_count);
+    const mlp_labels_t labels = mlp_real_labels(training_labels, mlp->p_output_count, mlp->p_output_count);
+    mlp_backpropagate_row(mlp, workspace, &inputs, 0, &labels, learning_rate);
 }
 
-void mlp_backpropagate(multilayer_perceptron_t *mlp, const double training_features[], const double training_labels[], double learning_rate) {
+void mlp_backpropagate_row(multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const mlp_inputs_t *inputs, long i,
+    const mlp_labels_t *labels, double learning_rate) {
     
     // Equations of a node:
     // Pre-Activation: z = w * x + b
@@ -89,61 +555,90 @@ void mlp_backpropagate(multilayer_perceptron_t *mlp, const double training_featu
     // Technically, the definition of the MSE loss function is L = (y - a)^2, but the 1/2 is added as it 
     // doesn't affect the gradient of the loss function, but simplifies its calculation.
 
-    double output_dLdz[mlp->p_output_count];
-    double hidden1_dLdz[mlp->p_hidden1_count];
+    // Scratch comes from the workspace rather than the stack, so wide layers and small thread stacks are safe:
+    const real_t *hidden1_output = workspace->hidden1_output;
+    const real_t *output_output = workspace->output_output;
+    real_t *output_dLdz = workspace->output_dLdz;
+    real_t *hidden1_dLdz = workspace->hidden1_dLdz;
 
     // Stage 1. Calculate the gradient of the loss function with respect to z (the pre-activated output of the node):
 
     // For each node in the output layer, calculate dL/dz:
-    for (int k = 0; k < mlp->p_output_count; k++) {
-        // dL/dz = da/dz * dL/da
-        // dL/dz =  f'(z) * (y - a)
-        output_dLdz[k] = (mlp->p_output_output[k] - training_labels[k]) * mlp->p_output[k]->derivative_activation_function(mlp->p_output_output[k]);
-        // printf("output_dLdz[%d] = %f\n", k, output_dLdz[k]);
+    // dL/dz = da/dz * dL/da
+    // dL/dz =  f'(z) * (y - a)
+    // (or p - y for a softmax output, see output_error)
+    output_error(labels, i, output_output, output_dLdz, mlp->p_output_count);
+    if (mlp->loss == MLP_LOSS_MSE) {
+        layer_activation_derivative(&mlp->output, output_output, output_dLdz, mlp->p_output_count);
+    }
+    if (workspace->profile) {
+        mlp_profile_samples(workspace->profile, 1, sample_loss(mlp->loss, labels, i, output_output, mlp->p_output_count));
     }
 
     // For each node in the hidden1 layer, calculate dL/dz:
+    // Build up the sigma component of equation:
+    // dL/dz = da/dz * Σ(dz/da * output_dLdz)
+    // dL/dz = da/dz * Σ(w * output_dLdz)
+    // The sum is accumulated one output neuron (weight row) at a time, so the output weight matrix is read 
+    // sequentially rather than down its columns:
+    memset(hidden1_dLdz, 0, sizeof(real_t) * mlp->p_hidden1_count);
+    for (int j = 0; j < mlp->p_output_count; j++) {
+        vector_axpy(output_dLdz[j], mlp_layer_row(&mlp->output, j), hidden1_dLdz, mlp->p_hidden1_count);
+    }
+    // Compute da/dz to finalise calculation of hidden1_dLdz:
+    // dL/dz = f'(z) * Σ(w * output_dLdz)
+    layer_activation_derivative(&mlp->hidden1, hidden1_output, hidden1_dLdz, mlp->p_hidden1_count);
+
+    // Units with dL/dz = 0 (dead ReLUs, where f'(z) = 0) would see their weights and bias not move, so only the rest
+    // are listed for the updates below:
+    int *active = workspace->hidden1_active;
+    int active_count = 0;
     for (int k = 0; k < mlp->p_hidden1_count; k++) {
-        hidden1_dLdz[k] = 0.0;
-        for (int j = 0; j < mlp->p_output_count; j++) {
-            // Build up the sigma component of equation:
-            // dL/dz = da/dz * Σ(dz/da * output_dLdz)
-            // dL/dz = da/dz * Σ(w * output_dLdz)
-            hidden1_dLdz[k] += mlp->p_output[j]->weights[k] * output_dLdz[j];
+        if (hidden1_dLdz[k] != 0) {
+            active[active_count++] = k;
         }
-        // Compute da/dz to finalise calculation of hidden1_dLdz:
-        // dL/dz = f'(z) * Σ(w * output_dLdz)
-        hidden1_dLdz[k] *= mlp->p_hidden1[k]->derivative_activation_function(mlp->p_hidden1_output[k]);
     }
+    mlp_profile_phase(workspace->profile, MLP_PHASE_BACKWARD);
 
     // Stage 2. Calculate the gradient of the loss function with respect to w (the input weight),
     // and update the weights using the update rule (gradient descent): w ← w - (α * (dL/dw))
 
     // Output layer:
     for (int k = 0; k < mlp->p_output_count; k++) {
-        for (int j = 0; j < mlp->p_hidden1_count; j++) {
-            // Gradient descent for each weight associated with the output node,
-            // noting that dL/dw = dz/dw * dL/dz, and dz/dw = a (the output of the hidden layer):
-            // w ← w - (α * (dz/dw * dL/dz))
-            mlp->p_output[k]->weights[j] -= learning_rate * (mlp->p_hidden1_output[j] * output_dLdz[k]);
-            // printf("output[%d] weight[%d]: %f\n", k, j, mlp->p_output[k]->weights[j]);
-        }
+        // Gradient descent for each weight associated with the output node,
+        // noting that dL/dw = dz/dw * dL/dz, and dz/dw = a (the output of the hidden layer):
+        // w ← w - (α * (dz/dw * dL/dz))
+        // Across the whole weight row this is a single axpy: row ← row + (-α * dL/dz) * a
+        vector_axpy(-learning_rate * output_dLdz[k], hidden1_output, mlp_layer_row(&mlp->output, k), mlp->p_hidden1_count);
         // For the bias, dz/dw = 1, so we can simplify the equation to:
         // w ← w - (α * (1 * dL/dz))
-        mlp->p_output[k]->bias_weight -= learning_rate * output_dLdz[k];
+        mlp->output.biases[k] -= learning_rate * output_dLdz[k];
     }
 
-    // Hidden layer, same logic as above:
-    for (int k = 0; k < mlp->p_hidden1_count; k++) {
-        for (int j = 0; j < mlp->input_count; j++) {
-            mlp->p_hidden1[k]->weights[j] -= learning_rate * (training_features[j] * hidden1_dLdz[k]);
+    // Hidden layer, same logic as above.
+    // dz/dw is the input, so the weights of zero inputs never change and a sparse row only updates its nonzero columns:
+    const mlp_sparse_inputs_t *sparse = sparse_row(inputs, i);
+    if (sparse) {
+        const long start = sparse->row_offsets[i];
+        const int nonzeros = (int)(sparse->row_offsets[i + 1] - start);
+        for (int t = 0; t < active_count; t++) {
+            sparse_axpy(-learning_rate * hidden1_dLdz[active[t]], sparse->values + start, sparse->columns + start, mlp_layer_row(&mlp->hidden1, active[t]), nonzeros);
+            mlp->hidden1.biases[active[t]] -= learning_rate * hidden1_dLdz[active[t]];
+        }
+    } else {
+        // The same (widened, for bytes) input row the forward pass saw:
+        int stride;
+        const real_t *training_features = input_rows(inputs, i, 1, workspace->input_row, &stride);
+        for (int t = 0; t < active_count; t++) {
+            vector_axpy(-learning_rate * hidden1_dLdz[active[t]], training_features, mlp_layer_row(&mlp->hidden1, active[t]), mlp->input_count);
+            mlp->hidden1.biases[active[t]] -= learning_rate * hidden1_dLdz[active[t]];
         }
-        mlp->p_hidden1[k]->bias_weight -= learning_rate * hidden1_dLdz[k];
     }
+    mlp_profile_phase(workspace->profile, MLP_PHASE_UPDATE);
 }
 
-void train_mlp(multilayer_perceptron_t *mlp, int feature_count, int feature_dimension, const double training_features[feature_count][feature_dimension],
-    int label_dimension, const double training_labels[feature_count][label_dimension], const double learning_rate) {
+void train_mlp(multilayer_perceptron_t *mlp, int feature_count, int feature_dimension, const real_t training_features[feature_count][feature_dimension],
+    int label_dimension, const real_t training_labels[feature_count][label_dimension], const double learning_rate) {
 
     // Exit if trying to train based on more features than expected:
     if (mlp->input_count != feature_dimension) {
@@ -156,93 +651,1470 @@ void train_mlp(multilayer_perceptron_t *mlp, int feature_count, int feature_dime
         return;
     }
 
+    const mlp_inputs_t inputs = mlp_real_inputs(training_features[0], feature_dimension, feature_dimension);
+    const mlp_labels_t labels = mlp_real_labels(training_labels[0], label_dimension, label_dimension);
+    train_sgd(mlp, feature_count, &inputs, &labels, learning_rate);
+}
+
+// Per-sample SGD over the first feature_count rows of the inputs, for every epoch:
+static void train_sgd(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate) {
+
+    // Each sample's phases, loss and count are recorded by the forward and backward passes (see mlp->workspace->profile):
+    mlp_profile_begin(mlp->profile);
+
     // Foreach Epoch:
     for (int epoch = 0; epoch < mlp->epoch_count; epoch++) {
-        // Foreach training vector:
+        // Foreach training vector, predict and train:
         for (int i = 0; i < feature_count; i++) {
+            mlp_feedforward_row(mlp, mlp->workspace, training_features, i);
+            mlp_backpropagate_row(mlp, mlp->workspace, training_features, i, training_labels, learning_rate);
+        }
+        mlp_profile_end_epoch(mlp->profile);
+    }
 
-            // Debug print:
-            // printf("Epoch: %d, Training Row: %d\n", epoch, i);
-            // printf("\tfeature:");
-            // for (int j = 0; j < column_count; j++) {
-            //     printf("%f ", training_features[i][j]);
-            // }
-            // printf("label:%f\n", training_labels[i]);
+    mlp_profile_end(mlp->profile);
+}
 
-            // Predict and train:
-            mlp_feedforward(mlp, training_features[i]);
+// ////////////////////////////////////  //
+//          Mini-Batch Training          //
+//  ///////////////////////////////////  //
 
-            // Debug print:
-            // printf("\t--> Output: ");
-            // for (int j = 0; j < mlp->p_output_count; j++) {
-            //     printf("%f ", mlp->p_output_output[j]);
-            // }
-            // printf("\n");
+mlp_batch_t *init_mlp_batch(const multilayer_perceptron_t *mlp, int max_batch_size) {
 
-            mlp_backpropagate(mlp, training_features[i], training_labels[i], learning_rate);
-        }
+    mlp_batch_t *batch = (mlp_batch_t *)malloc(sizeof(*batch));
+    memset(batch, 0, sizeof(*batch));
+    batch->max_batch_size = max_batch_size;
+
+    batch->hidden1_output = alloc_aligned((size_t)max_batch_size * mlp->p_hidden1_count);
+    batch->output_output = alloc_aligned((size_t)max_batch_size * mlp->p_output_count);
+    batch->hidden1_dLdz = alloc_aligned((size_t)max_batch_size * mlp->p_hidden1_count);
+    batch->output_dLdz = alloc_aligned((size_t)max_batch_size * mlp->p_output_count);
+    batch->input_rows = alloc_aligned((size_t)max_batch_size * mlp->input_count);
+
+    // Gradients share the shape (and row padding) of the layer they belong to, so they can be applied as one flat axpy:
+    alloc_layer(&batch->hidden1_gradient, mlp->input_count, mlp->p_hidden1_count, NULL, NULL);
+    alloc_layer(&batch->output_gradient, mlp->p_hidden1_count, mlp->p_output_count, NULL, NULL);
+
+    return batch;
+}
+
+void destroy_mlp_batch(mlp_batch_t *batch) {
+    free(batch->hidden1_output);
+    free(batch->output_output);
+    free(batch->hidden1_dLdz);
+    free(batch->output_dLdz);
+    free(batch->input_rows);
+    destroy_layer(&batch->hidden1_gradient);
+    destroy_layer(&batch->output_gradient);
+    free(batch);
+}
+
+void mlp_batch_gradients(const multilayer_perceptron_t *mlp, mlp_batch_t *batch, int batch_size, 
+    const mlp_inputs_t *inputs, const mlp_labels_t *labels, long first_row) {
+
+    // This is the same maths as mlp_feedforward + mlp_backpropagate (see the comments there),
+    // with each per-sample vector becoming one row of a batch_size-row matrix.
+    // Every matrix-vector product then becomes a matrix-matrix product, so each weight is loaded
+    // once per batch instead of once per sample.
+    const int hidden_count = mlp->p_hidden1_count;
+    const int output_count = mlp->p_output_count;
+
+    // The batch's input rows as a matrix (widened once here if they are bytes, then reused by both products that need them):
+    int feature_stride;
+    const real_t *features = input_rows(inputs, first_row, batch_size, batch->input_rows, &feature_stride);
+    mlp_profile_phase(batch->profile, MLP_PHASE_FETCH);
+
+    // Forward pass:
+    layer_feedforward_batch(&mlp->hidden1, batch_size, features, feature_stride, batch->hidden1_output);
+    layer_feedforward_batch(&mlp->output, batch_size, batch->hidden1_output, hidden_count, batch->output_output);
+    output_softmax(mlp->loss, batch->output_output, batch_size, output_count);
+    mlp_profile_phase(batch->profile, MLP_PHASE_FORWARD);
+
+    // Output layer dL/dz = f'(z) * (a - y), or p - y for a softmax output.
+    // The loss itself costs little next to the matrix products, so it is always tallied:
+    batch->loss = 0;
+    for (int b = 0; b < batch_size; b++) {
+        output_error(labels, first_row + b, batch->output_output + (size_t)b * output_count,
+            batch->output_dLdz + (size_t)b * output_count, output_count);
+        batch->loss += sample_loss(mlp->loss, labels, first_row + b, batch->output_output + (size_t)b * output_count, output_count);
+    }
+    if (mlp->loss == MLP_LOSS_MSE) {
+        layer_activation_derivative(&mlp->output, batch->output_output, batch->output_dLdz, (size_t)batch_size * output_count);
+    }
+
+    // Hidden layer dL/dz = f'(z) * Σ(w * output_dLdz), where the sums for the batch are output_dLdz * W_output:
+    gemm(GEMM_NO_TRANS, GEMM_NO_TRANS, batch_size, hidden_count, output_count,
+        1.0, batch->output_dLdz, output_count, mlp->output.weights, mlp->output.stride, 0.0, batch->hidden1_dLdz, hidden_count);
+    layer_activation_derivative(&mlp->hidden1, batch->hidden1_output, batch->hidden1_dLdz, (size_t)batch_size * hidden_count);
+
+    // Weight gradients, summed over the batch:
+    layer_gradient_batch(&mlp->output, &batch->output_gradient, batch_size, batch->output_dLdz, batch->hidden1_output, hidden_count);
+    layer_gradient_batch(&mlp->hidden1, &batch->hidden1_gradient, batch_size, batch->hidden1_dLdz, features, feature_stride);
+    mlp_profile_phase(batch->profile, MLP_PHASE_BACKWARD);
+}
+
+// Step a layer's weights and biases along their gradient with the optimizer's update rule.
+// They are one contiguous block (as are the gradient and state), so each rule is a single pass over the padded block;
+// the padding gradients are always zero, so the padding weights never move:
+static void layer_apply_gradient(mlp_layer_t *layer, const mlp_layer_t *gradient, const mlp_optimizer_t *optimizer, const double learning_rate) {
+    const int n = (int)layer_parameter_count(layer);
+
+    switch (optimizer->type) {
+    case MLP_OPTIMIZER_MOMENTUM:
+    case MLP_OPTIMIZER_NESTEROV:
+        optimizer_momentum(layer->weights, gradient->weights, layer->state, n, learning_rate, optimizer->momentum,
+            optimizer->type == MLP_OPTIMIZER_NESTEROV);
+        break;
+    case MLP_OPTIMIZER_ADAM: {
+        // The bias corrections of the moment estimates, m / (1 - β1^t) and v / (1 - β2^t), fold into the step size
+        // and epsilon, so the kernel never has to rescale either moment:
+        const double correction1 = 1.0 - pow(optimizer->beta1, optimizer->step);
+        const double correction2 = 1.0 - pow(optimizer->beta2, optimizer->step);
+        optimizer_adam(layer->weights, gradient->weights, layer->state, layer->state + n, n,
+            learning_rate * sqrt(correction2) / correction1, optimizer->beta1, optimizer->beta2, optimizer->epsilon * sqrt(correction2));
+        break;
+    }
+    default:
+        // w ← w - (α * (dL/dw))
+        vector_axpy(-learning_rate, gradient->weights, layer->weights, n);
+        break;
     }
 }
 
-void save_mlp_weights(const multilayer_perceptron_t *mlp, const char *filename) {
-    
-    FILE *file = fopen(filename, "wb");
-    if (!file) {
-        perror("Failed to open file for saving weights");
+void mlp_apply_gradients(multilayer_perceptron_t *mlp, const mlp_batch_t *batch, const double learning_rate) {
+    mlp->optimizer.step++;
+    layer_apply_gradient(&mlp->hidden1, &batch->hidden1_gradient, &mlp->optimizer, learning_rate);
+    layer_apply_gradient(&mlp->output, &batch->output_gradient, &mlp->optimizer, learning_rate);
+}
+
+void train_mlp_minibatch(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate, int batch_size) {
+
+    if (mlp->input_count != training_features->dimension) {
+        printf("Invalid Feature Dimensionality.\n");
         return;
     }
 
-    // Save the MLP structure
-    fwrite(&mlp->input_count, sizeof(int), 1, file);
-    fwrite(&mlp->p_hidden1_count, sizeof(int), 1, file);
-    fwrite(&mlp->p_output_count, sizeof(int), 1, file);
+    if (mlp->p_output_count != training_labels->dimension) {
+        printf("Invalid Label Dimensionality.\n");
+        return;
+    }
 
-    // Save weights and biases for hidden layer
-    for (int i = 0; i < mlp->p_hidden1_count; i++) {
-        fwrite(mlp->p_hidden1[i]->weights, sizeof(double), mlp->input_count, file);
-        fwrite(&mlp->p_hidden1[i]->bias_weight, sizeof(double), 1, file);
+    // A batch of one is plain per-sample SGD, unless there is optimizer state to keep:
+    if (batch_size <= 1 && mlp->optimizer.type == MLP_OPTIMIZER_SGD) {
+        train_sgd(mlp, feature_count, training_features, training_labels, learning_rate);
+        return;
     }
 
-    // Save weights and biases for output layer
-    for (int i = 0; i < mlp->p_output_count; i++) {
-        fwrite(mlp->p_output[i]->weights, sizeof(double), mlp->p_hidden1_count, file);
-        fwrite(&mlp->p_output[i]->bias_weight, sizeof(double), 1, file);
+    mlp_batch_t *batch = init_mlp_batch(mlp, batch_size);
+    batch->profile = mlp->profile;
+    mlp_profile_begin(mlp->profile);
+
+    // Foreach Epoch:
+    for (int epoch = 0; epoch < mlp->epoch_count; epoch++) {
+        // Foreach batch of consecutive training rows (the last one may be short):
+        for (int i = 0; i < feature_count; i += batch_size) {
+            const int n = (feature_count - i < batch_size) ? feature_count - i : batch_size;
+
+            // Gradients are summed rather than averaged over the batch, so the learning rate keeps
+            // the same per-sample meaning as in train_mlp:
+            mlp_batch_gradients(mlp, batch, n, training_features, training_labels, i);
+            mlp_apply_gradients(mlp, batch, learning_rate);
+            mlp_profile_phase(mlp->profile, MLP_PHASE_UPDATE);
+            mlp_profile_samples(mlp->profile, n, batch->loss);
+        }
+        mlp_profile_end_epoch(mlp->profile);
     }
 
-    fclose(file);
+    mlp_profile_end(mlp->profile);
+    destroy_mlp_batch(batch);
 }
 
-void load_mlp_weights(multilayer_perceptron_t *mlp, const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Failed to open file for loading weights");
-        return;
+// ////////////////////////////////////  //
+//           Batched Inference           //
+//  ///////////////////////////////////  //
+
+// Rows run through the network per GEMM call:
+#define PREDICT_BLOCK 64
+
+// The index of the highest of each of count rows of output_count outputs:
+static void output_labels(const real_t *outputs, int count, int output_count, int *labels) {
+    for (int b = 0; b < count; b++) {
+        const real_t *row = outputs + (size_t)b * output_count;
+        int best = 0;
+        for (int k = 1; k < output_count; k++) {
+            if (row[k] > row[best]) {
+                best = k;
+            }
+        }
+        labels[b] = best;
     }
+}
 
-    int input_count, hidden1_count, output_count;
+mlp_predict_workspace_t *init_mlp_predict_workspace(const multilayer_perceptron_t *mlp, int thread_count) {
 
-    // Read and validate structure
-    fread(&input_count, sizeof(int), 1, file);
-    fread(&hidden1_count, sizeof(int), 1, file);
-    fread(&output_count, sizeof(int), 1, file);
+    // Init and zeroise:
+    mlp_predict_workspace_t *workspace = (mlp_predict_workspace_t *)malloc(sizeof(*workspace));
+    memset(workspace, 0, sizeof(*workspace));
 
-    if (input_count != mlp->input_count || hidden1_count != mlp->p_hidden1_count || output_count != mlp->p_output_count) {
-        fclose(file);
-        fprintf(stderr, "MLP structure does not match file contents\n");
+    workspace->thread_count = thread_count < 1 ? 1 : thread_count;
+    workspace->threads = malloc(sizeof(*workspace->threads) * workspace->thread_count);
+    for (int t = 0; t < workspace->thread_count; t++) {
+        workspace->threads[t].hidden1_output = alloc_aligned((size_t)PREDICT_BLOCK * mlp->p_hidden1_count);
+        workspace->threads[t].output_output = alloc_aligned((size_t)PREDICT_BLOCK * mlp->p_output_count);
+        // Only needed for byte inputs, so left to the first call that has some:
+        workspace->threads[t].input_rows = NULL;
+    }
+    return workspace;
+}
+
+void destroy_mlp_predict_workspace(mlp_predict_workspace_t *workspace) {
+    for (int t = 0; t < workspace->thread_count; t++) {
+        free(workspace->threads[t].hidden1_output);
+        free(workspace->threads[t].output_output);
+        free(workspace->threads[t].input_rows);
+    }
+    free(workspace->threads);
+    free(workspace);
+}
+
+typedef struct {
+    const multilayer_perceptron_t *mlp;
+    mlp_predict_workspace_t *workspace;
+    int thread_count;
+    int count;
+    const mlp_inputs_t *inputs;
+    real_t *outputs;
+    int *labels;
+} predict_job_t;
+
+static void predict_task(void *arg, int thread_index) {
+    predict_job_t *job = (predict_job_t *)arg;
+    const multilayer_perceptron_t *mlp = job->mlp;
+    const int start = (int)((long)job->count * thread_index / job->thread_count);
+    const int end = (int)((long)job->count * (thread_index + 1) / job->thread_count);
+    if (start >= end) {
         return;
     }
 
-    // Load weights and biases for hidden layer
-    for (int i = 0; i < mlp->p_hidden1_count; i++) {
-        fread(mlp->p_hidden1[i]->weights, sizeof(double), mlp->input_count, file);
-        fread(&mlp->p_hidden1[i]->bias_weight, sizeof(double), 1, file);
+    // Thread-private activations from the caller's workspace, so any number of callers and threads can share one model:
+    mlp_predict_thread_t *scratch = &job->workspace->threads[thread_index];
+    if (job->inputs->bytes && !scratch->input_rows) {
+        scratch->input_rows = alloc_aligned((size_t)PREDICT_BLOCK * mlp->input_count);
     }
+    real_t *hidden1_output = scratch->hidden1_output;
+    real_t *output_output = scratch->output_output;
+    real_t *input_scratch = scratch->input_rows;
+
+    for (int i = start; i < end; i += PREDICT_BLOCK) {
+        const int n = (end - i < PREDICT_BLOCK) ? end - i : PREDICT_BLOCK;
+
+        // Outputs go straight into the caller's buffer when one is given:
+        real_t *outputs = job->outputs ? job->outputs + (size_t)i * mlp->p_output_count : output_output;
+
+        int input_stride;
+        const real_t *inputs = input_rows(job->inputs, i, n, input_scratch, &input_stride);
+        layer_feedforward_batch(&mlp->hidden1, n, inputs, input_stride, hidden1_output);
+        layer_feedforward_batch(&mlp->output, n, hidden1_output, mlp->p_hidden1_count, outputs);
+        output_softmax(mlp->loss, outputs, n, mlp->p_output_count);
 
-    // Load weights and biases for output layer
-    for (int i = 0; i < mlp->p_output_count; i++) {
-        fread(mlp->p_output[i]->weights, sizeof(double), mlp->p_hidden1_count, file);
-        fread(&mlp->p_output[i]->bias_weight, sizeof(double), 1, file);
+        if (job->labels) {
+            output_labels(outputs, n, mlp->p_output_count, job->labels + i);
+        }
     }
+}
 
-    fclose(file);
-}
\ No newline at end of file
+void mlp_predict_batch_r(const multilayer_perceptron_t *mlp, mlp_predict_workspace_t *workspace, int count,
+    const mlp_inputs_t *inputs, real_t *outputs, int *labels, thread_pool_t *pool) {
+
+    predict_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.mlp = mlp;
+    job.workspace = workspace;
+    job.thread_count = pool ? pool->thread_count : 1;
+    job.count = count;
+    job.inputs = inputs;
+    job.outputs = outputs;
+    job.labels = labels;
+
+    // A programming error, and the outputs would be left unwritten, so don't carry on as if they were results:
+    if (job.thread_count > workspace->thread_count) {
+        fprintf(stderr, "Predict workspace is for %d threads, not %d\n", workspace->thread_count, job.thread_count);
+        abort();
+    }
+
+    if (pool) {
+        thread_pool_run(pool, predict_task, &job);
+    } else {
+        predict_task(&job, 0);
+    }
+}
+
+void mlp_predict_batch(const multilayer_perceptron_t *mlp, int count, const mlp_inputs_t *inputs,
+    real_t *outputs, int *labels, thread_pool_t *pool) {
+    mlp_predict_workspace_t *workspace = init_mlp_predict_workspace(mlp, pool ? pool->thread_count : 1);
+    mlp_predict_batch_r(mlp, workspace, count, inputs, outputs, labels, pool);
+    destroy_mlp_predict_workspace(workspace);
+}
+
+// ////////////////////////////////////  //
+//       Neuron-Parallel Inference       //
+//  ///////////////////////////////////  //
+
+// Neurons per slice of a layer are a multiple of a whole MLP_ALIGNMENT block of outputs, so no two threads write the same cache line:
+#define LATENCY_NEURON_BLOCK (MLP_ALIGNMENT / (int)sizeof(real_t))
+// Multiply-adds per thread below which splitting a layer further costs more (in the barrier after it) than it saves:
+#define LATENCY_MIN_WORK 8192
+
+typedef struct {
+    const multilayer_perceptron_t *mlp;
+    mlp_workspace_t *workspace;
+    spin_pool_t *pool;
+    const real_t *input;
+} latency_job_t;
+
+// Thread thread_index's neurons [*start, *end) of a layer, in whole blocks, spread over no more threads than the
+// layer has work for (the rest get an empty slice):
+static void layer_slice(const mlp_layer_t *layer, int thread_count, int thread_index, int *start, int *end) {
+    const int blocks = (layer->output_count + LATENCY_NEURON_BLOCK - 1) / LATENCY_NEURON_BLOCK;
+    int threads = (int)((long)layer->output_count * layer->input_count / LATENCY_MIN_WORK);
+    threads = threads < thread_count ? threads : thread_count;
+    threads = threads < blocks ? threads : blocks;
+    threads = threads > 1 ? threads : 1;
+
+    *start = *end = 0;
+    if (thread_index < threads) {
+        *start = blocks * thread_index / threads * LATENCY_NEURON_BLOCK;
+        *end = blocks * (thread_index + 1) / threads * LATENCY_NEURON_BLOCK;
+        *start = *start < layer->output_count ? *start : layer->output_count;
+        *end = *end < layer->output_count ? *end : layer->output_count;
+    }
+}
+
+// Every thread computes its slice of a layer, then waits for the rest before reading the whole layer as its input:
+static void latency_task(void *arg, int thread_index) {
+    latency_job_t *job = (latency_job_t *)arg;
+    const multilayer_perceptron_t *mlp = job->mlp;
+    const int thread_count = job->pool->thread_count;
+    int start, end;
+
+    layer_slice(&mlp->hidden1, thread_count, thread_index, &start, &end);
+    layer_feedforward_slice(&mlp->hidden1, job->input, job->workspace->hidden1_output, start, end);
+    spin_pool_barrier(job->pool);
+
+    layer_slice(&mlp->output, thread_count, thread_index, &start, &end);
+    layer_feedforward_slice(&mlp->output, job->workspace->hidden1_output, job->workspace->output_output, start, end);
+}
+
+void mlp_feedforward_latency(const multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const mlp_inputs_t *inputs, long i, spin_pool_t *pool) {
+    latency_job_t job;
+    int stride;
+    job.mlp = mlp;
+    job.workspace = workspace;
+    job.pool = pool;
+    job.input = input_rows(inputs, i, 1, workspace->input_row, &stride);
+
+    spin_pool_run(pool, latency_task, &job);
+    // The softmax needs every output, so it runs once they are all in:
+    output_softmax(mlp->loss, workspace->output_output, 1, mlp->p_output_count);
+}
+
+// ////////////////////////////////////  //
+//        Data-Parallel Training         //
+//  ///////////////////////////////////  //
+
+// NUMA mode: one shard's rows of the training set, copied onto its worker's node in the order the shard trains on them:
+typedef struct {
+    long count;
+    mlp_inputs_t features;
+    mlp_labels_t labels;
+    // The storage behind them:
+    void *feature_rows;
+    void *label_rows;
+} numa_partition_t;
+
+// Shared state for one synchronous data-parallel step:
+typedef struct {
+    const multilayer_perceptron_t *mlp;
+    int thread_count;
+
+    // One private set of scratch and gradient buffers per thread:
+    mlp_batch_t **shards;
+
+    // The current batch, starting at row first_row of the features and labels:
+    const mlp_inputs_t *features;
+    const mlp_labels_t *labels;
+    long first_row;
+    int batch_size;
+
+    // NUMA mode (see threadpool.h): each shard's own copy of its rows, on its worker's node, or NULL.
+    // Which rows those are follows from the number of rows per epoch and the batch size (only the last batch is short):
+    numa_partition_t *partitions;
+    long feature_count;
+    int full_batch_size;
+} parallel_step_t;
+
+// Each thread computes the gradients of its own contiguous slice of the batch:
+static void shard_gradients_task(void *arg, int thread_index) {
+    parallel_step_t *step = (parallel_step_t *)arg;
+    const int start = (int)((long)step->batch_size * thread_index / step->thread_count);
+    const int end = (int)((long)step->batch_size * (thread_index + 1) / step->thread_count);
+
+    // An empty slice still runs, which zeroises that shard's gradients:
+    if (step->partitions) {
+        // Every batch before this one was a whole one, and gave this shard a slice of the same length:
+        const numa_partition_t *partition = &step->partitions[thread_index];
+        const long full_slice = (long)step->full_batch_size * (thread_index + 1) / step->thread_count -
+            (long)step->full_batch_size * thread_index / step->thread_count;
+        mlp_batch_gradients(step->mlp, step->shards[thread_index], end - start,
+            &partition->features, &partition->labels, step->first_row / step->full_batch_size * full_slice);
+    } else {
+        mlp_batch_gradients(step->mlp, step->shards[thread_index], end - start,
+            step->features, step->labels, step->first_row + start);
+    }
+}
+
+// Parameters summed per piece of the gradient reduction:
+#define REDUCE_GRAIN 4096
+
+// Sum the shards' gradients into shard 0 over parameters [begin, end) of one layer's gradients (weights and biases,
+// which are contiguous), with a pairwise tree: at each level shard t absorbs shard t + stride.
+// The pairing depends only on the thread count, so the summation order (and therefore the result) is fixed.
+static void reduce_layer_range(const parallel_step_t *step, size_t gradient_offset, long begin, long end) {
+    for (int stride = 1; stride < step->thread_count; stride *= 2) {
+        for (int t = 0; t + stride < step->thread_count; t += 2 * stride) {
+            const mlp_layer_t *from = (const mlp_layer_t *)((const char *)step->shards[t + stride] + gradient_offset);
+            mlp_layer_t *into = (mlp_layer_t *)((char *)step->shards[t] + gradient_offset);
+            vector_axpy(1.0, from->weights + begin, into->weights + begin, (int)(end - begin));
+        }
+    }
+}
+
+// The reduction as one parallel range over every parameter of both layers, so each piece of it reads and writes a
+// cache-sized slice of every shard, and all the threads share each level rather than half of them sitting it out:
+static void reduce_gradients_range(void *arg, long begin, long end) {
+    const parallel_step_t *step = (const parallel_step_t *)arg;
+    const long hidden_count = (long)layer_parameter_count(&step->shards[0]->hidden1_gradient);
+    if (begin < hidden_count) {
+        reduce_layer_range(step, offsetof(mlp_batch_t, hidden1_gradient), begin, end < hidden_count ? end : hidden_count);
+    }
+    if (end > hidden_count) {
+        reduce_layer_range(step, offsetof(mlp_batch_t, output_gradient), (begin > hidden_count ? begin : hidden_count) - hidden_count, end - hidden_count);
+    }
+}
+
+// Each shard is allocated (and zeroised) by the worker that will use it, so its pages are first touched on that worker's node:
+static void init_shard_task(void *arg, int thread_index) {
+    parallel_step_t *step = (parallel_step_t *)arg;
+    step->shards[thread_index] = init_mlp_batch(step->mlp, (step->full_batch_size + step->thread_count - 1) / step->thread_count);
+}
+
+static void init_parallel_shards(parallel_step_t *step, const multilayer_perceptron_t *mlp, thread_pool_t *pool, int batch_size) {
+    memset(step, 0, sizeof(*step));
+    step->mlp = mlp;
+    step->thread_count = pool->thread_count;
+    step->full_batch_size = batch_size;
+
+    step->shards = malloc(sizeof(mlp_batch_t *) * pool->thread_count);
+    thread_pool_run(pool, init_shard_task, step);
+    // Profiles aren't thread safe, so only one shard records phases (the caller is waiting on the pool meanwhile):
+    step->shards[0]->profile = mlp->profile;
+}
+
+static void destroy_parallel_shards(parallel_step_t *step) {
+    for (int t = 0; t < step->thread_count; t++) {
+        destroy_mlp_batch(step->shards[t]);
+        if (step->partitions) {
+            free(step->partitions[t].feature_rows);
+            free(step->partitions[t].label_rows);
+        }
+    }
+    free(step->shards);
+    free(step->partitions);
+}
+
+// Copy every row shard thread_index will train on over an epoch of feature_count rows (its slice of each batch, in
+// turn) into its partition. Run by that shard's worker, so the copy lands on its node:
+static void init_partition_task(void *arg, int thread_index) {
+    parallel_step_t *step = (parallel_step_t *)arg;
+    numa_partition_t *partition = &step->partitions[thread_index];
+    const mlp_inputs_t *features = step->features;
+    const mlp_labels_t *labels = step->labels;
+    const long feature_count = step->feature_count;
+
+    // Bytes stay bytes, so a partition is no bigger than the rows it holds:
+    long count = 0;
+    for (long i = 0; i < feature_count; i += step->full_batch_size) {
+        const long batch_size = (feature_count - i < step->full_batch_size) ? feature_count - i : step->full_batch_size;
+        count += batch_size * (thread_index + 1) / step->thread_count - batch_size * thread_index / step->thread_count;
+    }
+    const size_t feature_size = features->bytes ? 1 : sizeof(real_t);
+    const size_t label_size = labels->classes ? 1 : sizeof(real_t) * labels->dimension;
+    partition->feature_rows = malloc(feature_size * features->dimension * (count ? count : 1));
+    partition->label_rows = malloc(label_size * (count ? count : 1));
+
+    long r = 0;
+    for (long i = 0; i < feature_count; i += step->full_batch_size) {
+        const long batch_size = (feature_count - i < step->full_batch_size) ? feature_count - i : step->full_batch_size;
+        const long end = i + batch_size * (thread_index + 1) / step->thread_count;
+        for (long row = i + batch_size * thread_index / step->thread_count; row < end; row++, r++) {
+            if (features->bytes) {
+                memcpy((unsigned char *)partition->feature_rows + (size_t)r * features->dimension,
+                    features->bytes + (size_t)row * features->stride, features->dimension);
+            } else {
+                memcpy((real_t *)partition->feature_rows + (size_t)r * features->dimension,
+                    features->features + (size_t)row * features->stride, sizeof(real_t) * features->dimension);
+            }
+            if (labels->classes) {
+                ((unsigned char *)partition->label_rows)[r] = labels->classes[row];
+            } else {
+                memcpy((real_t *)partition->label_rows + (size_t)r * labels->dimension,
+                    labels->values + (size_t)row * labels->stride, label_size);
+            }
+        }
+    }
+
+    partition->count = count;
+    partition->features = features->bytes ?
+        mlp_byte_inputs(partition->feature_rows, features->dimension, features->dimension, features->byte_scale) :
+        mlp_real_inputs(partition->feature_rows, features->dimension, features->dimension);
+    partition->labels = labels->classes ?
+        mlp_class_labels(partition->label_rows, labels->dimension) :
+        mlp_real_labels(partition->label_rows, labels->dimension, labels->dimension);
+}
+
+// Add a region's resident pages, and those of them on node, to the counts. Returns 0 if the kernel can't say:
+static int count_local_pages(const numa_topology_t *numa, const void *address, size_t size, int node, long *resident, long *local) {
+    long region_resident, region_local;
+    if (!numa_page_placement(numa, address, size, node, &region_resident, &region_local)) {
+        return 0;
+    }
+    *resident += region_resident;
+    *local += region_local;
+    return 1;
+}
+
+// Where the partitions and gradient buffers of each node's shards ended up, from the kernel's page tables.
+// Anything short of 100% local is memory the node's workers reach across the interconnect:
+static void report_numa_placement(const parallel_step_t *step, const thread_pool_t *pool) {
+    for (int node = 0; node < pool->numa->node_count; node++) {
+        long row_pages = 0, local_row_pages = 0, gradient_pages = 0, local_gradient_pages = 0;
+        int workers = 0, known = 1;
+        for (int t = 0; t < step->thread_count; t++) {
+            if (pool->worker_nodes[t] != node) {
+                continue;
+            }
+            workers++;
+            const numa_partition_t *partition = &step->partitions[t];
+            const mlp_batch_t *shard = step->shards[t];
+            const size_t row_size = partition->features.dimension * (partition->features.bytes ? 1 : sizeof(real_t));
+            known &= count_local_pages(pool->numa, partition->feature_rows, partition->count * row_size, node,
+                &row_pages, &local_row_pages);
+            known &= count_local_pages(pool->numa, shard->hidden1_gradient.weights,
+                sizeof(real_t) * layer_parameter_count(&shard->hidden1_gradient), node, &gradient_pages, &local_gradient_pages);
+            known &= count_local_pages(pool->numa, shard->output_gradient.weights,
+                sizeof(real_t) * layer_parameter_count(&shard->output_gradient), node, &gradient_pages, &local_gradient_pages);
+        }
+        if (!workers) {
+            continue;
+        }
+        if (!known || !row_pages || !gradient_pages) {
+            fprintf(stderr, "NUMA node %d: %d workers (page placement unavailable)\n", pool->numa->node_ids[node], workers);
+            continue;
+        }
+        const double rows = 100.0 * local_row_pages / row_pages;
+        const double gradients = 100.0 * local_gradient_pages / gradient_pages;
+        fprintf(stderr, "NUMA node %d: %d workers, %.1f%% of their rows and %.1f%% of their gradients local (%.1f%% and %.1f%% remote)\n",
+            pool->numa->node_ids[node], workers, rows, gradients, 100 - rows, 100 - gradients);
+    }
+}
+
+// One synchronous update for the batch described by step:
+static void parallel_step(multilayer_perceptron_t *mlp, parallel_step_t *step, thread_pool_t *pool, const double learning_rate) {
+
+    // Every thread computes gradients for its slice of the batch (waiting for the slowest counts as backward):
+    thread_pool_run(pool, shard_gradients_task, step);
+    mlp_profile_phase(mlp->profile, MLP_PHASE_BACKWARD);
+
+    double loss = 0;
+    for (int t = 0; t < step->thread_count; t++) {
+        loss += step->shards[t]->loss;
+    }
+
+    // Combine them into shard 0:
+    const long parameter_count = (long)(layer_parameter_count(&step->shards[0]->hidden1_gradient) +
+        layer_parameter_count(&step->shards[0]->output_gradient));
+    thread_pool_parallel_for(pool, parameter_count, REDUCE_GRAIN, reduce_gradients_range, step);
+
+    // And take a single, shared step:
+    mlp_apply_gradients(mlp, step->shards[0], learning_rate);
+    mlp_profile_phase(mlp->profile, MLP_PHASE_UPDATE);
+    mlp_profile_samples(mlp->profile, step->batch_size, loss);
+}
+
+void train_mlp_parallel(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate, int batch_size, thread_pool_t *pool) {
+
+    // Nothing to split across:
+    if (!pool || pool->thread_count == 1) {
+        train_mlp_minibatch(mlp, feature_count, training_features, training_labels, learning_rate, batch_size);
+        return;
+    }
+
+    if (mlp->input_count != training_features->dimension) {
+        printf("Invalid Feature Dimensionality.\n");
+        return;
+    }
+
+    if (mlp->p_output_count != training_labels->dimension) {
+        printf("Invalid Label Dimensionality.\n");
+        return;
+    }
+
+    parallel_step_t step;
+    init_parallel_shards(&step, mlp, pool, batch_size);
+    step.features = training_features;
+    step.labels = training_labels;
+
+    // In NUMA mode the training set is split up front into one partition per shard, on the shard's node, so every
+    // step's reads stay local. The rows (and so the results) are the same as reading the shared set:
+    if (pool->numa) {
+        step.partitions = malloc(sizeof(numa_partition_t) * pool->thread_count);
+        step.feature_count = feature_count;
+        thread_pool_run(pool, init_partition_task, &step);
+        report_numa_placement(&step, pool);
+    }
+    mlp_profile_begin(mlp->profile);
+
+    // Foreach Epoch:
+    for (int epoch = 0; epoch < mlp->epoch_count; epoch++) {
+        // Foreach batch of consecutive training rows (the last one may be short):
+        for (int i = 0; i < feature_count; i += batch_size) {
+            step.batch_size = (feature_count - i < batch_size) ? feature_count - i : batch_size;
+            step.first_row = i;
+            parallel_step(mlp, &step, pool, learning_rate);
+        }
+        mlp_profile_end_epoch(mlp->profile);
+    }
+
+    mlp_profile_end(mlp->profile);
+    destroy_parallel_shards(&step);
+}
+
+// ////////////////////////////////////  //
+//          Pipelined Training           //
+//  ///////////////////////////////////  //
+
+// Rows per pipeline batch when training per-sample (batch_size 1):
+#define PIPELINE_SGD_BLOCK 64
+
+void train_mlp_pipelined(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate, int batch_size, uint64_t seed, thread_pool_t *pool) {
+
+    if (mlp->input_count != training_features->dimension) {
+        printf("Invalid Feature Dimensionality.\n");
+        return;
+    }
+
+    if (mlp->p_output_count != training_labels->dimension) {
+        printf("Invalid Label Dimensionality.\n");
+        return;
+    }
+
+    const int dimension = training_features->dimension;
+    const int sgd = batch_size <= 1 && mlp->optimizer.type == MLP_OPTIMIZER_SGD;
+    const int parallel = !sgd && pool && pool->thread_count > 1;
+
+    mlp_pipeline_t *pipeline = init_mlp_pipeline(feature_count, training_features, training_labels,
+        sgd ? PIPELINE_SGD_BLOCK : batch_size, mlp->epoch_count, seed);
+
+    parallel_step_t step;
+    mlp_batch_t *batch = NULL;
+    if (parallel) {
+        init_parallel_shards(&step, mlp, pool, batch_size);
+    } else if (!sgd) {
+        batch = init_mlp_batch(mlp, batch_size);
+        batch->profile = mlp->profile;
+    }
+    mlp_profile_begin(mlp->profile);
+
+    // Pipeline batches arrive already shuffled, gathered and widened, so each one is a plain contiguous real_t block.
+    // Fetch time is only what the trainer spends waiting for the producer to catch up:
+    const mlp_pipeline_batch_t *ready;
+    int epoch = 0;
+    while ((ready = mlp_pipeline_next(pipeline))) {
+        mlp_profile_phase(mlp->profile, MLP_PHASE_FETCH);
+        if (ready->epoch != epoch) {
+            mlp_profile_end_epoch(mlp->profile);
+            epoch = ready->epoch;
+        }
+        const mlp_inputs_t inputs = mlp_real_inputs(ready->features, dimension, dimension);
+
+        if (sgd) {
+            for (int r = 0; r < ready->count; r++) {
+                mlp_feedforward_row(mlp, mlp->workspace, &inputs, r);
+                mlp_backpropagate_row(mlp, mlp->workspace, &inputs, r, &ready->labels, learning_rate);
+            }
+        } else if (parallel) {
+            step.features = &inputs;
+            step.first_row = 0;
+            step.labels = &ready->labels;
+            step.batch_size = ready->count;
+            parallel_step(mlp, &step, pool, learning_rate);
+        } else {
+            mlp_batch_gradients(mlp, batch, ready->count, &inputs, &ready->labels, 0);
+            mlp_apply_gradients(mlp, batch, learning_rate);
+            mlp_profile_phase(mlp->profile, MLP_PHASE_UPDATE);
+            mlp_profile_samples(mlp->profile, ready->count, batch->loss);
+        }
+
+        mlp_pipeline_release(pipeline);
+    }
+    mlp_profile_end(mlp->profile);
+
+    if (parallel) {
+        destroy_parallel_shards(&step);
+    } else if (batch) {
+        destroy_mlp_batch(batch);
+    }
+    destroy_mlp_pipeline(pipeline);
+}
+
+// ////////////////////////////////////  //
+//      Asynchronous (Hogwild) SGD       //
+//  ///////////////////////////////////  //
+
+// Samples claimed from the shared cursor per atomic operation:
+#define HOGWILD_CHUNK 16
+
+typedef struct {
+    multilayer_perceptron_t *mlp;
+    mlp_workspace_t **workspaces;
+
+    const mlp_inputs_t *features;
+    const mlp_labels_t *labels;
+    int feature_count;
+    double learning_rate;
+
+    // Next sample to train on, counted across all epochs:
+    atomic_long cursor;
+    long total_samples;
+} hogwild_state_t;
+
+static void hogwild_task(void *arg, int thread_index) {
+    hogwild_state_t *state = (hogwild_state_t *)arg;
+    mlp_workspace_t *workspace = state->workspaces[thread_index];
+
+    for (;;) {
+        const long start = atomic_fetch_add_explicit(&state->cursor, HOGWILD_CHUNK, memory_order_relaxed);
+        if (start >= state->total_samples) {
+            break;
+        }
+        const long end = (start + HOGWILD_CHUNK < state->total_samples) ? start + HOGWILD_CHUNK : state->total_samples;
+
+        for (long s = start; s < end; s++) {
+            const long i = s % state->feature_count;
+
+            // Plain per-sample SGD, writing straight into the shared weights with no locking.
+            // Concurrent updates to the same weight can occasionally be lost; with mostly-zero inputs
+            // the updates rarely touch the same weights and SGD tolerates the noise.
+            mlp_feedforward_row(state->mlp, workspace, state->features, i);
+            mlp_backpropagate_row(state->mlp, workspace, state->features, i, state->labels, state->learning_rate);
+        }
+    }
+}
+
+void train_mlp_hogwild(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate, thread_pool_t *pool, mlp_train_stats_t *stats) {
+
+    if (mlp->input_count != training_features->dimension) {
+        printf("Invalid Feature Dimensionality.\n");
+        return;
+    }
+
+    if (mlp->p_output_count != training_labels->dimension) {
+        printf("Invalid Label Dimensionality.\n");
+        return;
+    }
+
+    const int thread_count = pool ? pool->thread_count : 1;
+
+    hogwild_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.mlp = mlp;
+    state.features = training_features;
+    state.labels = training_labels;
+    state.feature_count = feature_count;
+    state.learning_rate = learning_rate;
+    state.total_samples = (long)feature_count * mlp->epoch_count;
+    atomic_init(&state.cursor, 0);
+
+    state.workspaces = malloc(sizeof(mlp_workspace_t *) * thread_count);
+    for (int t = 0; t < thread_count; t++) {
+        state.workspaces[t] = init_mlp_workspace(mlp);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (pool) {
+        thread_pool_run(pool, hogwild_task, &state);
+    } else {
+        hogwild_task(&state, 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (stats) {
+        stats->samples = state.total_samples;
+        stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        stats->samples_per_second = stats->seconds > 0 ? stats->samples / stats->seconds : 0;
+    }
+
+    for (int t = 0; t < thread_count; t++) {
+        destroy_mlp_workspace(state.workspaces[t]);
+    }
+    free(state.workspaces);
+}
+
+// ////////////////////////////////////  //
+//           N-Layer Networks            //
+//  ///////////////////////////////////  //
+
+// Take the next block of count real_ts (rounded up to whole MLP_ALIGNMENT blocks) from the front of an arena:
+static real_t *arena_take(unsigned char **arena, size_t count) {
+    real_t *block = (real_t *)*arena;
+    *arena += aligned_size(count);
+    return block;
+}
+
+mlp_network_t *init_mlp_network(int layer_count, const int sizes[], const activation_type_t activations[],
+    mlp_loss_t loss, const mlp_optimizer_t *optimizer, int max_batch_size, int epoch_count, thread_pool_t *pool) {
+
+    if (layer_count < 1 || max_batch_size < 1) {
+        fprintf(stderr, "A network needs at least one layer, and a batch size of at least 1\n");
+        return NULL;
+    }
+    for (int l = 0; l <= layer_count; l++) {
+        if (sizes[l] < 1) {
+            fprintf(stderr, "Network layer sizes must be positive (size %d is %d)\n", l, sizes[l]);
+            return NULL;
+        }
+    }
+    for (int l = 0; l < layer_count; l++) {
+        double (*activation_function)(double);
+        double (*derivative_activation_function)(double);
+        if (!activation_functions(activations[l], &activation_function, &derivative_activation_function)) {
+            fprintf(stderr, "Network layer %d needs an activation with a vector kernel\n", l);
+            return NULL;
+        }
+    }
+
+    // Init and zeroise:
+    mlp_network_t *network = (mlp_network_t *)malloc(sizeof(*network));
+    memset(network, 0, sizeof(*network));
+    network->epoch_count = epoch_count;
+    network->input_count = sizes[0];
+    network->output_count = sizes[layer_count];
+    network->max_batch_size = max_batch_size;
+    network->layer_count = layer_count;
+    network->loss = loss;
+    network->optimizer = *optimizer;
+    network->optimizer.step = 0;
+
+    network->layers = (mlp_layer_t *)malloc(sizeof(mlp_layer_t) * layer_count);
+    network->gradients = (mlp_layer_t *)malloc(sizeof(mlp_layer_t) * layer_count);
+    network->outputs = (real_t **)malloc(sizeof(real_t *) * layer_count);
+    network->dLdz = (real_t **)malloc(sizeof(real_t *) * layer_count);
+
+    // Shape every layer first, to size the arena:
+    const int state_count = optimizer_state_count(optimizer->type);
+    size_t size = aligned_size((size_t)max_batch_size * network->input_count);
+    for (int l = 0; l < layer_count; l++) {
+        double (*activation_function)(double);
+        double (*derivative_activation_function)(double);
+        activation_functions(activations[l], &activation_function, &derivative_activation_function);
+        shape_layer(&network->layers[l], sizes[l], sizes[l + 1], activation_function, derivative_activation_function);
+        shape_layer(&network->gradients[l], sizes[l], sizes[l + 1], NULL, NULL);
+
+        const size_t parameter_count = layer_parameter_count(&network->layers[l]);
+        size += aligned_size(parameter_count) * 2 + aligned_size(parameter_count * state_count);
+        size += aligned_size((size_t)max_batch_size * sizes[l + 1]) * 2;
+    }
+    network->arena_size = size;
+    network->arena = aligned_alloc(MLP_ALIGNMENT, size);
+    memset(network->arena, 0, size);
+
+    // Then carve it up in the order the hot loops walk it: the weights of every layer back to back (the forward pass
+    // streams through them in one run), the gradients and optimizer state the update reads alongside them, then the
+    // per-batch activations and dL/dz:
+    unsigned char *next = (unsigned char *)network->arena;
+    for (int l = 0; l < layer_count; l++) {
+        mlp_layer_t *layer = &network->layers[l];
+        layer->weights = arena_take(&next, layer_parameter_count(layer));
+        layer->biases = layer->weights + layer_weight_count(layer);
+    }
+    for (int l = 0; l < layer_count; l++) {
+        mlp_layer_t *gradient = &network->gradients[l];
+        gradient->weights = arena_take(&next, layer_parameter_count(gradient));
+        gradient->biases = gradient->weights + layer_weight_count(gradient);
+    }
+    for (int l = 0; l < layer_count; l++) {
+        if (state_count) {
+            network->layers[l].state = arena_take(&next, layer_parameter_count(&network->layers[l]) * state_count);
+        }
+    }
+    for (int l = 0; l < layer_count; l++) {
+        network->outputs[l] = arena_take(&next, (size_t)max_batch_size * sizes[l + 1]);
+        network->dLdz[l] = arena_take(&next, (size_t)max_batch_size * sizes[l + 1]);
+    }
+    network->input_rows = arena_take(&next, (size_t)max_batch_size * network->input_count);
+
+    // The ±0.01 of init_mlp would shrink the signal by orders of magnitude per layer, which a single hidden layer
+    // gets away with but a deep stack doesn't:
+    for (int l = 0; l < layer_count; l++) {
+        mlp_init_layer_weights(&network->layers[l], activations[l] == ACTIVATION_RELU ? MLP_INIT_HE : MLP_INIT_XAVIER, pool);
+    }
+
+    if (getenv("MLP_PROFILE")) {
+        network->profile = init_mlp_profile(stderr);
+    }
+    return network;
+}
+
+void destroy_mlp_network(mlp_network_t *network) {
+    destroy_mlp_profile(network->profile);
+    // Every layer, gradient and buffer lives in the arena:
+    free(network->arena);
+    free(network->layers);
+    free(network->gradients);
+    free(network->outputs);
+    free(network->dLdz);
+    free(network);
+}
+
+// Run batch_size rows through every layer, leaving each layer's activated outputs in network->outputs:
+static void network_feedforward(const mlp_network_t *network, int batch_size, const real_t *features, int feature_stride) {
+    const real_t *input = features;
+    int input_stride = feature_stride;
+    for (int l = 0; l < network->layer_count; l++) {
+        layer_feedforward_batch(&network->layers[l], batch_size, input, input_stride, network->outputs[l]);
+        input = network->outputs[l];
+        input_stride = network->layers[l].output_count;
+    }
+    output_softmax(network->loss, network->outputs[network->layer_count - 1], batch_size, network->output_count);
+}
+
+void mlp_network_gradients(mlp_network_t *network, int batch_size, const mlp_inputs_t *inputs, const mlp_labels_t *labels, long first_row) {
+
+    // The arena's activation and gradient slabs hold max_batch_size rows; a larger batch is a programming error that
+    // would run past them:
+    if (batch_size > network->max_batch_size) {
+        fprintf(stderr, "Batch of %d rows is larger than the network's arena (%d)\n", batch_size, network->max_batch_size);
+        abort();
+    }
+
+    // The same maths as mlp_batch_gradients (see the comments there), repeated down the stack of layers.
+    const int last = network->layer_count - 1;
+    const int output_count = network->output_count;
+    const mlp_layer_t *layers = network->layers;
+
+    int feature_stride;
+    const real_t *features = input_rows(inputs, first_row, batch_size, network->input_rows, &feature_stride);
+    mlp_profile_phase(network->profile, MLP_PHASE_FETCH);
+
+    network_feedforward(network, batch_size, features, feature_stride);
+    mlp_profile_phase(network->profile, MLP_PHASE_FORWARD);
+
+    // Output layer dL/dz = f'(z) * (a - y), or p - y for a softmax output:
+    network->batch_loss = 0;
+    for (int b = 0; b < batch_size; b++) {
+        const real_t *a = network->outputs[last] + (size_t)b * output_count;
+        output_error(labels, first_row + b, a, network->dLdz[last] + (size_t)b * output_count, output_count);
+        network->batch_loss += sample_loss(network->loss, labels, first_row + b, a, output_count);
+    }
+    if (network->loss == MLP_LOSS_MSE) {
+        layer_activation_derivative(&layers[last], network->outputs[last], network->dLdz[last], (size_t)batch_size * output_count);
+    }
+
+    // Back down the stack, each layer's dL/dz = f'(z) * (dL/dz of the layer above * that layer's weights):
+    for (int l = last; l > 0; l--) {
+        gemm(GEMM_NO_TRANS, GEMM_NO_TRANS, batch_size, layers[l].input_count, layers[l].output_count,
+            1.0, network->dLdz[l], layers[l].output_count, layers[l].weights, layers[l].stride, 0.0, network->dLdz[l - 1], layers[l].input_count);
+        layer_activation_derivative(&layers[l - 1], network->outputs[l - 1], network->dLdz[l - 1], (size_t)batch_size * layers[l - 1].output_count);
+    }
+
+    // Weight gradients, summed over the batch. Each layer's input is the activated output of the one below it:
+    for (int l = 0; l <= last; l++) {
+        const real_t *input = l ? network->outputs[l - 1] : features;
+        const int input_stride = l ? layers[l].input_count : feature_stride;
+        layer_gradient_batch(&layers[l], &network->gradients[l], batch_size, network->dLdz[l], input, input_stride);
+    }
+    mlp_profile_phase(network->profile, MLP_PHASE_BACKWARD);
+}
+
+void mlp_network_apply_gradients(mlp_network_t *network, const double learning_rate) {
+    network->optimizer.step++;
+    for (int l = 0; l < network->layer_count; l++) {
+        layer_apply_gradient(&network->layers[l], &network->gradients[l], &network->optimizer, learning_rate);
+    }
+}
+
+void train_mlp_network(mlp_network_t *network, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate) {
+
+    if (network->input_count != training_features->dimension) {
+        printf("Invalid Feature Dimensionality.\n");
+        return;
+    }
+
+    if (network->output_count != training_labels->dimension) {
+        printf("Invalid Label Dimensionality.\n");
+        return;
+    }
+
+    const int batch_size = network->max_batch_size;
+    mlp_profile_begin(network->profile);
+
+    // Foreach Epoch:
+    for (int epoch = 0; epoch < network->epoch_count; epoch++) {
+        // Foreach batch of consecutive training rows (the last one may be short):
+        for (int i = 0; i < feature_count; i += batch_size) {
+            const int n = (feature_count - i < batch_size) ? feature_count - i : batch_size;
+            mlp_network_gradients(network, n, training_features, training_labels, i);
+            mlp_network_apply_gradients(network, learning_rate);
+            mlp_profile_phase(network->profile, MLP_PHASE_UPDATE);
+            mlp_profile_samples(network->profile, n, network->batch_loss);
+        }
+        mlp_profile_end_epoch(network->profile);
+    }
+
+    mlp_profile_end(network->profile);
+}
+
+void mlp_network_predict(mlp_network_t *network, int count, const mlp_inputs_t *inputs, real_t *outputs, int *labels) {
+    const int batch_size = network->max_batch_size;
+    const int output_count = network->output_count;
+
+    for (int i = 0; i < count; i += batch_size) {
+        const int n = (count - i < batch_size) ? count - i : batch_size;
+        int feature_stride;
+        const real_t *features = input_rows(inputs, i, n, network->input_rows, &feature_stride);
+        network_feedforward(network, n, features, feature_stride);
+
+        const real_t *result = network->outputs[network->layer_count - 1];
+        if (outputs) {
+            memcpy(outputs + (size_t)i * output_count, result, sizeof(real_t) * n * output_count);
+        }
+        if (labels) {
+            output_labels(result, n, output_count, labels + i);
+        }
+    }
+}
+
+// ////////////////////////////////////  //
+//             Weights Files             //
+//  ///////////////////////////////////  //
+
+static void write_layer(const mlp_layer_t *layer, FILE *file) {
+    for (int k = 0; k < layer->output_count; k++) {
+        fwrite(mlp_layer_row(layer, k), sizeof(real_t), layer->input_count, file);
+        fwrite(&layer->biases[k], sizeof(real_t), 1, file);
+    }
+}
+
+// Read count values stored as element_size byte floats (float32 or float64) into a real_t array.
+// Returns 0, or -1 if the file ends first:
+static int read_values(real_t *values, int count, size_t element_size, FILE *file) {
+    if (element_size == sizeof(real_t)) {
+        return fread(values, sizeof(real_t), count, file) == (size_t)count ? 0 : -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (element_size == sizeof(float)) {
+            float value = 0;
+            if (fread(&value, sizeof(float), 1, file) != 1) {
+                return -1;
+            }
+            values[i] = (real_t)value;
+        } else {
+            double value = 0;
+            if (fread(&value, sizeof(double), 1, file) != 1) {
+                return -1;
+            }
+            values[i] = (real_t)value;
+        }
+    }
+    return 0;
+}
+
+static int read_layer(mlp_layer_t *layer, size_t element_size, FILE *file) {
+    for (int k = 0; k < layer->output_count; k++) {
+        if (read_values(mlp_layer_row(layer, k), layer->input_count, element_size, file) != 0 ||
+            read_values(&layer->biases[k], 1, element_size, file) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void save_mlp_weights(const multilayer_perceptron_t *mlp, const char *filename) {
+    
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        perror("Failed to open file for saving weights");
+        return;
+    }
+
+    // Save the MLP structure
+    fwrite(&mlp->input_count, sizeof(int), 1, file);
+    fwrite(&mlp->p_hidden1_count, sizeof(int), 1, file);
+    fwrite(&mlp->p_output_count, sizeof(int), 1, file);
+
+    // Save weights and biases for hidden layer, then output layer.
+    // The on-disk layout is unchanged from the per-perceptron format (each neuron's weights followed by its bias),
+    // the row padding is never written. Values are written as real_t, so MLP_FLOAT32 builds produce a float32 file
+    // (see convert_weights.c to convert between the two):
+    write_layer(&mlp->hidden1, file);
+    write_layer(&mlp->output, file);
+
+    fclose(file);
+}
+
+// Row by row, as the file may have been written with a different row padding:
+static void copy_layer_weights(mlp_layer_t *into, const mlp_layer_t *from) {
+    for (int k = 0; k < into->output_count; k++) {
+        memcpy(mlp_layer_row(into, k), mlp_layer_row(from, k), sizeof(real_t) * into->input_count);
+    }
+    memcpy(into->biases, from->biases, sizeof(real_t) * into->output_count);
+}
+
+// Copy the weights of a model file into an existing network of the same structure:
+static int load_mlp_model_weights(multilayer_perceptron_t *mlp, const char *filename) {
+    multilayer_perceptron_t *model = map_mlp_model(filename, 1);
+    if (!model) {
+        return -1;
+    }
+    if (model->input_count != mlp->input_count || model->p_hidden1_count != mlp->p_hidden1_count || model->p_output_count != mlp->p_output_count) {
+        fprintf(stderr, "MLP structure does not match file contents\n");
+        destroy_mlp(model);
+        return -1;
+    }
+    copy_layer_weights(&mlp->hidden1, &model->hidden1);
+    copy_layer_weights(&mlp->output, &model->output);
+    destroy_mlp(model);
+    return 0;
+}
+
+int load_mlp_weights(multilayer_perceptron_t *mlp, const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        perror("Failed to open file for loading weights");
+        return -1;
+    }
+
+    char magic[sizeof(MLP_MODEL_MAGIC) - 1];
+    if (fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, MLP_MODEL_MAGIC, sizeof(magic)) == 0) {
+        fclose(file);
+        return load_mlp_model_weights(mlp, filename);
+    }
+    rewind(file);
+
+    int input_count, hidden1_count, output_count;
+
+    // Read and validate structure
+    if (fread(&input_count, sizeof(int), 1, file) != 1 || fread(&hidden1_count, sizeof(int), 1, file) != 1 ||
+        fread(&output_count, sizeof(int), 1, file) != 1) {
+        fclose(file);
+        fprintf(stderr, "Weights file is too short to hold an MLP structure\n");
+        return -1;
+    }
+
+    if (input_count != mlp->input_count || hidden1_count != mlp->p_hidden1_count || output_count != mlp->p_output_count) {
+        fclose(file);
+        fprintf(stderr, "MLP structure does not match file contents\n");
+        return -1;
+    }
+
+    // Weights are stored in the precision of the build that saved them (float64, or float32 for MLP_FLOAT32 builds).
+    // The format has no field for it, so infer it from the size of the payload following the structure:
+    const long value_count = (long)hidden1_count * (input_count + 1) + (long)output_count * (hidden1_count + 1);
+    const long payload_start = ftell(file);
+    fseek(file, 0, SEEK_END);
+    const long payload_size = ftell(file) - payload_start;
+    fseek(file, payload_start, SEEK_SET);
+
+    size_t element_size;
+    if (payload_size == value_count * (long)sizeof(double)) {
+        element_size = sizeof(double);
+    } else if (payload_size == value_count * (long)sizeof(float)) {
+        element_size = sizeof(float);
+    } else {
+        fclose(file);
+        fprintf(stderr, "Weights file size does not match the MLP structure\n");
+        return -1;
+    }
+
+    // Load weights and biases for hidden layer, then output layer (converting to real_t if needed):
+    if (read_layer(&mlp->hidden1, element_size, file) != 0 || read_layer(&mlp->output, element_size, file) != 0) {
+        fclose(file);
+        fprintf(stderr, "Weights file is truncated\n");
+        return -1;
+    }
+
+    fclose(file);
+    return 0;
+}
+// ////////////////////////////////////  //
+//              Model Files              //
+//  ///////////////////////////////////  //
+
+// FNV-1a over the native 64-bit words of data (zero padded out to a whole word), run as four interleaved streams so
+// the multiplies overlap, then folded together. Not cryptographic; it is there to catch truncation and corruption:
+static uint64_t model_checksum(const void *data, size_t size) {
+    const uint64_t prime = 0x100000001b3ull;
+    uint64_t hash[4] = {0xcbf29ce484222325ull, 0xcbf29ce484222325ull ^ 1, 0xcbf29ce484222325ull ^ 2, 0xcbf29ce484222325ull ^ 3};
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int s = 0; s < 4; s++) {
+            uint64_t word;
+            memcpy(&word, bytes + i + 8 * s, sizeof(word));
+            hash[s] = (hash[s] ^ word) * prime;
+        }
+    }
+    for (int s = 0; i < size; i += 8, s++) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, (size - i < 8) ? size - i : 8);
+        hash[s] = (hash[s] ^ word) * prime;
+    }
+
+    uint64_t folded = size;
+    for (int s = 0; s < 4; s++) {
+        folded = (folded ^ hash[s]) * prime;
+    }
+    return folded;
+}
+
+static uint64_t header_checksum(const mlp_model_header_t *header) {
+    return model_checksum(header, offsetof(mlp_model_header_t, header_checksum));
+}
+
+static size_t page_align(size_t offset) {
+    return (offset + MLP_MODEL_PAGE_SIZE - 1) / MLP_MODEL_PAGE_SIZE * MLP_MODEL_PAGE_SIZE;
+}
+
+int save_mlp_model(const multilayer_perceptron_t *mlp, const char *filename) {
+
+    // Layers in file order:
+    const mlp_layer_t *layers[] = {&mlp->hidden1, &mlp->output};
+    const int layer_count = sizeof(layers) / sizeof(layers[0]);
+
+    mlp_model_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MLP_MODEL_MAGIC, sizeof(header.magic));
+    header.version = MLP_MODEL_VERSION;
+    header.byte_order = MLP_MODEL_BYTE_ORDER;
+    header.element_size = sizeof(real_t);
+    header.loss = mlp->loss;
+    header.layer_count = layer_count;
+
+    // Sections follow the header page, each starting on a page of its own:
+    size_t offset = MLP_MODEL_PAGE_SIZE;
+    for (int l = 0; l < layer_count; l++) {
+        const mlp_layer_t *layer = layers[l];
+        if (layer->activation == ACTIVATION_CUSTOM) {
+            fprintf(stderr, "%s: Custom activation functions can't be saved in a model file\n", filename);
+            return -1;
+        }
+        mlp_model_layer_t *section = &header.layers[l];
+        section->input_count = layer->input_count;
+        section->output_count = layer->output_count;
+        section->stride = layer->stride;
+        section->activation = layer->activation;
+        section->offset = offset;
+        section->size = sizeof(real_t) * layer_parameter_count(layer);
+        offset = page_align(offset + section->size);
+    }
+    const mlp_model_layer_t *last = &header.layers[layer_count - 1];
+    header.file_size = last->offset + last->size;
+
+    // The payload checksum runs over exactly the bytes written after the header page, padding included:
+    static const unsigned char zeros[MLP_MODEL_PAGE_SIZE];
+    unsigned char *payload = calloc(header.file_size - MLP_MODEL_PAGE_SIZE, 1);
+    for (int l = 0; l < layer_count; l++) {
+        memcpy(payload + header.layers[l].offset - MLP_MODEL_PAGE_SIZE, layers[l]->weights, header.layers[l].size);
+    }
+    header.payload_checksum = model_checksum(payload, header.file_size - MLP_MODEL_PAGE_SIZE);
+    header.header_checksum = header_checksum(&header);
+
+    // Write a temporary file next to the target, then rename it into place (atomic on the same filesystem):
+    char *temporary = malloc(strlen(filename) + 16);
+    sprintf(temporary, "%s.tmp.%d", filename, (int)getpid());
+    FILE *file = fopen(temporary, "wb");
+    if (!file) {
+        perror("Failed to open file for saving model");
+        free(payload);
+        free(temporary);
+        return -1;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(zeros, MLP_MODEL_PAGE_SIZE - sizeof(header), 1, file) == 1 &&
+        fwrite(payload, header.file_size - MLP_MODEL_PAGE_SIZE, 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(temporary, filename) != 0) {
+        perror("Failed to save model");
+        remove(temporary);
+        free(payload);
+        free(temporary);
+        return -1;
+    }
+
+    free(payload);
+    free(temporary);
+    return 0;
+}
+
+// Check a mapped model file's header, and that its sections describe a network this build can run.
+// Returns 0, or -1 after printing why:
+static int validate_model(const mlp_model_header_t *header, size_t size, const char *filename) {
+    if (size < MLP_MODEL_PAGE_SIZE || memcmp(header->magic, MLP_MODEL_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s: Not a model file\n", filename);
+        return -1;
+    }
+    if (header->byte_order != MLP_MODEL_BYTE_ORDER) {
+        fprintf(stderr, "%s: Model file was written on a machine of the other byte order\n", filename);
+        return -1;
+    }
+    if (header->version != MLP_MODEL_VERSION) {
+        fprintf(stderr, "%s: Unsupported model file version %u\n", filename, header->version);
+        return -1;
+    }
+    if (header->header_checksum != header_checksum(header)) {
+        fprintf(stderr, "%s: Model file header checksum mismatch\n", filename);
+        return -1;
+    }
+    if (header->file_size != size) {
+        fprintf(stderr, "%s: Model file size does not match its header\n", filename);
+        return -1;
+    }
+    if ((header->element_size != sizeof(float) && header->element_size != sizeof(double)) || header->layer_count != 2 ||
+        (header->loss != MLP_LOSS_MSE && header->loss != MLP_LOSS_SOFTMAX_CROSS_ENTROPY)) {
+        fprintf(stderr, "%s: Model file describes a network this build can't run\n", filename);
+        return -1;
+    }
+
+    const uint32_t row_block = MLP_ALIGNMENT / header->element_size;
+    for (uint32_t l = 0; l < header->layer_count; l++) {
+        const mlp_model_layer_t *section = &header->layers[l];
+        double (*activation_function)(double);
+        double (*derivative_activation_function)(double);
+        const uint64_t bias_count = (section->output_count + row_block - 1) / row_block * row_block;
+        if (section->input_count == 0 || section->output_count == 0 || section->input_count > INT32_MAX ||
+            section->output_count > INT32_MAX || section->stride < section->input_count || section->stride % row_block != 0 ||
+            (l > 0 && section->input_count != header->layers[l - 1].output_count) ||
+            !activation_functions((activation_type_t)section->activation, &activation_function, &derivative_activation_function) ||
+            section->offset % MLP_MODEL_PAGE_SIZE != 0 || section->offset < MLP_MODEL_PAGE_SIZE ||
+            section->size != ((uint64_t)section->output_count * section->stride + bias_count) * header->element_size ||
+            section->offset > size || section->size > size - section->offset) {
+            fprintf(stderr, "%s: Model file layer %u is malformed\n", filename, l);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Point a layer at its section of a mapping in this build's precision, with no copy:
+static void map_layer(mlp_layer_t *layer, const mlp_model_layer_t *section, unsigned char *map) {
+    double (*activation_function)(double);
+    double (*derivative_activation_function)(double);
+    activation_functions((activation_type_t)section->activation, &activation_function, &derivative_activation_function);
+
+    layer->input_count = section->input_count;
+    layer->output_count = section->output_count;
+    layer->stride = section->stride;
+    layer->weights = (real_t *)(map + section->offset);
+    layer->biases = layer->weights + (size_t)layer->output_count * layer->stride;
+    layer->activation_function = activation_function;
+    layer->derivative_activation_function = derivative_activation_function;
+    layer->activation = (activation_type_t)section->activation;
+    layer->state = NULL;
+}
+
+// Or convert a section of the other precision into an allocated layer:
+static void convert_layer(mlp_layer_t *layer, const mlp_model_layer_t *section, size_t element_size, const unsigned char *map) {
+    double (*activation_function)(double);
+    double (*derivative_activation_function)(double);
+    activation_functions((activation_type_t)section->activation, &activation_function, &derivative_activation_function);
+    alloc_layer(layer, section->input_count, section->output_count, activation_function, derivative_activation_function);
+
+    const unsigned char *weights = map + section->offset;
+    const unsigned char *biases = weights + (size_t)section->output_count * section->stride * element_size;
+    for (int k = 0; k < layer->output_count; k++) {
+        for (int j = 0; j < layer->input_count; j++) {
+            const size_t index = (size_t)k * section->stride + j;
+            mlp_layer_row(layer, k)[j] = (element_size == sizeof(float)) ?
+                (real_t)((const float *)weights)[index] : (real_t)((const double *)weights)[index];
+        }
+        layer->biases[k] = (element_size == sizeof(float)) ? (real_t)((const float *)biases)[k] : (real_t)((const double *)biases)[k];
+    }
+}
+
+multilayer_perceptron_t *map_mlp_model(const char *filename, int verify) {
+
+    const int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror(filename);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < MLP_MODEL_PAGE_SIZE) {
+        fprintf(stderr, "%s: Not a model file\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    // Shared and read-only, so every process serving this file maps the same page cache pages.
+    // The mapping stays valid after the descriptor is closed:
+    unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(filename);
+        return NULL;
+    }
+
+    const mlp_model_header_t *header = (const mlp_model_header_t *)map;
+    if (validate_model(header, st.st_size, filename) != 0) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    if (verify && header->payload_checksum != model_checksum(map + MLP_MODEL_PAGE_SIZE, st.st_size - MLP_MODEL_PAGE_SIZE)) {
+        fprintf(stderr, "%s: Model file payload checksum mismatch\n", filename);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    // Init and zeroise:
+    multilayer_perceptron_t *mlp = (multilayer_perceptron_t *)malloc(sizeof(*mlp));
+    memset(mlp, 0, sizeof(*mlp));
+    mlp->input_count = header->layers[0].input_count;
+    mlp->p_hidden1_count = header->layers[0].output_count;
+    mlp->p_output_count = header->layers[1].output_count;
+    mlp->loss = (mlp_loss_t)header->loss;
+    mlp->optimizer = mlp_sgd_optimizer();
+
+    if (header->element_size == sizeof(real_t)) {
+        map_layer(&mlp->hidden1, &header->layers[0], map);
+        map_layer(&mlp->output, &header->layers[1], map);
+        mlp->model_map = map;
+        mlp->model_map_size = st.st_size;
+    } else {
+        convert_layer(&mlp->hidden1, &header->layers[0], header->element_size, map);
+        convert_layer(&mlp->output, &header->layers[1], header->element_size, map);
+        munmap(map, st.st_size);
+    }
+
+    init_mlp_scratch(mlp);
+    return mlp;
+}
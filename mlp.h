@@ -6,8 +6,110 @@
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
+#include <stdint.h>
 
 #include "perceptron.h"
+#include "threadpool.h"
+#include "profile.h"
+
+// Alignment (in bytes) of every weight row, wide enough for a full cache line / AVX-512 register:
+#define MLP_ALIGNMENT 64
+
+// A fully connected layer.
+// Rather than an array of individually allocated perceptrons, the weights of every neuron in the layer
+// live in a single aligned, row-major matrix: row k holds the input weights of neuron k.
+// Rows are padded out to 'stride' elements so each one starts on an MLP_ALIGNMENT boundary, 
+// and the biases follow the matrix in the same allocation.
+typedef struct mlp_layer_t {
+    int input_count;
+    int output_count;
+    int stride;
+    real_t *weights;
+    real_t *biases;
+    double (*activation_function)(double);
+    double (*derivative_activation_function)(double);
+    // Which vector kernel implements the pair above, or ACTIVATION_CUSTOM to call them element by element:
+    activation_type_t activation;
+    // Optimizer state (see mlp_set_optimizer), in blocks shaped like the weights and biases: the velocity for
+    // momentum, or Adam's first then second moments. NULL for plain SGD:
+    real_t *state;
+} mlp_layer_t;
+
+// Weight row (the input weights) of a single neuron in the layer:
+static inline real_t *mlp_layer_row(const mlp_layer_t *layer, int neuron) {
+    return layer->weights + (size_t)neuron * layer->stride;
+}
+
+// Scratch for one single-sample forward/backward pass: the activated output and dL/dz of each layer.
+// Each thread running the _r (re-entrant) functions below needs its own.
+typedef struct mlp_workspace_t {
+    // The current input row widened to real_t, when the inputs are bytes:
+    real_t *input_row;
+    real_t *hidden1_output;
+    real_t *output_output;
+    real_t *hidden1_dLdz;
+    real_t *output_dLdz;
+    // Backpropagation's list of the hidden units with a nonzero dL/dz for the current row (dead ReLU units are left
+    // out), the only ones whose weights it updates:
+    int *hidden1_active;
+    // Where the phases of per-sample training through this workspace are recorded (see profile.h), or NULL:
+    mlp_profile_t *profile;
+} mlp_workspace_t;
+
+// What the network is trained to minimise, and how its outputs are read:
+//  - MLP_LOSS_MSE: mean squared error between the output layer's activations and the labels.
+//  - MLP_LOSS_SOFTMAX_CROSS_ENTROPY: the output layer's values are turned into probabilities by a softmax, and
+//    trained by cross-entropy. Both are fused, so dL/dz is just p - y; the output activation should be linear.
+typedef enum {
+    MLP_LOSS_MSE,
+    MLP_LOSS_SOFTMAX_CROSS_ENTROPY
+} mlp_loss_t;
+
+// The update rule mlp_apply_gradients uses to step the weights along the batch gradients:
+//  - MLP_OPTIMIZER_SGD: w -= α * g.
+//  - MLP_OPTIMIZER_MOMENTUM: a velocity accumulates the gradients, decaying by momentum per step, and w follows it.
+//  - MLP_OPTIMIZER_NESTEROV: as momentum, but the step looks ahead along the updated velocity.
+//  - MLP_OPTIMIZER_ADAM: each weight's step is scaled by running estimates of its gradient's mean and variance.
+// Each runs as one fused pass over a layer's weights, gradients and state (see optimizer_momentum in kernels.h).
+typedef enum {
+    MLP_OPTIMIZER_SGD,
+    MLP_OPTIMIZER_MOMENTUM,
+    MLP_OPTIMIZER_NESTEROV,
+    MLP_OPTIMIZER_ADAM
+} mlp_optimizer_type_t;
+
+typedef struct mlp_optimizer_t {
+    mlp_optimizer_type_t type;
+    // Momentum and Nesterov:
+    double momentum;
+    // Adam:
+    double beta1;
+    double beta2;
+    double epsilon;
+    // Updates taken so far, for Adam's bias correction:
+    long step;
+} mlp_optimizer_t;
+
+static inline mlp_optimizer_t mlp_sgd_optimizer(void) {
+    mlp_optimizer_t optimizer = {MLP_OPTIMIZER_SGD, 0, 0, 0, 0, 0};
+    return optimizer;
+}
+
+static inline mlp_optimizer_t mlp_momentum_optimizer(double momentum) {
+    mlp_optimizer_t optimizer = {MLP_OPTIMIZER_MOMENTUM, momentum, 0, 0, 0, 0};
+    return optimizer;
+}
+
+static inline mlp_optimizer_t mlp_nesterov_optimizer(double momentum) {
+    mlp_optimizer_t optimizer = {MLP_OPTIMIZER_NESTEROV, momentum, 0, 0, 0, 0};
+    return optimizer;
+}
+
+// The usual values are beta1 0.9, beta2 0.999 and epsilon 1e-8:
+static inline mlp_optimizer_t mlp_adam_optimizer(double beta1, double beta2, double epsilon) {
+    mlp_optimizer_t optimizer = {MLP_OPTIMIZER_ADAM, 0, beta1, beta2, epsilon, 0};
+    return optimizer;
+}
 
 typedef struct multilayer_perceptron_t {
     
@@ -19,30 +121,377 @@ typedef struct multilayer_perceptron_t {
     
     // Hidden layer:
     int p_hidden1_count;
-    perceptron_t **p_hidden1;
-    double *p_hidden1_output;
+    mlp_layer_t hidden1;
+    real_t *p_hidden1_output;
 
     // Output layer:
     int p_output_count;
-    perceptron_t **p_output;
-    double *p_output_output;
+    mlp_layer_t output;
+    real_t *p_output_output;
+
+    // MLP_LOSS_MSE unless set otherwise after init_mlp:
+    mlp_loss_t loss;
+
+    // Plain SGD unless set otherwise with mlp_set_optimizer:
+    mlp_optimizer_t optimizer;
+
+    // Scratch used by mlp_feedforward/mlp_backpropagate (p_hidden1_output and p_output_output point into it):
+    mlp_workspace_t *workspace;
+
+    // Training instrumentation, owned by the network. NULL (off) unless enabled with mlp_enable_profile:
+    mlp_profile_t *profile;
+
+    // The read-only model file mapping the layer weights point into (see map_mlp_model), or NULL when they are allocated:
+    void *model_map;
+    size_t model_map_size;
     
 } multilayer_perceptron_t;
 
+// Scratch space and gradient accumulators for training on up to max_batch_size samples at a time.
+// Every per-sample vector of the single-sample path becomes one row of a [batch][count] matrix.
+typedef struct mlp_batch_t {
+    int max_batch_size;
+
+    // Activated outputs and dL/dz of each layer, one row per sample:
+    real_t *hidden1_output;
+    real_t *output_output;
+    real_t *hidden1_dLdz;
+    real_t *output_dLdz;
+
+    // Byte input rows widened (and scaled) to real_t for the batch's matrix products; small enough to stay in cache:
+    real_t *input_rows;
+
+    // Gradients of the loss summed over the batch, shaped like the layer they belong to:
+    mlp_layer_t hidden1_gradient;
+    mlp_layer_t output_gradient;
+
+    // Loss summed over the last batch passed to mlp_batch_gradients:
+    double loss;
+
+    // Where the phases of mlp_batch_gradients are recorded (see profile.h), or NULL:
+    mlp_profile_t *profile;
+} mlp_batch_t;
+
+// CSR (compressed sparse row) encoding of a set of input rows: row i's nonzero values (already scaled to real_t)
+// and their columns are values/columns[row_offsets[i], row_offsets[i + 1]).
+// Rows with more than dense_limit nonzeros are cheaper to process densely, and are left to the dense path.
+typedef struct mlp_sparse_inputs_t {
+    int count;
+    int dimension;
+    int dense_limit;
+    long *row_offsets;
+    int *columns;
+    real_t *values;
+} mlp_sparse_inputs_t;
+
+// Default density (fraction of nonzeros) above which a row goes down the dense path instead. Dense kernels stream
+// whole vectors at full SIMD width while the sparse ones gather, so sparse only pays off well below 50%:
+#define MLP_SPARSE_DENSITY 0.25
+
+// A set of network input rows, each dimension values long and stride elements apart.
+// Rows are either real_t features, or uint8 bytes (e.g. raw pixels) that the first layer multiplies by byte_scale
+// as it reads them, so byte datasets are never expanded to real_t in memory (1 byte per value instead of 4 or 8).
+typedef struct mlp_inputs_t {
+    int dimension;
+    int stride;
+    const real_t *features;
+    const unsigned char *bytes;
+    real_t byte_scale;
+
+    // Optional CSR encoding of the same rows (see encode_sparse_inputs). When set, the per-sample first layer
+    // forward pass and weight update only visit the nonzeros of sparse enough rows:
+    const mlp_sparse_inputs_t *sparse;
+} mlp_inputs_t;
+
+static inline mlp_inputs_t mlp_real_inputs(const real_t *features, int dimension, int stride) {
+    mlp_inputs_t inputs = {dimension, stride, features, NULL, 1.0, NULL};
+    return inputs;
+}
+
+static inline mlp_inputs_t mlp_byte_inputs(const unsigned char *bytes, int dimension, int stride, real_t byte_scale) {
+    mlp_inputs_t inputs = {dimension, stride, NULL, bytes, byte_scale, NULL};
+    return inputs;
+}
+
+// Training targets for a set of rows, in one of two forms:
+//  - real_t rows of dimension values, stride elements apart;
+//  - one class index per row (less than dimension, so up to 256 classes), standing in for a one-hot row that is
+//    never built. With MLP_LOSS_SOFTMAX_CROSS_ENTROPY this is the natural form, e.g. MNIST's raw label bytes.
+typedef struct mlp_labels_t {
+    int dimension;
+    int stride;
+    const real_t *values;
+    const unsigned char *classes;
+} mlp_labels_t;
+
+static inline mlp_labels_t mlp_real_labels(const real_t *values, int dimension, int stride) {
+    mlp_labels_t labels = {dimension, stride, values, NULL};
+    return labels;
+}
+
+// The classes index the outputs unchecked, so validate them where they are read in (as mnist.c does for the IDX labels):
+static inline mlp_labels_t mlp_class_labels(const unsigned char *classes, int dimension) {
+    mlp_labels_t labels = {dimension, 1, NULL, classes};
+    return labels;
+}
+
+// Throughput of a training run:
+typedef struct mlp_train_stats_t {
+    long samples;
+    double seconds;
+    double samples_per_second;
+} mlp_train_stats_t;
+
 double step_function(double x);
 
+// Starting weight distributions, all uniform: MLP_INIT_UNIFORM in ±0.01 with biases drawn the same way (what init_mlp
+// uses, and enough for a single small hidden layer), MLP_INIT_XAVIER (Glorot) in ±sqrt(6 / (fan_in + fan_out)) and
+// MLP_INIT_HE in ±sqrt(6 / fan_in), for ReLU layers, both with zero biases.
+typedef enum {
+    MLP_INIT_UNIFORM,
+    MLP_INIT_XAVIER,
+    MLP_INIT_HE
+} mlp_init_t;
+
+// Redraw a layer's weights and biases from a fresh stream of the process seed (see random.h), split by rows across
+// the pool if there is one. Every row draws from its own sub-stream, so the weights only depend on the seed and the
+// order layers are initialised in, never on the thread count.
+void mlp_init_layer_weights(mlp_layer_t *layer, mlp_init_t init, thread_pool_t *pool);
+
 multilayer_perceptron_t *init_mlp(int p_input_count, int p_hidden1_count, int p_output_count, 
     double (*hidden1_activation_function)(double), double (*hidden1_derivative_activation_function)(double), 
     double (*output_activation_function)(double),  double (*output_derivative_activation_function)(double), int epoch_count);
 void destroy_mlp(multilayer_perceptron_t *mlp);
 
-void mlp_feedforward(multilayer_perceptron_t *mlp, const double training_features[]);
-void mlp_backpropagate(multilayer_perceptron_t *mlp, const double training_features[], const double training_labels[], const double learning_rate);
+// Switch the update rule of the batched trainers, with freshly zeroised state.
+// The per-sample paths (train_mlp, a batch_size of 1 with SGD, and Hogwild) always update in place with plain SGD.
+void mlp_set_optimizer(multilayer_perceptron_t *mlp, const mlp_optimizer_t *optimizer);
+
+// Record per-phase timings, per-epoch loss and throughput, and hardware counters while training, written to log
+// (stderr if NULL) every epoch and on SIGUSR1 (see profile.h). Networks built while MLP_PROFILE is set in the
+// environment start with this enabled on stderr.
+void mlp_enable_profile(multilayer_perceptron_t *mlp, FILE *log);
+
+mlp_workspace_t *init_mlp_workspace(const multilayer_perceptron_t *mlp);
+void destroy_mlp_workspace(mlp_workspace_t *workspace);
 
-void train_mlp(multilayer_perceptron_t *mlp, int feature_count, int feature_dimension, const double training_features[feature_count][feature_dimension],
-    int label_dimension, const double training_labels[feature_count][label_dimension], const double learning_rate);
+void mlp_feedforward(multilayer_perceptron_t *mlp, const real_t training_features[]);
+void mlp_backpropagate(multilayer_perceptron_t *mlp, const real_t training_features[], const real_t training_labels[], const double learning_rate);
 
+// Re-entrant versions of the above, keeping all per-sample state in the caller's workspace:
+void mlp_feedforward_r(const multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const real_t training_features[]);
+void mlp_backpropagate_r(multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const real_t training_features[], const real_t training_labels[], const double learning_rate);
+
+// The same for row i of a set of inputs (see mlp_inputs_t), which may be bytes, and of a set of labels (see mlp_labels_t):
+void mlp_feedforward_row(const multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const mlp_inputs_t *inputs, long i);
+void mlp_backpropagate_row(multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const mlp_inputs_t *inputs, long i,
+    const mlp_labels_t *labels, const double learning_rate);
+
+void train_mlp(multilayer_perceptron_t *mlp, int feature_count, int feature_dimension, const real_t training_features[feature_count][feature_dimension],
+    int label_dimension, const real_t training_labels[feature_count][label_dimension], const double learning_rate);
+
+// Mini-batch training, where each layer's forward pass, dL/dz and weight gradients are computed for the whole batch
+// as matrix-matrix products (see gemm.h), then applied by the optimizer. A batch_size of 1 with plain SGD falls back to train_mlp.
+mlp_batch_t *init_mlp_batch(const multilayer_perceptron_t *mlp, int max_batch_size);
+void destroy_mlp_batch(mlp_batch_t *batch);
+void mlp_batch_gradients(const multilayer_perceptron_t *mlp, mlp_batch_t *batch, int batch_size, 
+    const mlp_inputs_t *features, const mlp_labels_t *labels, long first_row);
+void mlp_apply_gradients(multilayer_perceptron_t *mlp, const mlp_batch_t *batch, const double learning_rate);
+
+void train_mlp_minibatch(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate, int batch_size);
+
+// Scratch for batched inference, one slot per pool thread: a block of widened byte inputs (allocated on first use)
+// and the activations of each layer for that block. Each caller of mlp_predict_batch_r needs its own.
+typedef struct mlp_predict_thread_t {
+    real_t *input_rows;
+    real_t *hidden1_output;
+    real_t *output_output;
+} mlp_predict_thread_t;
+
+typedef struct mlp_predict_workspace_t {
+    mlp_predict_thread_t *threads;
+    int thread_count;
+} mlp_predict_workspace_t;
+
+// thread_count is that of the pool it will be used with (1 for none); mlp_predict_batch_r aborts if it is smaller:
+mlp_predict_workspace_t *init_mlp_predict_workspace(const multilayer_perceptron_t *mlp, int thread_count);
+void destroy_mlp_predict_workspace(mlp_predict_workspace_t *workspace);
+
+// Re-entrant batched inference: runs the first count rows of inputs through the network,
+// splitting them across the pool (which may be NULL to run on the calling thread).
+// outputs, if given, receives [count][p_output_count] activated outputs (probabilities, with a softmax output); labels, if given, the index of the
+// highest output for each input. The model is only read, so any number of callers may share it, each with its own workspace.
+void mlp_predict_batch_r(const multilayer_perceptron_t *mlp, mlp_predict_workspace_t *workspace, int count,
+    const mlp_inputs_t *inputs, real_t *outputs, int *labels, thread_pool_t *pool);
+
+// As mlp_predict_batch_r, with a workspace of its own for the call, for one-off batches:
+void mlp_predict_batch(const multilayer_perceptron_t *mlp, int count, const mlp_inputs_t *inputs,
+    real_t *outputs, int *labels, thread_pool_t *pool);
+
+// Single-sample, low-latency inference: each layer's neurons are split across the threads of a spin pool (see
+// threadpool.h), with a barrier between layers, so one prediction uses every core rather than one. Layers too small
+// to be worth splitting run on fewer threads. The outputs end up in workspace->output_output (as with
+// mlp_feedforward_row), but the workspace isn't prepared for backpropagation, and sparse encodings are ignored.
+void mlp_feedforward_latency(const multilayer_perceptron_t *mlp, mlp_workspace_t *workspace, const mlp_inputs_t *inputs,
+    long i, spin_pool_t *pool);
+
+// Synchronous data-parallel training: each batch is split across the threads of the pool, every thread computes
+// the gradients of its slice into private buffers, and these are summed by a pairwise tree reduction before
+// a single weight update. The batch is split, not multiplied, so the updates (and the model, up to rounding) are the
+// same for any thread count. Results are deterministic for a given thread count.
+// On a NUMA pool (MLP_NUMA=1, see threadpool.h) each thread first copies the rows it will train on onto its own node,
+// and the placement of those copies and of the gradient buffers is reported on stderr. The results are unchanged.
+void train_mlp_parallel(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate, int batch_size, thread_pool_t *pool);
+
+// Training fed by a background pipeline thread (see pipeline.h): every epoch visits the rows in a fresh random order
+// (reproducible for a given seed), with the shuffled batches gathered ahead of time while the previous one trains.
+// A batch_size of 1 with plain SGD is per-sample SGD; larger batches are split across the pool like train_mlp_parallel.
+void train_mlp_pipelined(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate, int batch_size, uint64_t seed, thread_pool_t *pool);
+
+// Asynchronous lock-free SGD (Hogwild): every thread in the pool claims samples from a shared atomic cursor and applies
+// per-sample updates directly to the shared weights. Sample order, and therefore the result, is not deterministic.
+// stats (optional) receives the throughput of the run.
+void train_mlp_hogwild(multilayer_perceptron_t *mlp, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate, thread_pool_t *pool, mlp_train_stats_t *stats);
+
+// Encode the first count rows of inputs as CSR, once, up front. Rows denser than density are marked for the dense path.
+// The rows are scanned in parallel on pool, if it isn't NULL.
+mlp_sparse_inputs_t *encode_sparse_inputs(const mlp_inputs_t *inputs, int count, double density, thread_pool_t *pool);
+void destroy_sparse_inputs(mlp_sparse_inputs_t *sparse);
+
+// Legacy weights file: three ints (the structure), then every neuron's weights followed by its bias, as real_t.
+// load_mlp_weights also accepts a model file (see below), as long as its structure matches. It returns 0, or -1 after
+// printing why, in which case the network's weights are not (or not all) loaded.
 void save_mlp_weights(const multilayer_perceptron_t *mlp, const char *filename);
-void load_mlp_weights(multilayer_perceptron_t *mlp, const char *filename);
+int load_mlp_weights(multilayer_perceptron_t *mlp, const char *filename);
+
+// ////////////////////////////////////  //
+//           N-Layer Networks            //
+//  ///////////////////////////////////  //
+
+// A fully connected network of any depth, trained and run a batch at a time with the same layer kernels as the
+// batched trainers above (and the same loss and optimizer options).
+// All the numbers a training step touches are carved out of one MLP_ALIGNMENT aligned arena, allocated and zeroised
+// once by init_mlp_network: every layer's weights and biases (back to back), their gradients and optimizer state,
+// and each layer's activated outputs and dL/dz for up to max_batch_size rows. Nothing is allocated or freed between
+// init and destroy.
+typedef struct mlp_network_t {
+    int epoch_count;
+    int input_count;
+    int output_count;
+    int max_batch_size;
+
+    // Weight layers (hidden layers, then the output layer), and their batch gradients, shaped like them:
+    int layer_count;
+    mlp_layer_t *layers;
+    mlp_layer_t *gradients;
+
+    // [max_batch_size][layers[l].output_count] activated outputs and dL/dz of each layer l:
+    real_t **outputs;
+    real_t **dLdz;
+
+    // Byte input rows widened (and scaled) to real_t, [max_batch_size][input_count]:
+    real_t *input_rows;
+
+    // Fixed at init, as the optimizer state is sized for it:
+    mlp_loss_t loss;
+    mlp_optimizer_t optimizer;
+
+    // Loss summed over the last batch passed to mlp_network_gradients:
+    double batch_loss;
+
+    // Training instrumentation (see profile.h), on when MLP_PROFILE is set in the environment, or NULL:
+    mlp_profile_t *profile;
+
+    void *arena;
+    size_t arena_size;
+} mlp_network_t;
+
+// A network of layer_count weight layers, taking sizes[0] inputs to sizes[layer_count] outputs, where layer l maps
+// sizes[l] to sizes[l + 1] values and activates them with activations[l] (which needs a vector kernel, so not
+// ACTIVATION_CUSTOM; the output layer should be ACTIVATION_LINEAR with MLP_LOSS_SOFTMAX_CROSS_ENTROPY).
+// Weights start as MLP_INIT_HE for ReLU layers and MLP_INIT_XAVIER for the rest, so activations keep their scale
+// through deep stacks, drawn in parallel on pool (which may be NULL).
+// Returns NULL after printing why if the shape is invalid.
+mlp_network_t *init_mlp_network(int layer_count, const int sizes[], const activation_type_t activations[],
+    mlp_loss_t loss, const mlp_optimizer_t *optimizer, int max_batch_size, int epoch_count, thread_pool_t *pool);
+void destroy_mlp_network(mlp_network_t *network);
+
+// Forward and backward passes over rows [first_row, first_row + batch_size) (at most max_batch_size, or it aborts),
+// leaving the batch's summed gradients in network->gradients; and a step of the weights along them with the network's
+// optimizer:
+void mlp_network_gradients(mlp_network_t *network, int batch_size, const mlp_inputs_t *inputs, const mlp_labels_t *labels, long first_row);
+void mlp_network_apply_gradients(mlp_network_t *network, const double learning_rate);
+
+// Mini-batch training over the first feature_count rows, max_batch_size rows at a time, for every epoch:
+void train_mlp_network(mlp_network_t *network, int feature_count, const mlp_inputs_t *training_features,
+    const mlp_labels_t *training_labels, const double learning_rate);
+
+// Batched inference through the network's own arena, as with mlp_predict_batch (outputs and labels are optional).
+// Not re-entrant: each network runs one call at a time.
+void mlp_network_predict(mlp_network_t *network, int count, const mlp_inputs_t *inputs, real_t *outputs, int *labels);
+
+// ////////////////////////////////////  //
+//              Model Files              //
+//  ///////////////////////////////////  //
+
+// A versioned model file, laid out so it can be mmap'd and used in place:
+//   [0, MLP_MODEL_PAGE_SIZE)   mlp_model_header_t, zero padded out to the page
+//   each layer's section       at a page aligned offset, holding the layer exactly as it is laid out in memory:
+//                              output_count rows of stride values (zero padded), then the biases, zero padded
+//                              out to a whole MLP_ALIGNMENT block.
+// Values are in the precision of the build that saved it (element_size), and every field is in the byte order of the
+// machine that wrote it (byte_order reads back as MLP_MODEL_BYTE_ORDER on a machine of the same order).
+// Checksums are FNV-1a over 64-bit words (see model_checksum in mlp.c).
+#define MLP_MODEL_MAGIC "MLPMODEL"
+#define MLP_MODEL_VERSION 1
+#define MLP_MODEL_BYTE_ORDER 0x01020304u
+#define MLP_MODEL_PAGE_SIZE 4096
+#define MLP_MODEL_MAX_LAYERS 16
+
+typedef struct mlp_model_layer_t {
+    uint32_t input_count;
+    uint32_t output_count;
+    uint32_t stride;
+    // activation_type_t:
+    uint32_t activation;
+    // Byte offset of the section from the start of the file, and its size:
+    uint64_t offset;
+    uint64_t size;
+} mlp_model_layer_t;
+
+typedef struct mlp_model_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    // sizeof(float) or sizeof(double):
+    uint32_t element_size;
+    // mlp_loss_t:
+    uint32_t loss;
+    uint32_t layer_count;
+    uint32_t reserved;
+    uint64_t file_size;
+    // Of every byte after the header page:
+    uint64_t payload_checksum;
+    mlp_model_layer_t layers[MLP_MODEL_MAX_LAYERS];
+    // Of the header up to this field:
+    uint64_t header_checksum;
+} mlp_model_header_t;
+
+// Write the network as a model file. It is written alongside and renamed over filename, so a process mapping the
+// model never sees a partial file (and one that already has it mapped keeps the old version).
+// Returns 0, or -1 after printing why. Layers with custom activation functions can't be saved.
+int save_mlp_model(const multilayer_perceptron_t *mlp, const char *filename);
+
+// Map a model file for inference. When it was saved in this build's precision, the layers point straight into the
+// shared, read-only mapping: nothing is read or copied up front, pages are faulted in as inference touches them, and
+// every process serving the same file shares the same physical pages. A file of the other precision is converted
+// into allocated layers instead. verify checks the payload checksum, which reads every page once.
+// The result is for inference only (training would write to the read-only mapping). Returns NULL after printing why
+// if the file can't be opened or fails validation; destroy_mlp unmaps it.
+multilayer_perceptron_t *map_mlp_model(const char *filename, int verify);
 
 #endif
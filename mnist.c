@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mnist.h"
+
+static mnist_split_t train_set;
+static mnist_split_t test_set;
+
+static void open_split(mnist_split_t *split, const char *image_file, const char *label_file) {
+
+    split->images = open_idx(image_file);
+    split->labels = open_idx(label_file);
+    if (!split->images || !split->labels) {
+        exit(-1);
+    }
+
+    // Images are count x rows x columns bytes, labels count bytes:
+    if (split->images->type != IDX_UBYTE || split->images->dimension_count != 3 ||
+        split->labels->type != IDX_UBYTE || split->labels->dimension_count != 1) {
+        fprintf(stderr, "%s, %s: Unexpected MNIST layout\n", image_file, label_file);
+        exit(-1);
+    }
+    if (split->images->count != split->labels->count) {
+        fprintf(stderr, "%s, %s: %d images but %d labels\n", image_file, label_file, split->images->count, split->labels->count);
+        exit(-1);
+    }
+
+    split->count = split->images->count;
+    split->feature_count = split->images->row_size;
+    split->pixels = (const unsigned char *)split->images->data;
+    split->label_values = (const unsigned char *)split->labels->data;
+
+    // The labels index the network's outputs directly (see mlp_class_labels), so a bad byte must not get that far:
+    for (int i = 0; i < split->count; i++) {
+        if (split->label_values[i] >= MNIST_CLASS_COUNT) {
+            fprintf(stderr, "%s: Label %d of image %d is not a digit\n", label_file, split->label_values[i], i);
+            exit(-1);
+        }
+    }
+}
+
+const mnist_split_t *mnist_train_set(void) {
+    if (!train_set.images) {
+        open_split(&train_set, TRAIN_IMAGE, TRAIN_LABEL);
+    }
+    return &train_set;
+}
+
+const mnist_split_t *mnist_test_set(void) {
+    if (!test_set.images) {
+        open_split(&test_set, TEST_IMAGE, TEST_LABEL);
+    }
+    return &test_set;
+}
@@ -0,0 +1,185 @@
+// sched_getaffinity and the CPU_* macros:
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "numa.h"
+
+// Pages asked about per move_pages call:
+#define PLACEMENT_CHUNK 1024
+
+// ////////////////////////////////////  //
+//               Topology                //
+//  ///////////////////////////////////  //
+
+// Parse a sysfs list such as "0-3,8-11" into set. Returns 0 if the file can't be read:
+static int read_id_list(const char *path, cpu_set_t *set) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    char text[4096];
+    const int found = fgets(text, sizeof(text), file) != NULL;
+    fclose(file);
+    if (!found) {
+        return 0;
+    }
+
+    CPU_ZERO(set);
+    char *cursor = text;
+    while (*cursor && *cursor != '\n') {
+        char *end;
+        const long first = strtol(cursor, &end, 10);
+        if (end == cursor) {
+            break;
+        }
+        long last = first;
+        cursor = end;
+        if (*cursor == '-') {
+            last = strtol(cursor + 1, &end, 10);
+            cursor = end;
+        }
+        for (long id = first; id <= last && id < CPU_SETSIZE; id++) {
+            CPU_SET((int)id, set);
+        }
+        if (*cursor == ',') {
+            cursor++;
+        }
+    }
+    return 1;
+}
+
+// Append node (kernel id node_id) with the CPUs of cpus that are set, if there are any:
+static void add_node(numa_topology_t *topology, int node_id, const cpu_set_t *cpus) {
+    const int count = CPU_COUNT(cpus);
+    if (count == 0) {
+        return;
+    }
+    const int n = topology->node_count++;
+    topology->node_ids[n] = node_id;
+    topology->cpu_counts[n] = count;
+    topology->cpus[n] = malloc(sizeof(int) * count);
+    for (int cpu = 0, i = 0; cpu < CPU_SETSIZE && i < count; cpu++) {
+        if (CPU_ISSET(cpu, cpus)) {
+            topology->cpus[n][i++] = cpu;
+        }
+    }
+}
+
+numa_topology_t *init_numa_topology(void) {
+
+    // Init and zeroise:
+    numa_topology_t *topology = (numa_topology_t *)malloc(sizeof(*topology));
+    memset(topology, 0, sizeof(*topology));
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        CPU_ZERO(&allowed);
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int cpu = 0; cpu < (cores > 0 ? cores : 1) && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+
+    cpu_set_t nodes;
+    const int node_slots = read_id_list("/sys/devices/system/node/online", &nodes) ? CPU_COUNT(&nodes) : 0;
+    topology->node_ids = malloc(sizeof(int) * (node_slots ? node_slots : 1));
+    topology->cpu_counts = malloc(sizeof(int) * (node_slots ? node_slots : 1));
+    topology->cpus = malloc(sizeof(int *) * (node_slots ? node_slots : 1));
+
+    for (int node = 0; node < CPU_SETSIZE && topology->node_count < node_slots; node++) {
+        if (!CPU_ISSET(node, &nodes)) {
+            continue;
+        }
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        cpu_set_t cpus;
+        if (read_id_list(path, &cpus)) {
+            CPU_AND(&cpus, &cpus, &allowed);
+            add_node(topology, node, &cpus);
+        }
+    }
+
+    // No sysfs (or no node with a CPU we can use), so it's all one node:
+    if (topology->node_count == 0) {
+        add_node(topology, 0, &allowed);
+    }
+
+    return topology;
+}
+
+void destroy_numa_topology(numa_topology_t *topology) {
+    for (int n = 0; n < topology->node_count; n++) {
+        free(topology->cpus[n]);
+    }
+    free(topology->node_ids);
+    free(topology->cpu_counts);
+    free(topology->cpus);
+    free(topology);
+}
+
+int numa_worker_node(const numa_topology_t *topology, int worker, int worker_count) {
+    return (int)((long)worker * topology->node_count / worker_count);
+}
+
+int numa_worker_cpu(const numa_topology_t *topology, int worker, int worker_count) {
+    const int node = numa_worker_node(topology, worker, worker_count);
+    // The first worker of this node's block:
+    int first = worker;
+    while (first > 0 && numa_worker_node(topology, first - 1, worker_count) == node) {
+        first--;
+    }
+    return topology->cpus[node][(worker - first) % topology->cpu_counts[node]];
+}
+
+// ////////////////////////////////////  //
+//            Page Placement             //
+//  ///////////////////////////////////  //
+
+int numa_page_placement(const numa_topology_t *topology, const void *address, size_t size, int node,
+    long *resident_pages, long *local_pages) {
+
+    *resident_pages = 0;
+    *local_pages = 0;
+#if defined(__linux__) && defined(SYS_move_pages)
+    const long page_size = sysconf(_SC_PAGESIZE);
+    const uintptr_t first = (uintptr_t)address & ~(uintptr_t)(page_size - 1);
+    const uintptr_t last = (uintptr_t)address + size;
+
+    // With no target nodes, move_pages moves nothing and just reports the node each page is on (or a negative errno,
+    // such as -ENOENT for a page that was never touched):
+    void *pages[PLACEMENT_CHUNK];
+    int status[PLACEMENT_CHUNK];
+    for (uintptr_t page = first; page < last;) {
+        int count = 0;
+        for (; count < PLACEMENT_CHUNK && page < last; count++, page += page_size) {
+            pages[count] = (void *)page;
+        }
+        if (syscall(SYS_move_pages, 0, (unsigned long)count, pages, NULL, status, 0) != 0) {
+            return 0;
+        }
+        for (int p = 0; p < count; p++) {
+            if (status[p] >= 0) {
+                (*resident_pages)++;
+                *local_pages += status[p] == topology->node_ids[node];
+            }
+        }
+    }
+    return 1;
+#else
+    (void)topology;
+    (void)address;
+    (void)size;
+    (void)node;
+    return 0;
+#endif
+}
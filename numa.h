@@ -0,0 +1,37 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+
+// NUMA topology and page placement, read straight from sysfs and the kernel's memory policy syscalls, so nothing
+// extra (libnuma) is needed to build or run. On a single-node machine, or anywhere the information isn't available,
+// everything looks like one node holding every CPU the process may run on.
+//
+// Nothing here moves memory: placement follows the kernel's default first-touch policy, where a page lands on the
+// node of the thread that first writes it. Node-local data is made by having a thread pinned to the node allocate
+// and fill it (see MLP_NUMA in threadpool.h).
+
+typedef struct numa_topology_t {
+    // Nodes with at least one CPU this process may run on (memory-only nodes are left out):
+    int node_count;
+    // The kernel's id for each node (ids may have gaps), and its usable CPUs in ascending order:
+    int *node_ids;
+    int *cpu_counts;
+    int **cpus;
+} numa_topology_t;
+
+numa_topology_t *init_numa_topology(void);
+void destroy_numa_topology(numa_topology_t *topology);
+
+// Which node (an index into the topology, not a kernel id) worker of worker_count goes on: workers are spread over the
+// nodes in contiguous blocks, so neighbouring workers (which get neighbouring slices of the work) share a node:
+int numa_worker_node(const numa_topology_t *topology, int worker, int worker_count);
+// And which CPU of that node it is pinned to (its place within the node's block, wrapping around the node's CPUs):
+int numa_worker_cpu(const numa_topology_t *topology, int worker, int worker_count);
+
+// Count the pages of [address, address + size) that are resident, and how many of those are on node (an index into
+// the topology). Returns 0 with nothing counted where the kernel can't say (no move_pages, or not Linux).
+int numa_page_placement(const numa_topology_t *topology, const void *address, size_t size, int node,
+    long *resident_pages, long *local_pages);
+
+#endif
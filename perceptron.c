@@ -1,4 +1,5 @@
 #include "perceptron.h"
+#include "kernels.h"
 
 // ////////////////////////////////////  //
 //            Create/Destroy             //
@@ -11,14 +12,14 @@ perceptron_t *init_perceptron(const int input_count, double (*activation_functio
     memset(p, 0, sizeof(*p));
 
     // Allocate the weights array
-    // Randomly set the starting weights on a value between -1 and 1
-    p->weights = malloc(sizeof(double) * input_count);
-    for (int i = 0; i < input_count; i++) {
-        p->weights[i] = (rand() / (double)RAND_MAX * 2 - 1) * 0.01;
-    }
+    // Randomly set the starting weights on a value between -1 and 1 (scaled down), from a fresh stream of the process seed:
+    mlp_random_lanes_t lanes;
+    mlp_random_lanes(&lanes, mlp_random_seed(), mlp_random_take_stream());
+    p->weights = malloc(sizeof(real_t) * input_count);
+    vector_random_uniform(&lanes, p->weights, input_count, -0.01, 0.01);
 
-    // Assign the Biases weight between -1 and 1:
-    p->bias_weight = (rand() / (double)RAND_MAX * 2 - 1) * 0.01;
+    // Assign the Biases weight the same way:
+    vector_random_uniform(&lanes, &p->bias_weight, 1, -0.01, 0.01);
 
     p->input_count = input_count;
     p->activation_function = activation_function;
@@ -72,7 +73,9 @@ double relu_activation(double x) {
 }
 
 double derivative_relu_activation(double x) {
-    return x >= 0 ? 1 : 0;
+    // x is the activated output, which is never negative, so x >= 0 would pass every unit's gradient back. A unit
+    // clamped to 0 has a slope of 0, and passes nothing:
+    return x > 0 ? 1 : 0;
 }
 
 // Sigmoid
@@ -85,11 +88,57 @@ double derivative_sigmoid_activation(double x) {
     return x * (1.0 - x);
 }
 
+activation_type_t activation_type(double (*activation_function)(double), double (*derivative_activation_function)(double)) {
+    if (activation_function == linear_activation && derivative_activation_function == derivative_linear_activation) {
+        return ACTIVATION_LINEAR;
+    }
+    if (activation_function == relu_activation && derivative_activation_function == derivative_relu_activation) {
+        return ACTIVATION_RELU;
+    }
+    if (activation_function == sigmoid_activation && derivative_activation_function == derivative_sigmoid_activation) {
+        return ACTIVATION_SIGMOID;
+    }
+    if (activation_function == step_activation_function && !derivative_activation_function) {
+        return ACTIVATION_STEP;
+    }
+    if (activation_function == sign_activation_function && !derivative_activation_function) {
+        return ACTIVATION_SIGN;
+    }
+    return ACTIVATION_CUSTOM;
+}
+
+int activation_functions(activation_type_t type, double (**activation_function)(double), double (**derivative_activation_function)(double)) {
+    switch (type) {
+    case ACTIVATION_LINEAR:
+        *activation_function = linear_activation;
+        *derivative_activation_function = derivative_linear_activation;
+        return 1;
+    case ACTIVATION_RELU:
+        *activation_function = relu_activation;
+        *derivative_activation_function = derivative_relu_activation;
+        return 1;
+    case ACTIVATION_SIGMOID:
+        *activation_function = sigmoid_activation;
+        *derivative_activation_function = derivative_sigmoid_activation;
+        return 1;
+    case ACTIVATION_STEP:
+        *activation_function = step_activation_function;
+        *derivative_activation_function = NULL;
+        return 1;
+    case ACTIVATION_SIGN:
+        *activation_function = sign_activation_function;
+        *derivative_activation_function = NULL;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
 // ////////////////////////////////////  //
 //               Predict                 //
 //  ///////////////////////////////////  //
 
-double perceptron_feedforward(perceptron_t *p, const double training_features[]) {
+double perceptron_feedforward(perceptron_t *p, const real_t training_features[]) {
 
     // Perform a weighted sum of all training features, and run it through the activation function to produce a final prediction output.
 
@@ -116,10 +165,7 @@ double perceptron_feedforward(perceptron_t *p, const double training_features[])
     // Feature space (Adding the bias as an additional term to make x.w + b): This shifts the intercept of the hyperplane so that it has a degree of freedom. A hyperplane free
     // from the constraint of requiring origin intersection, can now separate (1) and (3).
 
-    double weighted_sum = p->bias_weight;
-    for (int i = 0; i < p->input_count; i++) {
-        weighted_sum += training_features[i] * p->weights[i];
-    }
+    real_t weighted_sum = p->bias_weight + vector_dot(training_features, p->weights, p->input_count);
     return p->activation_function(weighted_sum);
 }
 
@@ -127,7 +173,7 @@ double perceptron_feedforward(perceptron_t *p, const double training_features[])
 //            Training Loop              //
 //  ///////////////////////////////////  //
 
-void train_perceptron(perceptron_t *p, int row_count, int column_count, const double training_features[row_count][column_count], const double training_labels[row_count], const double learning_rate) {
+void train_perceptron(perceptron_t *p, int row_count, int column_count, const real_t training_features[row_count][column_count], const real_t training_labels[row_count], const double learning_rate) {
 
     // Exit if trying to train based on more features than expected:
     if (p->input_count != column_count) {
@@ -146,7 +192,7 @@ void train_perceptron(perceptron_t *p, int row_count, int column_count, const do
             // new_weight = current_weight + (error)(input)(learning_rate)
 
             // Create a prediction for this particular vector of features:
-            double prediction = perceptron_feedforward(p, training_features[i]);
+            real_t prediction = perceptron_feedforward(p, training_features[i]);
 
             // First calculate the error difference (Difference in expected/predicted values).
             // If the error_difference == 0, then the weights are effectively not adjusted as the prediction was correct (there's nothing to do!)
@@ -156,7 +202,7 @@ void train_perceptron(perceptron_t *p, int row_count, int column_count, const do
             //  1           -1      -2 (incorrect, was a false positive)
             // -1            1       2 (incorrect. was a false negative)
             // -1           -1       0 (correct response)
-            double error_difference = training_labels[i] - prediction;
+            real_t error_difference = training_labels[i] - prediction;
 
             // Given the error_difference, calculate:
             // new_weight = current_weight + (error)(input)(learning_rate)
@@ -178,9 +224,7 @@ void train_perceptron(perceptron_t *p, int row_count, int column_count, const do
             
             // First address the bias (same formula, with training feature implicit as 1), then nudge the rest of the weight vector entries:
             p->bias_weight += learning_rate * error_difference;
-            for (int j = 0; j < p->input_count; j++) {
-                p->weights[j] += learning_rate * error_difference * training_features[i][j];
-            }
+            vector_axpy(learning_rate * error_difference, training_features[i], p->weights, p->input_count);
         }
     }
 
@@ -7,12 +7,15 @@
 #include <time.h>
 #include <math.h>
 
+#include "real.h"
+#include "kernels.h"
+
 // Struct init and destruction:
 typedef struct perceptron_t {
     int training_epoch_count;
     int input_count;
-    double *weights;
-    double bias_weight;
+    real_t *weights;
+    real_t bias_weight;
     double (*activation_function)(double);
     double (*derivative_activation_function)(double);
 } perceptron_t;
@@ -32,10 +35,16 @@ double derivative_relu_activation(double x);
 double sigmoid_activation(double x);
 double derivative_sigmoid_activation(double x);
 
+// The vector kernel equivalent of an activation function and its derivative (which must be the matching one above,
+// or NULL for sign and step), or ACTIVATION_CUSTOM for any other pair:
+activation_type_t activation_type(double (*activation_function)(double), double (*derivative_activation_function)(double));
+// And back: the function pair behind a vector activation type. Returns 0 for ACTIVATION_CUSTOM (or an unknown type):
+int activation_functions(activation_type_t type, double (**activation_function)(double), double (**derivative_activation_function)(double));
+
 // For use in single node networks (singleton perceptron):
 // Activate the perceptron, and return the result:
-double perceptron_feedforward(perceptron_t *p, const double training_features[]);
+double perceptron_feedforward(perceptron_t *p, const real_t training_features[]);
 // Used for single node networks:
-void train_perceptron(perceptron_t *p, int row_count, int column_count, const double training_features[row_count][column_count], const double training_labels[row_count], const double learning_rate);
+void train_perceptron(perceptron_t *p, int row_count, int column_count, const real_t training_features[row_count][column_count], const real_t training_labels[row_count], const double learning_rate);
 
 #endif
\ No newline at end of file
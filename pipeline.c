@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "kernels.h"
+#include "simd.h"
+
+// Rows ahead of the current one to prefetch while gathering:
+#define PIPELINE_PREFETCH_DISTANCE 4
+
+// Spins before a waiting side starts yielding its core, yields before it starts sleeping, and the length of each sleep:
+#define PIPELINE_SPIN_LIMIT 256
+#define PIPELINE_YIELD_LIMIT (PIPELINE_SPIN_LIMIT + 16)
+#define PIPELINE_SLEEP_NS 20000
+
+// ////////////////////////////////////  //
+//              Helpers                  //
+//  ///////////////////////////////////  //
+
+// Fisher-Yates shuffle of the row order, with the producer thread's private generator:
+static void shuffle(int *order, int count, mlp_random_t *random) {
+    for (int i = count - 1; i > 0; i--) {
+        const int j = (int)mlp_random_below(random, (uint64_t)(i + 1));
+        const int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+}
+
+// Wait for the other side of the ring to move: spin first, since a batch is normally only microseconds away,
+// then yield, and finally back off to short sleeps so a waiting side never competes for a core with the one it is waiting on:
+static void ring_wait(int *spins) {
+    ++*spins;
+    if (*spins < PIPELINE_SPIN_LIMIT) {
+#ifdef SIMD_X86
+        _mm_pause();
+#endif
+    } else if (*spins < PIPELINE_YIELD_LIMIT) {
+        sched_yield();
+    } else {
+        const struct timespec pause = {0, PIPELINE_SLEEP_NS};
+        nanosleep(&pause, NULL);
+    }
+}
+
+static void *alloc_slot_buffer(size_t count) {
+    const size_t size = (sizeof(real_t) * count + MLP_ALIGNMENT - 1) / MLP_ALIGNMENT * MLP_ALIGNMENT;
+    return aligned_alloc(MLP_ALIGNMENT, size ? size : MLP_ALIGNMENT);
+}
+
+// ////////////////////////////////////  //
+//              Producer                 //
+//  ///////////////////////////////////  //
+
+// Copy rows order[start, start + count) into a batch:
+static void gather_batch(mlp_pipeline_t *pipeline, mlp_pipeline_batch_t *batch, int start, int count) {
+    const mlp_inputs_t *inputs = &pipeline->inputs;
+    const int dimension = inputs->dimension;
+
+    for (int b = 0; b < count; b++) {
+        const int row = pipeline->order[start + b];
+
+        // The gather is random access, so get the next few rows on their way before they are needed:
+        if (b + PIPELINE_PREFETCH_DISTANCE < count) {
+            const int ahead = pipeline->order[start + b + PIPELINE_PREFETCH_DISTANCE];
+            if (inputs->bytes) {
+                __builtin_prefetch(inputs->bytes + (size_t)ahead * inputs->stride);
+            } else {
+                __builtin_prefetch(inputs->features + (size_t)ahead * inputs->stride);
+            }
+        }
+
+        real_t *features = batch->features + (size_t)b * dimension;
+        if (inputs->bytes) {
+            vector_widen_u8(inputs->byte_scale, inputs->bytes + (size_t)row * inputs->stride, features, dimension);
+        } else {
+            memcpy(features, inputs->features + (size_t)row * inputs->stride, sizeof(real_t) * dimension);
+        }
+        const mlp_labels_t *labels = &pipeline->labels;
+        if (labels->classes) {
+            batch->label_classes[b] = labels->classes[row];
+        } else {
+            memcpy(batch->label_values + (size_t)b * labels->dimension, labels->values + (size_t)row * labels->stride,
+                sizeof(real_t) * labels->dimension);
+        }
+    }
+    batch->count = count;
+}
+
+static void *producer_main(void *arg) {
+    mlp_pipeline_t *pipeline = (mlp_pipeline_t *)arg;
+    unsigned long head = 0;
+
+    for (int epoch = 0; epoch < pipeline->epoch_count; epoch++) {
+        shuffle(pipeline->order, pipeline->feature_count, &pipeline->random);
+
+        for (int i = 0; i < pipeline->feature_count; i += pipeline->batch_size) {
+            const int count = (pipeline->feature_count - i < pipeline->batch_size) ? pipeline->feature_count - i : pipeline->batch_size;
+
+            // Wait for a free slot:
+            int spins = 0;
+            while (head - atomic_load_explicit(&pipeline->tail, memory_order_acquire) == PIPELINE_SLOTS) {
+                if (atomic_load_explicit(&pipeline->stop, memory_order_relaxed)) {
+                    return NULL;
+                }
+                ring_wait(&spins);
+            }
+
+            mlp_pipeline_batch_t *batch = &pipeline->slots[head % PIPELINE_SLOTS];
+            gather_batch(pipeline, batch, i, count);
+            batch->epoch = epoch;
+
+            // Publish it; the release pairs with the consumer's acquire so the batch contents are visible first:
+            atomic_store_explicit(&pipeline->head, ++head, memory_order_release);
+        }
+    }
+
+    return NULL;
+}
+
+// ////////////////////////////////////  //
+//            Create/Destroy             //
+//  ///////////////////////////////////  //
+
+mlp_pipeline_t *init_mlp_pipeline(int feature_count, const mlp_inputs_t *features, const mlp_labels_t *labels,
+    int batch_size, int epoch_count, uint64_t seed) {
+
+    // Init and zeroise:
+    mlp_pipeline_t *pipeline = (mlp_pipeline_t *)aligned_alloc(64, sizeof(mlp_pipeline_t));
+    memset(pipeline, 0, sizeof(*pipeline));
+
+    pipeline->inputs = *features;
+    pipeline->feature_count = feature_count;
+    pipeline->labels = *labels;
+    pipeline->batch_size = batch_size < 1 ? 1 : batch_size;
+    pipeline->epoch_count = epoch_count;
+    pipeline->total_batches = (unsigned long)epoch_count * ((feature_count + pipeline->batch_size - 1) / pipeline->batch_size);
+
+    pipeline->random = mlp_random_stream(seed, 0);
+    pipeline->order = malloc(sizeof(int) * (feature_count > 0 ? feature_count : 1));
+    for (int i = 0; i < feature_count; i++) {
+        pipeline->order[i] = i;
+    }
+
+    for (int s = 0; s < PIPELINE_SLOTS; s++) {
+        mlp_pipeline_batch_t *slot = &pipeline->slots[s];
+        slot->features = alloc_slot_buffer((size_t)pipeline->batch_size * features->dimension);
+        if (labels->classes) {
+            slot->label_classes = malloc(pipeline->batch_size);
+            slot->labels = mlp_class_labels(slot->label_classes, labels->dimension);
+        } else {
+            slot->label_values = alloc_slot_buffer((size_t)pipeline->batch_size * labels->dimension);
+            slot->labels = mlp_real_labels(slot->label_values, labels->dimension, labels->dimension);
+        }
+    }
+
+    atomic_init(&pipeline->head, 0);
+    atomic_init(&pipeline->tail, 0);
+    atomic_init(&pipeline->stop, 0);
+    pthread_create(&pipeline->thread, NULL, producer_main, pipeline);
+
+    return pipeline;
+}
+
+void destroy_mlp_pipeline(mlp_pipeline_t *pipeline) {
+    atomic_store(&pipeline->stop, 1);
+    pthread_join(pipeline->thread, NULL);
+
+    for (int s = 0; s < PIPELINE_SLOTS; s++) {
+        free(pipeline->slots[s].features);
+        free(pipeline->slots[s].label_values);
+        free(pipeline->slots[s].label_classes);
+    }
+    free(pipeline->order);
+    free(pipeline);
+}
+
+// ////////////////////////////////////  //
+//              Consumer                 //
+//  ///////////////////////////////////  //
+
+const mlp_pipeline_batch_t *mlp_pipeline_next(mlp_pipeline_t *pipeline) {
+    const unsigned long tail = atomic_load_explicit(&pipeline->tail, memory_order_relaxed);
+    if (tail == pipeline->total_batches) {
+        return NULL;
+    }
+
+    int spins = 0;
+    while (atomic_load_explicit(&pipeline->head, memory_order_acquire) == tail) {
+        ring_wait(&spins);
+    }
+    return &pipeline->slots[tail % PIPELINE_SLOTS];
+}
+
+void mlp_pipeline_release(mlp_pipeline_t *pipeline) {
+    const unsigned long tail = atomic_load_explicit(&pipeline->tail, memory_order_relaxed);
+    atomic_store_explicit(&pipeline->tail, tail + 1, memory_order_release);
+}
@@ -0,0 +1,68 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "mlp.h"
+
+// Background data pipeline for training.
+//
+// A producer thread draws a fresh random permutation of the training rows every epoch, gathers the shuffled rows
+// (and their labels) into contiguous, aligned batches, widening byte inputs to real_t on the way, and publishes
+// them through a single-producer/single-consumer ring. The trainer only ever sees ready, sequential batches,
+// so the random gathers (and their cache misses) overlap with compute instead of stalling it.
+
+// Batches in flight: one being trained on, one being filled, and slack to absorb jitter on either side:
+#define PIPELINE_SLOTS 4
+
+typedef struct mlp_pipeline_batch_t {
+    int count;
+    int epoch;
+    // [count][dimension] features, in shuffled order:
+    real_t *features;
+    // Their labels, in the same order and form as the source labels:
+    mlp_labels_t labels;
+    // The storage behind labels: [count][dimension] values, or count class indices:
+    real_t *label_values;
+    unsigned char *label_classes;
+} mlp_pipeline_batch_t;
+
+typedef struct mlp_pipeline_t {
+    mlp_inputs_t inputs;
+    int feature_count;
+    mlp_labels_t labels;
+    int batch_size;
+    int epoch_count;
+
+    // Permutation of [0, feature_count), reshuffled each epoch, and the generator behind it:
+    int *order;
+    mlp_random_t random;
+
+    mlp_pipeline_batch_t slots[PIPELINE_SLOTS];
+
+    // Batches published by the producer, and released by the consumer. Slot n % PIPELINE_SLOTS holds batch n;
+    // head - tail is the number of full slots. Each counter has a single writer, so no locks are needed:
+    _Alignas(64) atomic_ulong head;
+    _Alignas(64) atomic_ulong tail;
+    unsigned long total_batches;
+
+    atomic_int stop;
+    pthread_t thread;
+} mlp_pipeline_t;
+
+// Start producing epoch_count epochs of batch_size-row batches (the last batch of each epoch may be short).
+// The same seed gives the same sequence of batches.
+mlp_pipeline_t *init_mlp_pipeline(int feature_count, const mlp_inputs_t *features, const mlp_labels_t *labels,
+    int batch_size, int epoch_count, uint64_t seed);
+
+// Stops the producer (even mid-run) and frees the pipeline:
+void destroy_mlp_pipeline(mlp_pipeline_t *pipeline);
+
+// The next batch, waiting for it if necessary, or NULL once every epoch has been delivered.
+// The batch stays valid until mlp_pipeline_release(), which hands its slot back to the producer.
+const mlp_pipeline_batch_t *mlp_pipeline_next(mlp_pipeline_t *pipeline);
+void mlp_pipeline_release(mlp_pipeline_t *pipeline);
+
+#endif
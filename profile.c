@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "profile.h"
+
+static const char *phase_names[MLP_PHASE_COUNT] = {"fetch", "forward", "backward", "update"};
+
+// ////////////////////////////////////  //
+//           Hardware Counters           //
+//  ///////////////////////////////////  //
+
+// Open a user-space hardware counter for this process and every thread it starts from now on, or return -1
+// (no perf support, perf_event_paranoid too strict, or running in a container that blocks the syscall):
+static int open_counter(unsigned int type, unsigned long long config) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // The kernel multiplexes counters when it runs out of hardware ones, so ask for the times needed to scale back up:
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)type;
+    (void)config;
+    return -1;
+#endif
+}
+
+// A counter's value (estimated, if it was multiplexed), or -1 if it isn't available:
+static double read_counter(int fd) {
+    unsigned long long values[3];
+    if (fd < 0 || read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+        return -1;
+    }
+    return (double)values[0] * ((double)values[1] / values[2]);
+}
+
+static void read_counters(const mlp_profile_t *profile, double counters[PROFILE_COUNTERS]) {
+    for (int c = 0; c < PROFILE_COUNTERS; c++) {
+        counters[c] = read_counter(profile->counter_fds[c]);
+    }
+}
+
+// ////////////////////////////////////  //
+//           SIGUSR1 Snapshots           //
+//  ///////////////////////////////////  //
+
+// Printing isn't async-signal-safe, so the handler only raises a flag for the training thread to notice:
+static volatile sig_atomic_t snapshot_requested = 0;
+static struct sigaction previous_action;
+
+static void snapshot_handler(int signal_number) {
+    (void)signal_number;
+    snapshot_requested = 1;
+}
+
+// ////////////////////////////////////  //
+//         Struct Init & Destroy         //
+//  ///////////////////////////////////  //
+
+mlp_profile_t *init_mlp_profile(FILE *log) {
+
+    // Init and zeroise:
+    mlp_profile_t *profile = (mlp_profile_t *)malloc(sizeof(*profile));
+    memset(profile, 0, sizeof(*profile));
+    profile->log = log ? log : stderr;
+
+#ifdef __linux__
+    // Cache events are configured as cache | operation << 8 | result << 16:
+    const unsigned long long node_read = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8);
+    const unsigned int types[PROFILE_COUNTERS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE
+    };
+    const unsigned long long configs[PROFILE_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES,
+        node_read | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16), node_read | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    };
+    for (int c = 0; c < PROFILE_COUNTERS; c++) {
+        profile->counter_fds[c] = open_counter(types[c], configs[c]);
+    }
+#else
+    for (int c = 0; c < PROFILE_COUNTERS; c++) {
+        profile->counter_fds[c] = -1;
+    }
+#endif
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = snapshot_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, &previous_action);
+
+    return profile;
+}
+
+void destroy_mlp_profile(mlp_profile_t *profile) {
+    if (!profile) {
+        return;
+    }
+    sigaction(SIGUSR1, &previous_action, NULL);
+    for (int c = 0; c < PROFILE_COUNTERS; c++) {
+        if (profile->counter_fds[c] >= 0) {
+            close(profile->counter_fds[c]);
+        }
+    }
+    free(profile);
+}
+
+// ////////////////////////////////////  //
+//               Reporting               //
+//  ///////////////////////////////////  //
+
+// One line for an interval of training: its samples, mean loss and throughput, where the time went,
+// and the counters' progress over it (counters holds their readings at the start of the interval):
+static void print_interval(const mlp_profile_t *profile, FILE *file, const char *label, long samples, double loss,
+    double elapsed, const double phase_seconds[MLP_PHASE_COUNT], const double counters[PROFILE_COUNTERS]) {
+
+    fprintf(file, "%s: loss %.6f, %ld samples in %.3fs (%.0f samples/sec) |", label,
+        samples ? loss / samples : 0.0, samples, elapsed, elapsed > 0 ? samples / elapsed : 0.0);
+
+    double phase_total = 0;
+    for (int p = 0; p < MLP_PHASE_COUNT; p++) {
+        phase_total += phase_seconds[p];
+    }
+    for (int p = 0; p < MLP_PHASE_COUNT; p++) {
+        fprintf(file, " %s %.3fs (%.1f%%)", phase_names[p], phase_seconds[p], phase_total > 0 ? 100 * phase_seconds[p] / phase_total : 0.0);
+    }
+
+    if (counters) {
+        double now[PROFILE_COUNTERS];
+        read_counters(profile, now);
+        const double cycles = now[PROFILE_CYCLES] - counters[PROFILE_CYCLES];
+        const double instructions = now[PROFILE_INSTRUCTIONS] - counters[PROFILE_INSTRUCTIONS];
+        const double references = now[PROFILE_CACHE_REFERENCES] - counters[PROFILE_CACHE_REFERENCES];
+        const double misses = now[PROFILE_CACHE_MISSES] - counters[PROFILE_CACHE_MISSES];
+        if (now[PROFILE_CYCLES] >= 0 && now[PROFILE_INSTRUCTIONS] >= 0 && cycles > 0) {
+            fprintf(file, " | IPC %.2f", instructions / cycles);
+        }
+        if (now[PROFILE_CACHE_REFERENCES] >= 0 && now[PROFILE_CACHE_MISSES] >= 0 && references > 0) {
+            fprintf(file, ", cache misses %.0f (%.1f%% of references)", misses, 100 * misses / references);
+        }
+        const double node_loads = now[PROFILE_NODE_LOADS] - counters[PROFILE_NODE_LOADS];
+        const double remote_loads = now[PROFILE_NODE_LOAD_MISSES] - counters[PROFILE_NODE_LOAD_MISSES];
+        if (now[PROFILE_NODE_LOADS] >= 0 && now[PROFILE_NODE_LOAD_MISSES] >= 0 && node_loads > 0) {
+            fprintf(file, ", remote NUMA loads %.1f%%", 100 * remote_loads / node_loads);
+        }
+    }
+    fprintf(file, "\n");
+}
+
+void mlp_profile_print(mlp_profile_t *profile, FILE *file) {
+    if (!profile) {
+        return;
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "Epoch %d (in progress)", profile->epoch + 1);
+    const double elapsed = profile->running ? profile_now() - profile->epoch_start : 0;
+    print_interval(profile, file, label, profile->epoch_samples, profile->epoch_loss, elapsed, profile->epoch_seconds,
+        profile->running ? profile->epoch_counters : NULL);
+
+    double total_seconds[MLP_PHASE_COUNT];
+    for (int p = 0; p < MLP_PHASE_COUNT; p++) {
+        total_seconds[p] = profile->total_seconds[p] + profile->epoch_seconds[p];
+    }
+    print_interval(profile, file, "Total", profile->total_samples + profile->epoch_samples, profile->total_loss + profile->epoch_loss,
+        profile->total_elapsed + elapsed, total_seconds, NULL);
+    fflush(file);
+}
+
+// ////////////////////////////////////  //
+//               Recording               //
+//  ///////////////////////////////////  //
+
+static void start_epoch(mlp_profile_t *profile) {
+    memset(profile->epoch_seconds, 0, sizeof(profile->epoch_seconds));
+    profile->epoch_samples = 0;
+    profile->epoch_loss = 0;
+    read_counters(profile, profile->epoch_counters);
+    profile->epoch_start = profile_now();
+    profile->mark = profile->epoch_start;
+}
+
+void mlp_profile_begin(mlp_profile_t *profile) {
+    if (!profile) {
+        return;
+    }
+    start_epoch(profile);
+    profile->running = 1;
+}
+
+void mlp_profile_end_epoch(mlp_profile_t *profile) {
+    if (!profile || !profile->running) {
+        return;
+    }
+
+    const double elapsed = profile_now() - profile->epoch_start;
+    char label[32];
+    snprintf(label, sizeof(label), "Epoch %d", profile->epoch + 1);
+    print_interval(profile, profile->log, label, profile->epoch_samples, profile->epoch_loss, elapsed,
+        profile->epoch_seconds, profile->epoch_counters);
+    fflush(profile->log);
+
+    for (int p = 0; p < MLP_PHASE_COUNT; p++) {
+        profile->total_seconds[p] += profile->epoch_seconds[p];
+    }
+    profile->total_samples += profile->epoch_samples;
+    profile->total_loss += profile->epoch_loss;
+    profile->total_elapsed += elapsed;
+    profile->epoch++;
+    start_epoch(profile);
+}
+
+void mlp_profile_end(mlp_profile_t *profile) {
+    if (!profile || !profile->running) {
+        return;
+    }
+    if (profile->epoch_samples) {
+        mlp_profile_end_epoch(profile);
+    }
+    profile->running = 0;
+}
+
+void mlp_profile_samples(mlp_profile_t *profile, long count, double loss) {
+    if (!profile || !profile->running) {
+        return;
+    }
+    profile->epoch_samples += count;
+    profile->epoch_loss += loss;
+
+    if (snapshot_requested) {
+        snapshot_requested = 0;
+        mlp_profile_print(profile, profile->log);
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <time.h>
+
+// Optional training instrumentation (see mlp_enable_profile in mlp.h, or set MLP_PROFILE=1).
+//
+// The trainers split their time into phases at every boundary they cross (one clock read each), and count samples
+// and loss as they go. At the end of every epoch a line goes to the log with the mean loss, samples/sec, the share
+// of time spent in each phase and, where perf_event_open is permitted, IPC, the cache miss rate and the share of memory
+// loads served by a remote NUMA node over the epoch.
+// Sending the process SIGUSR1 writes the same for the epoch in progress (plus the totals so far) at the next sample
+// or batch boundary, so a slow job can be inspected without attaching a profiler.
+//
+// With data-parallel training the forward and backward phases are those of the first shard's slice, and waiting
+// for the other threads counts as backward. Hogwild runs are not instrumented, as every thread updates at once
+// (train_mlp_hogwild reports its own throughput).
+
+typedef enum {
+    // Waiting for, gathering or widening input rows:
+    MLP_PHASE_FETCH,
+    MLP_PHASE_FORWARD,
+    // dL/dz and the weight gradients:
+    MLP_PHASE_BACKWARD,
+    // Applying the gradients (and reducing them across threads first, when data-parallel):
+    MLP_PHASE_UPDATE,
+    MLP_PHASE_COUNT
+} mlp_phase_t;
+
+// Hardware counters read through perf_event_open, for the whole process (including threads started later).
+// Node loads are the loads that went out to memory, and node load misses those served by another NUMA node:
+typedef enum {
+    PROFILE_CYCLES,
+    PROFILE_INSTRUCTIONS,
+    PROFILE_CACHE_REFERENCES,
+    PROFILE_CACHE_MISSES,
+    PROFILE_NODE_LOADS,
+    PROFILE_NODE_LOAD_MISSES,
+    PROFILE_COUNTERS
+} profile_counter_t;
+
+typedef struct mlp_profile_t {
+    FILE *log;
+
+    // Set between mlp_profile_begin and mlp_profile_end, so inference outside training is never charged:
+    int running;
+
+    // Time of the last phase boundary, and the seconds charged to each phase in the epoch in progress and overall:
+    double mark;
+    double epoch_seconds[MLP_PHASE_COUNT];
+    double total_seconds[MLP_PHASE_COUNT];
+
+    // The epoch in progress (counted across training runs), and the totals of every finished one:
+    int epoch;
+    double epoch_start;
+    long epoch_samples;
+    double epoch_loss;
+    long total_samples;
+    double total_loss;
+    double total_elapsed;
+
+    // perf_event_open descriptors (-1 where unavailable), and their readings when the epoch started:
+    int counter_fds[PROFILE_COUNTERS];
+    double epoch_counters[PROFILE_COUNTERS];
+} mlp_profile_t;
+
+// Installs the SIGUSR1 handler, which destroy_mlp_profile restores. Only one profile should be live at a time.
+mlp_profile_t *init_mlp_profile(FILE *log);
+void destroy_mlp_profile(mlp_profile_t *profile);
+
+static inline double profile_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Charge the time since the last boundary to phase.
+// A no-op without a profile (or outside a run), so the hot paths call it unconditionally:
+static inline void mlp_profile_phase(mlp_profile_t *profile, mlp_phase_t phase) {
+    if (profile && profile->running) {
+        const double now = profile_now();
+        profile->epoch_seconds[phase] += now - profile->mark;
+        profile->mark = now;
+    }
+}
+
+// A training run starts (which starts an epoch) and ends (finishing the epoch in progress, if it saw any samples).
+// Like mlp_profile_phase, all of these do nothing when profile is NULL.
+void mlp_profile_begin(mlp_profile_t *profile);
+void mlp_profile_end(mlp_profile_t *profile);
+// Log the epoch in progress and start the next one:
+void mlp_profile_end_epoch(mlp_profile_t *profile);
+
+// Count count trained samples and their summed loss, then write the snapshot if SIGUSR1 has arrived since the last call:
+void mlp_profile_samples(mlp_profile_t *profile, long count, double loss);
+
+// Write the epoch in progress and the totals so far:
+void mlp_profile_print(mlp_profile_t *profile, FILE *file);
+
+#endif
@@ -0,0 +1,388 @@
+#include <pthread.h>
+
+#include "quant.h"
+#include "kernels.h"
+#include "simd.h"
+
+// Bytes per weight row block (one cache line / zmm register):
+#define QUANT_ALIGNMENT 64
+
+// ////////////////////////////////////  //
+//          Int8 Dot Products            //
+//  ///////////////////////////////////  //
+
+// Each kernel returns Σ x[i] * w[i] for unsigned 8 bit activations x and signed 8 bit weights w, exactly, in int32.
+
+static int32_t dot_u8s8_scalar(const uint8_t *x, const int8_t *w, int n) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += (int32_t)x[i] * w[i];
+    }
+    return sum;
+}
+
+#ifdef SIMD_X86
+
+// VPMADDUBSW would multiply the bytes directly, but its int16 pair sums saturate (255 * 127 * 2 > 32767).
+// Instead both operands are widened to int16 and multiplied with VPMADDWD, which is exact.
+__attribute__((target("avx2")))
+static int32_t dot_u8s8_avx2(const uint8_t *x, const int8_t *w, int n) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i x0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(x + i)));
+        const __m256i w0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(w + i)));
+        const __m256i x1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(x + i + 16)));
+        const __m256i w1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(w + i + 16)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(x0, w0));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(x1, w1));
+    }
+    for (; i + 16 <= n; i += 16) {
+        const __m256i x0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(x + i)));
+        const __m256i w0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(w + i)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(x0, w0));
+    }
+    acc0 = _mm256_add_epi32(acc0, acc1);
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t sum = _mm_cvtsi128_si32(half);
+    for (; i < n; i++) {
+        sum += (int32_t)x[i] * w[i];
+    }
+    return sum;
+}
+
+// VPDPBUSD multiplies 64 unsigned by signed byte pairs and accumulates groups of four straight into int32, without saturation:
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static int32_t dot_u8s8_avx512vnni(const uint8_t *x, const int8_t *w, int n) {
+    __m512i acc0 = _mm512_setzero_si512();
+    __m512i acc1 = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 128 <= n; i += 128) {
+        acc0 = _mm512_dpbusd_epi32(acc0, _mm512_loadu_si512(x + i), _mm512_loadu_si512(w + i));
+        acc1 = _mm512_dpbusd_epi32(acc1, _mm512_loadu_si512(x + i + 64), _mm512_loadu_si512(w + i + 64));
+    }
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_dpbusd_epi32(acc0, _mm512_loadu_si512(x + i), _mm512_loadu_si512(w + i));
+    }
+    if (i < n) {
+        const __mmask64 mask = (n - i == 64) ? ~0ULL : ((1ULL << (n - i)) - 1);
+        acc1 = _mm512_dpbusd_epi32(acc1, _mm512_maskz_loadu_epi8(mask, x + i), _mm512_maskz_loadu_epi8(mask, w + i));
+    }
+    return _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+}
+
+#endif
+
+static int32_t dot_u8s8_resolve(const uint8_t *x, const int8_t *w, int n);
+static int32_t (*dot_u8s8)(const uint8_t *x, const int8_t *w, int n) = dot_u8s8_resolve;
+static const char *dot_u8s8_name = "scalar";
+static pthread_once_t dot_u8s8_once = PTHREAD_ONCE_INIT;
+
+// Follow the ISA selected for the floating point kernels (including any MLP_ISA cap),
+// with VNNI as an extra requirement for the AVX-512 version:
+static void select_dot_u8s8(void) {
+    dot_u8s8 = dot_u8s8_scalar;
+    dot_u8s8_name = "scalar";
+#ifdef SIMD_X86
+    const kernel_isa_t isa = kernels_isa();
+    if (isa >= ISA_AVX512 && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni")) {
+        dot_u8s8 = dot_u8s8_avx512vnni;
+        dot_u8s8_name = "avx512vnni";
+    } else if (isa >= ISA_AVX2) {
+        dot_u8s8 = dot_u8s8_avx2;
+        dot_u8s8_name = "avx2";
+    }
+#endif
+}
+
+// Run once, as the first calls may come from several pool threads at the same time:
+static int32_t dot_u8s8_resolve(const uint8_t *x, const int8_t *w, int n) {
+    pthread_once(&dot_u8s8_once, select_dot_u8s8);
+    return dot_u8s8(x, w, n);
+}
+
+const char *quantized_kernel_name(void) {
+    pthread_once(&dot_u8s8_once, select_dot_u8s8);
+    return dot_u8s8_name;
+}
+
+// ////////////////////////////////////  //
+//            Create/Destroy             //
+//  ///////////////////////////////////  //
+
+static void alloc_quantized_layer(mlp_quantized_layer_t *layer, int input_count, int output_count, double (*activation_function)(double)) {
+    const int stride = (input_count + QUANT_ALIGNMENT - 1) / QUANT_ALIGNMENT * QUANT_ALIGNMENT;
+
+    layer->input_count = input_count;
+    layer->output_count = output_count;
+    layer->stride = stride;
+    layer->activation_function = activation_function;
+
+    // Zeroised so the row padding never contributes:
+    layer->weights = aligned_alloc(QUANT_ALIGNMENT, (size_t)output_count * stride);
+    memset(layer->weights, 0, (size_t)output_count * stride);
+    layer->weight_scales = malloc(sizeof(float) * output_count);
+    layer->biases = malloc(sizeof(float) * output_count);
+}
+
+static void destroy_quantized_layer(mlp_quantized_layer_t *layer) {
+    free(layer->weights);
+    free(layer->weight_scales);
+    free(layer->biases);
+}
+
+// Symmetric per-neuron quantization: each row is scaled so its largest magnitude weight maps to ±127.
+static void quantize_layer(mlp_quantized_layer_t *q, const mlp_layer_t *layer) {
+    for (int k = 0; k < layer->output_count; k++) {
+        const real_t *row = mlp_layer_row(layer, k);
+        int8_t *q_row = q->weights + (size_t)k * q->stride;
+
+        double max_weight = 0.0;
+        for (int j = 0; j < layer->input_count; j++) {
+            if (fabs(row[j]) > max_weight) {
+                max_weight = fabs(row[j]);
+            }
+        }
+
+        const double scale = max_weight > 0.0 ? max_weight / 127.0 : 1.0;
+        for (int j = 0; j < layer->input_count; j++) {
+            q_row[j] = (int8_t)lrint(row[j] / scale);
+        }
+        q->weight_scales[k] = (float)scale;
+        q->biases[k] = (float)layer->biases[k];
+    }
+}
+
+mlp_quantized_t *quantize_mlp(const multilayer_perceptron_t *mlp, int calibration_count, const mlp_inputs_t *calibration_inputs, float input_scale) {
+
+    // Init and zeroise:
+    mlp_quantized_t *q = (mlp_quantized_t *)malloc(sizeof(*q));
+    memset(q, 0, sizeof(*q));
+
+    q->input_count = mlp->input_count;
+    q->p_hidden1_count = mlp->p_hidden1_count;
+    q->p_output_count = mlp->p_output_count;
+    q->input_scale = input_scale;
+
+    alloc_quantized_layer(&q->hidden1, mlp->input_count, mlp->p_hidden1_count, mlp->hidden1.activation_function);
+    alloc_quantized_layer(&q->output, mlp->p_hidden1_count, mlp->p_output_count, mlp->output.activation_function);
+    quantize_layer(&q->hidden1, &mlp->hidden1);
+    quantize_layer(&q->output, &mlp->output);
+
+    // Calibrate: the hidden activations are quantized to uint8 over [0, largest activation seen]:
+    mlp_workspace_t *workspace = init_mlp_workspace(mlp);
+    double max_activation = 0.0;
+    double min_activation = 0.0;
+    for (int i = 0; i < calibration_count; i++) {
+        mlp_feedforward_row(mlp, workspace, calibration_inputs, i);
+        for (int k = 0; k < mlp->p_hidden1_count; k++) {
+            if (workspace->hidden1_output[k] > max_activation) {
+                max_activation = workspace->hidden1_output[k];
+            }
+            if (workspace->hidden1_output[k] < min_activation) {
+                min_activation = workspace->hidden1_output[k];
+            }
+        }
+    }
+    destroy_mlp_workspace(workspace);
+
+    if (min_activation < 0.0) {
+        fprintf(stderr, "Hidden activations go negative (%f); they will be clamped to 0 when quantized\n", min_activation);
+    }
+    q->hidden1_scale = max_activation > 0.0 ? (float)(max_activation / 255.0) : 1.0f;
+
+    return q;
+}
+
+void destroy_quantized_mlp(mlp_quantized_t *q) {
+    destroy_quantized_layer(&q->hidden1);
+    destroy_quantized_layer(&q->output);
+    free(q);
+}
+
+// ////////////////////////////////////  //
+//               Predict                 //
+//  ///////////////////////////////////  //
+
+// Weighted sum of a uint8 input vector (each step worth input_scale) for every neuron, followed by the activation:
+static void quantized_layer_feedforward(const mlp_quantized_layer_t *layer, const uint8_t *input, float input_scale, float *output) {
+    for (int k = 0; k < layer->output_count; k++) {
+        const int32_t acc = dot_u8s8(input, layer->weights + (size_t)k * layer->stride, layer->input_count);
+        const double z = (double)acc * layer->weight_scales[k] * input_scale + layer->biases[k];
+        output[k] = (float)layer->activation_function(z);
+    }
+}
+
+typedef struct {
+    const mlp_quantized_t *q;
+    int thread_count;
+    int count;
+    const unsigned char *inputs;
+    int input_stride;
+    float *outputs;
+    int *labels;
+} quantized_predict_job_t;
+
+static void quantized_predict_task(void *arg, int thread_index) {
+    quantized_predict_job_t *job = (quantized_predict_job_t *)arg;
+    const mlp_quantized_t *q = job->q;
+    const int start = (int)((long)job->count * thread_index / job->thread_count);
+    const int end = (int)((long)job->count * (thread_index + 1) / job->thread_count);
+    if (start >= end) {
+        return;
+    }
+
+    // Thread-private activations:
+    float *hidden1_output = malloc(sizeof(float) * q->p_hidden1_count);
+    uint8_t *hidden1_quantized = malloc(q->p_hidden1_count);
+    float *output_output = malloc(sizeof(float) * q->p_output_count);
+
+    for (int i = start; i < end; i++) {
+        float *outputs = job->outputs ? job->outputs + (size_t)i * q->p_output_count : output_output;
+
+        quantized_layer_feedforward(&q->hidden1, job->inputs + (size_t)i * job->input_stride, q->input_scale, hidden1_output);
+
+        // Requantize the hidden activations to uint8 for the next layer:
+        for (int k = 0; k < q->p_hidden1_count; k++) {
+            const long level = lrintf(hidden1_output[k] / q->hidden1_scale);
+            hidden1_quantized[k] = (uint8_t)(level < 0 ? 0 : level > 255 ? 255 : level);
+        }
+
+        quantized_layer_feedforward(&q->output, hidden1_quantized, q->hidden1_scale, outputs);
+
+        if (job->labels) {
+            int best = 0;
+            for (int k = 1; k < q->p_output_count; k++) {
+                if (outputs[k] > outputs[best]) {
+                    best = k;
+                }
+            }
+            job->labels[i] = best;
+        }
+    }
+
+    free(hidden1_output);
+    free(hidden1_quantized);
+    free(output_output);
+}
+
+void quantized_predict_batch(const mlp_quantized_t *q, int count, const unsigned char *inputs, int input_stride,
+    float *outputs, int *labels, thread_pool_t *pool) {
+
+    quantized_predict_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.q = q;
+    job.thread_count = pool ? pool->thread_count : 1;
+    job.count = count;
+    job.inputs = inputs;
+    job.input_stride = input_stride;
+    job.outputs = outputs;
+    job.labels = labels;
+
+    if (pool) {
+        thread_pool_run(pool, quantized_predict_task, &job);
+    } else {
+        quantized_predict_task(&job, 0);
+    }
+}
+
+// ////////////////////////////////////  //
+//             Save/Load                 //
+//  ///////////////////////////////////  //
+
+static void write_quantized_layer(const mlp_quantized_layer_t *layer, FILE *file) {
+    for (int k = 0; k < layer->output_count; k++) {
+        fwrite(&layer->weight_scales[k], sizeof(float), 1, file);
+        fwrite(&layer->biases[k], sizeof(float), 1, file);
+        fwrite(layer->weights + (size_t)k * layer->stride, sizeof(int8_t), layer->input_count, file);
+    }
+}
+
+// Returns 0 if the file ends before the layer does:
+static int read_quantized_layer(mlp_quantized_layer_t *layer, FILE *file) {
+    for (int k = 0; k < layer->output_count; k++) {
+        if (fread(&layer->weight_scales[k], sizeof(float), 1, file) != 1 ||
+            fread(&layer->biases[k], sizeof(float), 1, file) != 1 ||
+            fread(layer->weights + (size_t)k * layer->stride, sizeof(int8_t), layer->input_count, file) != (size_t)layer->input_count) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void save_quantized_mlp(const mlp_quantized_t *q, const char *filename) {
+
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        perror("Failed to open file for saving quantized weights");
+        return;
+    }
+
+    // Structure and activation scales, then each neuron's weight scale, bias and int8 weights:
+    fwrite(&q->input_count, sizeof(int), 1, file);
+    fwrite(&q->p_hidden1_count, sizeof(int), 1, file);
+    fwrite(&q->p_output_count, sizeof(int), 1, file);
+    fwrite(&q->input_scale, sizeof(float), 1, file);
+    fwrite(&q->hidden1_scale, sizeof(float), 1, file);
+    write_quantized_layer(&q->hidden1, file);
+    write_quantized_layer(&q->output, file);
+
+    fclose(file);
+}
+
+mlp_quantized_t *load_quantized_mlp(const char *filename, double (*hidden1_activation_function)(double), double (*output_activation_function)(double)) {
+
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        perror("Failed to open file for loading quantized weights");
+        return NULL;
+    }
+
+    mlp_quantized_t *q = (mlp_quantized_t *)malloc(sizeof(*q));
+    memset(q, 0, sizeof(*q));
+
+    if (fread(&q->input_count, sizeof(int), 1, file) != 1 || fread(&q->p_hidden1_count, sizeof(int), 1, file) != 1 ||
+        fread(&q->p_output_count, sizeof(int), 1, file) != 1 || q->input_count <= 0 || q->p_hidden1_count <= 0 || q->p_output_count <= 0) {
+        fprintf(stderr, "Invalid quantized weights file\n");
+        free(q);
+        fclose(file);
+        return NULL;
+    }
+
+    // The counts size the allocations below, so check them against what the file actually holds first: two scales,
+    // then a weight scale, a bias and input_count int8 weights per neuron of each layer:
+    const long long expected_size = (long long)sizeof(int) * 3 + sizeof(float) * 2 +
+        (long long)q->p_hidden1_count * (sizeof(float) * 2 + q->input_count) +
+        (long long)q->p_output_count * (sizeof(float) * 2 + q->p_hidden1_count);
+    const long header_end = ftell(file);
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    fseek(file, header_end, SEEK_SET);
+    if (file_size != expected_size) {
+        fprintf(stderr, "Quantized weights file size does not match its %d-%d-%d structure\n", q->input_count, q->p_hidden1_count, q->p_output_count);
+        free(q);
+        fclose(file);
+        return NULL;
+    }
+    if (fread(&q->input_scale, sizeof(float), 1, file) != 1 || fread(&q->hidden1_scale, sizeof(float), 1, file) != 1) {
+        fprintf(stderr, "Invalid quantized weights file: missing activation scales\n");
+        free(q);
+        fclose(file);
+        return NULL;
+    }
+
+    alloc_quantized_layer(&q->hidden1, q->input_count, q->p_hidden1_count, hidden1_activation_function);
+    alloc_quantized_layer(&q->output, q->p_hidden1_count, q->p_output_count, output_activation_function);
+    if (!read_quantized_layer(&q->hidden1, file) || !read_quantized_layer(&q->output, file)) {
+        fprintf(stderr, "Invalid quantized weights file: truncated weights\n");
+        destroy_quantized_mlp(q);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    return q;
+}
@@ -0,0 +1,57 @@
+#ifndef QUANT_H
+#define QUANT_H
+
+#include <stdint.h>
+
+#include "mlp.h"
+
+// Int8 post-training quantization of a trained MLP, for inference only.
+//
+// Weights are stored as int8 with one float scale per neuron (w ≈ q * scale, symmetric around 0).
+// Activations entering each layer are uint8 with one scale per layer: the network inputs use input_scale
+// (1/255 for raw MNIST pixels), and the hidden layer outputs use a scale calibrated from the largest activation
+// seen on a sample of training data. Dot products are accumulated exactly in int32, then rescaled to float
+// for the bias and activation function. The hidden activation must be non-negative (ReLU, sigmoid, step).
+
+typedef struct mlp_quantized_layer_t {
+    int input_count;
+    int output_count;
+    // Row stride in bytes; rows are zero padded to whole 64 byte blocks:
+    int stride;
+    int8_t *weights;
+    float *weight_scales;
+    float *biases;
+    double (*activation_function)(double);
+} mlp_quantized_layer_t;
+
+typedef struct mlp_quantized_t {
+    int input_count;
+    int p_hidden1_count;
+    int p_output_count;
+
+    // Real value of one uint8 step of the network input, and of the hidden layer output:
+    float input_scale;
+    float hidden1_scale;
+
+    mlp_quantized_layer_t hidden1;
+    mlp_quantized_layer_t output;
+} mlp_quantized_t;
+
+// Quantize mlp, calibrating the hidden layer's activation range on the first calibration_count rows of calibration_inputs.
+// The quantized model reads uint8 inputs worth input_scale per step (the byte_scale of the inputs it was trained on).
+mlp_quantized_t *quantize_mlp(const multilayer_perceptron_t *mlp, int calibration_count, const mlp_inputs_t *calibration_inputs, float input_scale);
+void destroy_quantized_mlp(mlp_quantized_t *q);
+
+// Batched int8 inference on uint8 inputs (input_stride bytes apart), split across the pool (or the calling thread if NULL).
+// outputs, if given, receives [count][p_output_count] activated outputs; labels, if given, the argmax of each.
+void quantized_predict_batch(const mlp_quantized_t *q, int count, const unsigned char *inputs, int input_stride,
+    float *outputs, int *labels, thread_pool_t *pool);
+
+// Name of the int8 dot product kernel in use (scalar, avx2 or avx512vnni):
+const char *quantized_kernel_name(void);
+
+// The activation functions are not stored; load_quantized_mlp takes them from the caller like init_mlp does.
+void save_quantized_mlp(const mlp_quantized_t *q, const char *filename);
+mlp_quantized_t *load_quantized_mlp(const char *filename, double (*hidden1_activation_function)(double), double (*output_activation_function)(double));
+
+#endif
@@ -0,0 +1,36 @@
+#include <stdatomic.h>
+
+#include "random.h"
+
+// Until mlp_random_set_seed, the digits of pi (any constant would do):
+static uint64_t process_seed = 0x243F6A8885A308D3ULL;
+static atomic_ulong next_stream = 0;
+
+void mlp_random_lanes(mlp_random_lanes_t *lanes, uint64_t seed, uint64_t stream) {
+    // The lanes are consecutive sub-streams of the stream's own key, so no two lanes (of this or any other stream)
+    // start from the same state:
+    const uint64_t key = mlp_random_mix(seed ^ mlp_random_mix(stream));
+    for (int l = 0; l < MLP_RANDOM_LANES; l++) {
+        const mlp_random_t lane = mlp_random_stream(key, l);
+        for (int w = 0; w < 4; w++) {
+            lanes->s[w][l] = lane.s[w];
+        }
+    }
+}
+
+void mlp_random_set_seed(uint64_t seed) {
+    process_seed = seed;
+    atomic_store(&next_stream, 0);
+}
+
+uint64_t mlp_random_seed(void) {
+    return process_seed;
+}
+
+uint64_t mlp_random_take_stream(void) {
+    return atomic_fetch_add(&next_stream, 1);
+}
+
+mlp_random_t mlp_random_take(void) {
+    return mlp_random_stream(process_seed, mlp_random_take_stream());
+}
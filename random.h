@@ -0,0 +1,97 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+// Seeded, splittable pseudo-random numbers, used for everything random in the library in place of rand().
+//
+// The generator is xoshiro256++: 256 bits of state, a handful of adds, xors and rotates per 64-bit output, and
+// no lock (each user owns its state). Any number of independent streams are derived from one 64-bit seed by
+// keying splitmix64 with the seed and a stream number, so a parallel user gives every thread (or every row of work)
+// a stream of its own and gets the same numbers however the work is split.
+//
+// The library takes its streams in order from the process seed (mlp_random_take), so a program run twice with the
+// same seed (MLP_SEED) and the same calls sees the same numbers.
+
+typedef struct mlp_random_t {
+    uint64_t s[4];
+} mlp_random_t;
+
+// Interleaved streams stepped together by vector_random_uniform (see kernels.h), one per 64-bit vector lane.
+// s[w][l] is word w of stream l's state:
+#define MLP_RANDOM_LANES 8
+
+typedef struct mlp_random_lanes_t {
+    uint64_t s[4][MLP_RANDOM_LANES];
+} mlp_random_lanes_t;
+
+// splitmix64, which turns any 64-bit value (even 0, or consecutive counters) into a well-mixed one:
+static inline uint64_t mlp_random_mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static inline uint64_t mlp_random_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// Stream number stream of seed. The state is filled from a splitmix64 sequence keyed by both, so it is never all zero:
+static inline mlp_random_t mlp_random_stream(uint64_t seed, uint64_t stream) {
+    mlp_random_t random;
+    uint64_t key = mlp_random_mix(seed ^ mlp_random_mix(stream));
+    for (int w = 0; w < 4; w++) {
+        random.s[w] = key = mlp_random_mix(key);
+    }
+    return random;
+}
+
+static inline uint64_t mlp_random_next(mlp_random_t *random) {
+    uint64_t *s = random->s;
+    const uint64_t result = mlp_random_rotl(s[0] + s[3], 23) + s[0];
+    const uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = mlp_random_rotl(s[3], 45);
+    return result;
+}
+
+// Uniform in [0, 1), from the top 53 bits:
+static inline double mlp_random_double(mlp_random_t *random) {
+    return (mlp_random_next(random) >> 11) * 0x1.0p-53;
+}
+
+static inline double mlp_random_uniform(mlp_random_t *random, double low, double high) {
+    return low + (high - low) * mlp_random_double(random);
+}
+
+// Uniform in [0, n) for n > 0, without the bias of a plain modulo (Lemire's multiply and reject):
+static inline uint64_t mlp_random_below(mlp_random_t *random, uint64_t n) {
+    unsigned __int128 product = (unsigned __int128)mlp_random_next(random) * n;
+    if ((uint64_t)product < n) {
+        const uint64_t threshold = -n % n;
+        while ((uint64_t)product < threshold) {
+            product = (unsigned __int128)mlp_random_next(random) * n;
+        }
+    }
+    return (uint64_t)(product >> 64);
+}
+
+// MLP_RANDOM_LANES streams for vector_random_uniform, all derived from stream number stream of seed:
+void mlp_random_lanes(mlp_random_lanes_t *lanes, uint64_t seed, uint64_t stream);
+
+// The process seed, which the library's streams come from. Until it is set it is a fixed constant, so runs are
+// reproducible by default:
+void mlp_random_set_seed(uint64_t seed);
+uint64_t mlp_random_seed(void);
+
+// The number of the next unused stream of the process seed (thread safe), for users that derive further streams
+// from it (e.g. one per row), or a generator for the next stream directly:
+uint64_t mlp_random_take_stream(void);
+mlp_random_t mlp_random_take(void);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef REAL_H
+#define REAL_H
+
+// Storage type for weights, activations and datasets.
+// Builds are double precision by default; compile with -DMLP_FLOAT32 (./build.sh float32) for single precision,
+// which halves the memory and bandwidth of every array and doubles the lanes per SIMD register.
+// Scalars such as learning rates and activation function arguments stay double in both builds.
+#ifdef MLP_FLOAT32
+typedef float real_t;
+#define REAL_NAME "float32"
+#else
+typedef double real_t;
+#define REAL_NAME "float64"
+#endif
+
+#endif
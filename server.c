@@ -0,0 +1,524 @@
+// ppoll (for sub-millisecond batch deadlines) and accept4 are GNU extensions:
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+// Bytes read from a connection per call; a connection's input buffer holds at least this plus one whole request:
+#define SERVER_READ_SIZE 65536
+// Unsent response bytes a connection may have queued before its requests stop being read (until it catches up), so
+// a client that sends without reading can't make the server buffer without bound:
+#define SERVER_OUTPUT_LIMIT (1 << 20)
+
+static double server_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// ////////////////////////////////////  //
+//           Shutdown Signals            //
+//  ///////////////////////////////////  //
+
+// SIGINT and SIGTERM may land on any thread (including the pool's), so rather than rely on them interrupting the
+// event loop, the handler writes to a pipe the loop polls alongside the sockets:
+static int stop_pipe[2] = {-1, -1};
+
+static void stop_handler(int signal_number) {
+    (void)signal_number;
+    const int saved_errno = errno;
+    const char byte = 0;
+    if (write(stop_pipe[1], &byte, 1) < 0) {
+        // Already full, so the loop is going to stop anyway.
+    }
+    errno = saved_errno;
+}
+
+// ////////////////////////////////////  //
+//              Connections              //
+//  ///////////////////////////////////  //
+
+typedef struct connection_t {
+    // -1 while the slot is free:
+    int fd;
+    // Bumped whenever the slot is reused, so a batched request whose client has gone (and whose slot now holds
+    // another client) is recognised and its response dropped:
+    unsigned generation;
+
+    // Bytes read but not yet parsed into requests:
+    unsigned char *in;
+    size_t in_used;
+    size_t in_size;
+    // Set while whole requests are left in the input because the output was backed up:
+    int paused;
+
+    // Responses queued but not yet sent:
+    unsigned char *out;
+    size_t out_sent;
+    size_t out_used;
+    size_t out_size;
+} connection_t;
+
+// A prediction waiting in the micro-batch, whose input is the matching row of the batch's inputs:
+typedef struct pending_request_t {
+    int slot;
+    unsigned generation;
+    uint32_t id;
+    double arrival;
+} pending_request_t;
+
+typedef struct server_t {
+    const multilayer_perceptron_t *mlp;
+    const server_config_t *config;
+    thread_pool_t *pool;
+    size_t request_size;
+
+    int listen_fd;
+    connection_t *connections;
+    int connection_count;
+
+    // The micro-batch being gathered, and the space to run it in:
+    pending_request_t *pending;
+    int pending_count;
+    unsigned char *inputs;
+    mlp_predict_workspace_t *workspace;
+    real_t *outputs;
+    int *labels;
+    float *response_outputs;
+
+    // Counters, and a ring of the last SERVER_LATENCY_WINDOW prediction latencies:
+    double start;
+    uint64_t requests;
+    uint64_t batches;
+    double *latencies;
+} server_t;
+
+static void close_connection(connection_t *connection) {
+    close(connection->fd);
+    connection->fd = -1;
+    connection->generation++;
+    connection->in_used = 0;
+    connection->paused = 0;
+    connection->out_sent = connection->out_used = 0;
+}
+
+// A free slot for a new client, growing the table when they're all taken:
+static int add_connection(server_t *server, int fd) {
+    int slot = 0;
+    while (slot < server->connection_count && server->connections[slot].fd >= 0) {
+        slot++;
+    }
+    if (slot == server->connection_count) {
+        const int count = server->connection_count ? server->connection_count * 2 : 8;
+        server->connections = (connection_t *)realloc(server->connections, sizeof(connection_t) * count);
+        memset(server->connections + server->connection_count, 0, sizeof(connection_t) * (count - server->connection_count));
+        for (int c = server->connection_count; c < count; c++) {
+            server->connections[c].fd = -1;
+        }
+        server->connection_count = count;
+    }
+
+    connection_t *connection = &server->connections[slot];
+    connection->fd = fd;
+    if (!connection->in) {
+        connection->in_size = SERVER_READ_SIZE + server->request_size;
+        connection->in = (unsigned char *)malloc(connection->in_size);
+    }
+    return slot;
+}
+
+static int output_backed_up(const connection_t *connection) {
+    return connection->out_used - connection->out_sent >= SERVER_OUTPUT_LIMIT;
+}
+
+static void queue_response(connection_t *connection, const server_response_t *response, const void *body) {
+    const size_t size = sizeof(*response) + response->size;
+    if (connection->out_used + size > connection->out_size) {
+        // Compact what's been sent before growing:
+        memmove(connection->out, connection->out + connection->out_sent, connection->out_used - connection->out_sent);
+        connection->out_used -= connection->out_sent;
+        connection->out_sent = 0;
+        while (connection->out_used + size > connection->out_size) {
+            connection->out_size = connection->out_size ? connection->out_size * 2 : 4096;
+        }
+        connection->out = (unsigned char *)realloc(connection->out, connection->out_size);
+    }
+    memcpy(connection->out + connection->out_used, response, sizeof(*response));
+    memcpy(connection->out + connection->out_used + sizeof(*response), body, response->size);
+    connection->out_used += size;
+}
+
+// Send as much queued output as the socket takes without blocking. Returns -1 if the client has gone:
+static int send_responses(connection_t *connection) {
+    while (connection->out_sent < connection->out_used) {
+        const ssize_t sent = send(connection->fd, connection->out + connection->out_sent,
+            connection->out_used - connection->out_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        connection->out_sent += sent;
+    }
+    connection->out_sent = connection->out_used = 0;
+    return 0;
+}
+
+static void send_all_responses(server_t *server) {
+    for (int c = 0; c < server->connection_count; c++) {
+        connection_t *connection = &server->connections[c];
+        if (connection->fd >= 0 && connection->out_used > connection->out_sent && send_responses(connection) < 0) {
+            close_connection(connection);
+        }
+    }
+}
+
+// ////////////////////////////////////  //
+//               Batching                //
+//  ///////////////////////////////////  //
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void server_stats(const server_t *server, server_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->requests = server->requests;
+    stats->batches = server->batches;
+    stats->uptime_seconds = server_now() - server->start;
+    stats->requests_per_second = stats->uptime_seconds > 0 ? server->requests / stats->uptime_seconds : 0;
+    stats->mean_batch_size = server->batches ? (double)server->requests / server->batches : 0;
+
+    const int count = server->requests < SERVER_LATENCY_WINDOW ? (int)server->requests : SERVER_LATENCY_WINDOW;
+    if (count) {
+        double *sorted = (double *)malloc(sizeof(double) * count);
+        memcpy(sorted, server->latencies, sizeof(double) * count);
+        qsort(sorted, count, sizeof(double), compare_doubles);
+        stats->p50_latency_us = sorted[(count - 1) / 2] * 1e6;
+        stats->p99_latency_us = sorted[(int)((count - 1) * 0.99)] * 1e6;
+        stats->max_latency_us = sorted[count - 1] * 1e6;
+        free(sorted);
+    }
+}
+
+// Run the gathered predictions as one batched forward pass across the pool, and queue each response on its connection:
+static void run_batch(server_t *server) {
+    const int count = server->pending_count;
+    if (!count) {
+        return;
+    }
+    const int input_count = server->mlp->input_count;
+    const int output_count = server->mlp->p_output_count;
+
+    const mlp_inputs_t inputs = mlp_byte_inputs(server->inputs, input_count, input_count, server->config->byte_scale);
+    mlp_predict_batch_r(server->mlp, server->workspace, count, &inputs, server->outputs, server->labels, server->pool);
+
+    const double now = server_now();
+    for (int r = 0; r < count; r++) {
+        const pending_request_t *request = &server->pending[r];
+        server->latencies[(server->requests + r) % SERVER_LATENCY_WINDOW] = now - request->arrival;
+
+        connection_t *connection = &server->connections[request->slot];
+        if (connection->fd < 0 || connection->generation != request->generation) {
+            continue;
+        }
+        const real_t *outputs = server->outputs + (size_t)r * output_count;
+        for (int o = 0; o < output_count; o++) {
+            server->response_outputs[o] = (float)outputs[o];
+        }
+        const server_response_t response = {SERVER_OP_PREDICT, request->id, server->labels[r], (uint32_t)(sizeof(float) * output_count)};
+        queue_response(connection, &response, server->response_outputs);
+    }
+
+    server->requests += count;
+    server->batches++;
+    server->pending_count = 0;
+}
+
+// ////////////////////////////////////  //
+//               Requests                //
+//  ///////////////////////////////////  //
+
+// Parse every whole request in a connection's input, or as many as fit before its output backs up (leaving the rest
+// paused). Returns -1 if the client sent something invalid:
+static int handle_requests(server_t *server, int slot) {
+    connection_t *connection = &server->connections[slot];
+    const int input_count = server->mlp->input_count;
+    size_t offset = 0;
+
+    connection->paused = 0;
+    while (connection->in_used - offset >= sizeof(server_request_t)) {
+        if (output_backed_up(connection)) {
+            connection->paused = 1;
+            break;
+        }
+        server_request_t request;
+        memcpy(&request, connection->in + offset, sizeof(request));
+
+        if (request.op == SERVER_OP_PREDICT) {
+            if (connection->in_used - offset < server->request_size) {
+                break;
+            }
+            pending_request_t *pending = &server->pending[server->pending_count];
+            pending->slot = slot;
+            pending->generation = connection->generation;
+            pending->id = request.id;
+            pending->arrival = server_now();
+            memcpy(server->inputs + (size_t)server->pending_count * input_count, connection->in + offset + sizeof(request), input_count);
+            offset += server->request_size;
+
+            if (++server->pending_count == server->config->max_batch) {
+                run_batch(server);
+            }
+        } else if (request.op == SERVER_OP_STATS) {
+            // Run this client's waiting predictions first, so its responses stay in the order it sent the requests:
+            for (int r = 0; r < server->pending_count; r++) {
+                if (server->pending[r].slot == slot) {
+                    run_batch(server);
+                    break;
+                }
+            }
+            server_stats_t stats;
+            server_stats(server, &stats);
+            const server_response_t response = {SERVER_OP_STATS, request.id, -1, sizeof(stats)};
+            queue_response(connection, &response, &stats);
+            offset += sizeof(request);
+        } else {
+            fprintf(stderr, "Closing a connection that sent unknown op %u\n", request.op);
+            return -1;
+        }
+    }
+
+    // Keep any partial request for the next read:
+    memmove(connection->in, connection->in + offset, connection->in_used - offset);
+    connection->in_used -= offset;
+    return 0;
+}
+
+// Handle any paused requests, then read what's available and handle that, for as long as the output isn't backed up.
+// Returns -1 when the connection should be closed:
+static int read_requests(server_t *server, int slot) {
+    connection_t *connection = &server->connections[slot];
+    for (;;) {
+        if (handle_requests(server, slot) < 0) {
+            return -1;
+        }
+        // Once everything has been parsed, less than a whole request is left, so there's always room to read into:
+        if (connection->paused) {
+            return 0;
+        }
+
+        const ssize_t received = recv(connection->fd, connection->in + connection->in_used,
+            connection->in_size - connection->in_used, MSG_DONTWAIT);
+        if (received == 0) {
+            return -1;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        connection->in_used += received;
+    }
+}
+
+// ////////////////////////////////////  //
+//              Event Loop               //
+//  ///////////////////////////////////  //
+
+static int open_socket(const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    // Replace the socket file a previous run left behind:
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 128) < 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void accept_connections(server_t *server) {
+    for (;;) {
+        const int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+        add_connection(server, fd);
+    }
+}
+
+int run_inference_server(const multilayer_perceptron_t *mlp, const server_config_t *config, thread_pool_t *pool) {
+    if (config->max_batch < 1) {
+        fprintf(stderr, "The server's max_batch must be at least 1\n");
+        return -1;
+    }
+
+    // Init and zeroise:
+    server_t server;
+    memset(&server, 0, sizeof(server));
+    server.mlp = mlp;
+    server.config = config;
+    server.pool = pool;
+    server.request_size = sizeof(server_request_t) + mlp->input_count;
+
+    server.listen_fd = open_socket(config->socket_path);
+    if (server.listen_fd < 0) {
+        return -1;
+    }
+    if (pipe2(stop_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        perror("pipe");
+        close(server.listen_fd);
+        return -1;
+    }
+
+    struct sigaction action, previous_int, previous_term;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &previous_int);
+    sigaction(SIGTERM, &action, &previous_term);
+
+    server.pending = (pending_request_t *)malloc(sizeof(pending_request_t) * config->max_batch);
+    server.inputs = (unsigned char *)malloc((size_t)config->max_batch * mlp->input_count);
+    server.workspace = init_mlp_predict_workspace(mlp, pool ? pool->thread_count : 1);
+    server.outputs = (real_t *)malloc(sizeof(real_t) * config->max_batch * mlp->p_output_count);
+    server.labels = (int *)malloc(sizeof(int) * config->max_batch);
+    server.response_outputs = (float *)malloc(sizeof(float) * mlp->p_output_count);
+    server.latencies = (double *)malloc(sizeof(double) * SERVER_LATENCY_WINDOW);
+    server.start = server_now();
+
+    fprintf(stderr, "Serving on %s (batches of up to %d, waiting at most %.0fus)\n", config->socket_path,
+        config->max_batch, config->max_latency_seconds * 1e6);
+
+    // pollfds: the stop pipe, the listening socket, then one per connection slot (free ones are skipped, fd -1):
+    struct pollfd *fds = NULL;
+    int running = 1;
+    while (running) {
+        // Sleep until there's something to read or send, or the oldest waiting prediction's deadline:
+        struct timespec timeout, *deadline = NULL;
+        if (server.pending_count) {
+            const double remaining = server.pending[0].arrival + config->max_latency_seconds - server_now();
+            if (remaining <= 0) {
+                run_batch(&server);
+                send_all_responses(&server);
+                continue;
+            }
+            timeout.tv_sec = (time_t)remaining;
+            timeout.tv_nsec = (long)((remaining - timeout.tv_sec) * 1e9);
+            deadline = &timeout;
+        }
+
+        const int fd_count = 2 + server.connection_count;
+        fds = (struct pollfd *)realloc(fds, sizeof(struct pollfd) * fd_count);
+        fds[0] = (struct pollfd){stop_pipe[0], POLLIN, 0};
+        fds[1] = (struct pollfd){server.listen_fd, POLLIN, 0};
+        // A connection whose output is backed up is only polled for sending, until it drains:
+        for (int c = 0; c < server.connection_count; c++) {
+            const connection_t *connection = &server.connections[c];
+            fds[2 + c] = (struct pollfd){connection->fd, (output_backed_up(connection) ? 0 : POLLIN) |
+                (connection->out_used > connection->out_sent ? POLLOUT : 0), 0};
+        }
+
+        if (ppoll(fds, fd_count, deadline, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ppoll");
+            break;
+        }
+
+        if (fds[0].revents) {
+            running = 0;
+        }
+        // Connections accepted here get polled from the next pass, so only the first fd_count - 2 slots are read:
+        if (fds[1].revents & POLLIN) {
+            accept_connections(&server);
+        }
+        for (int c = 0; c < fd_count - 2; c++) {
+            if (fds[2 + c].fd >= 0 && (fds[2 + c].revents & (POLLIN | POLLHUP | POLLERR)) && read_requests(&server, c) < 0) {
+                close_connection(&server.connections[c]);
+            }
+        }
+        send_all_responses(&server);
+
+        // Connections that have drained pick up their paused requests (which may have no new input to poll for):
+        for (int c = 0; c < server.connection_count; c++) {
+            connection_t *connection = &server.connections[c];
+            if (connection->fd >= 0 && connection->paused && !output_backed_up(connection) && read_requests(&server, c) < 0) {
+                close_connection(connection);
+            }
+        }
+    }
+
+    // Answer whatever is still waiting before shutting down:
+    run_batch(&server);
+    for (int c = 0; c < server.connection_count; c++) {
+        connection_t *connection = &server.connections[c];
+        if (connection->fd >= 0) {
+            send_responses(connection);
+            close_connection(connection);
+        }
+        free(connection->in);
+        free(connection->out);
+    }
+
+    server_stats_t stats;
+    server_stats(&server, &stats);
+    fprintf(stderr, "Served %llu predictions in %llu batches (mean batch %.1f) over %.1fs, %.0f/sec | latency p50 %.0fus, p99 %.0fus, max %.0fus\n",
+        (unsigned long long)stats.requests, (unsigned long long)stats.batches, stats.mean_batch_size, stats.uptime_seconds,
+        stats.requests_per_second, stats.p50_latency_us, stats.p99_latency_us, stats.max_latency_us);
+
+    sigaction(SIGINT, &previous_int, NULL);
+    sigaction(SIGTERM, &previous_term, NULL);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    stop_pipe[0] = stop_pipe[1] = -1;
+    close(server.listen_fd);
+    unlink(config->socket_path);
+
+    free(fds);
+    free(server.connections);
+    free(server.pending);
+    free(server.inputs);
+    destroy_mlp_predict_workspace(server.workspace);
+    free(server.outputs);
+    free(server.labels);
+    free(server.response_outputs);
+    free(server.latencies);
+    return 0;
+}
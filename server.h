@@ -0,0 +1,71 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+#include "mlp.h"
+#include "threadpool.h"
+
+// Long-running inference server on a Unix domain socket.
+//
+// Clients connect to the socket and send requests back to back, without waiting for responses in between.
+// One event loop thread reads every connection, and coalesces prediction requests (from all clients) into a
+// micro-batch. A batch is run as soon as it is full, or once its oldest request has waited max_latency, as a single
+// batched forward pass split across the thread pool. Responses go back on the connection each request came in on,
+// in the order the requests were sent. A client that lets too many responses pile up unread stops having its requests
+// read until it catches up.
+//
+// The protocol is binary, in the host's byte order (both ends are on the same machine):
+//   request:  server_request_t, followed for SERVER_OP_PREDICT by the input row as input_count bytes (e.g. pixels)
+//   response: server_response_t, followed by size bytes: output_count float32 outputs for SERVER_OP_PREDICT
+//             (probabilities, for a softmax network), or a server_stats_t for SERVER_OP_STATS.
+// A connection that sends an unknown op is closed.
+
+#define SERVER_OP_PREDICT 1
+#define SERVER_OP_STATS 2
+
+typedef struct server_request_t {
+    uint32_t op;
+    // Echoed back in the response, so clients can match them up:
+    uint32_t id;
+} server_request_t;
+
+typedef struct server_response_t {
+    uint32_t op;
+    uint32_t id;
+    // Index of the highest output, for SERVER_OP_PREDICT:
+    int32_t label;
+    // Bytes that follow:
+    uint32_t size;
+} server_response_t;
+
+// Counters since the server started. Latency is from a request being fully read to its response being queued for
+// sending, over the last SERVER_LATENCY_WINDOW predictions:
+#define SERVER_LATENCY_WINDOW 65536
+
+typedef struct server_stats_t {
+    uint64_t requests;
+    uint64_t batches;
+    double uptime_seconds;
+    double requests_per_second;
+    double mean_batch_size;
+    double p50_latency_us;
+    double p99_latency_us;
+    double max_latency_us;
+} server_stats_t;
+
+typedef struct server_config_t {
+    const char *socket_path;
+    // Largest micro-batch, and the longest a request waits for one to fill:
+    int max_batch;
+    double max_latency_seconds;
+    // Input bytes are multiplied by this on the way in (see mlp_byte_inputs), e.g. 1/255 for MNIST pixels:
+    real_t byte_scale;
+} server_config_t;
+
+// Serve predictions from mlp (which is only read) on config->socket_path until SIGINT or SIGTERM, running batches on the
+// pool (which may be NULL to run them on the event loop thread). Prints the final stats to stderr on the way out.
+// Returns 0, or -1 after printing why if the socket can't be set up.
+int run_inference_server(const multilayer_perceptron_t *mlp, const server_config_t *config, thread_pool_t *pool);
+
+#endif
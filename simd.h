@@ -0,0 +1,231 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Internal helpers shared by the vectorised kernels (kernels.c, gemm.c).
+// Not part of the public API.
+
+#include "real.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Every kernel is written once against the v128_* / v256_* / v512_* names below, which map onto the
+// single or double precision intrinsics depending on real_t (see real.h).
+#ifdef SIMD_X86
+#ifdef MLP_FLOAT32
+typedef __m128 v128_t;
+typedef __m256 v256_t;
+typedef __m512 v512_t;
+typedef __mmask16 v512_mask_t;
+#define V128_LANES 4
+#define V256_LANES 8
+#define V512_LANES 16
+#define v128_zero _mm_setzero_ps
+#define v128_set1 _mm_set1_ps
+#define v128_loadu _mm_loadu_ps
+#define v128_storeu _mm_storeu_ps
+#define v128_add _mm_add_ps
+#define v128_mul _mm_mul_ps
+#define v256_zero _mm256_setzero_ps
+#define v256_set1 _mm256_set1_ps
+#define v256_load _mm256_load_ps
+#define v256_loadu _mm256_loadu_ps
+#define v256_storeu _mm256_storeu_ps
+#define v256_add _mm256_add_ps
+#define v256_sub _mm256_sub_ps
+#define v256_mul _mm256_mul_ps
+#define v256_div _mm256_div_ps
+#define v256_sqrt _mm256_sqrt_ps
+#define v256_min _mm256_min_ps
+#define v256_max _mm256_max_ps
+#define v256_and _mm256_and_ps
+#define v256_cmp _mm256_cmp_ps
+#define v256_blendv _mm256_blendv_ps
+#define v256_fmadd _mm256_fmadd_ps
+#define v256_fnmadd _mm256_fnmadd_ps
+#define v256_round(v) _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define v512_zero _mm512_setzero_ps
+#define v512_set1 _mm512_set1_ps
+#define v512_load _mm512_load_ps
+#define v512_loadu _mm512_loadu_ps
+#define v512_storeu _mm512_storeu_ps
+#define v512_maskz_loadu _mm512_maskz_loadu_ps
+#define v512_mask_storeu _mm512_mask_storeu_ps
+#define v512_add _mm512_add_ps
+#define v512_sub _mm512_sub_ps
+#define v512_mul _mm512_mul_ps
+#define v512_div _mm512_div_ps
+#define v512_sqrt _mm512_sqrt_ps
+#define v512_min _mm512_min_ps
+#define v512_max _mm512_max_ps
+#define v512_cmp_mask _mm512_cmp_ps_mask
+#define v512_mask_blend _mm512_mask_blend_ps
+#define v512_maskz_mov _mm512_maskz_mov_ps
+#define v512_fmadd _mm512_fmadd_ps
+#define v512_fnmadd _mm512_fnmadd_ps
+#define v512_scalef _mm512_scalef_ps
+#define v512_round(v) _mm512_roundscale_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define v512_reduce_add _mm512_reduce_add_ps
+
+__attribute__((target("sse2")))
+static inline real_t v128_reduce_add(v128_t v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("avx2")))
+static inline real_t v256_reduce_add(v256_t v) {
+    return v128_reduce_add(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+// Widen one vector's worth of uint8 values (8 for ymm, 16 for zmm) to real_t:
+__attribute__((target("avx2")))
+static inline v256_t v256_loadu_u8(const unsigned char *p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p)));
+}
+
+__attribute__((target("avx512f")))
+static inline v512_t v512_loadu_u8(const unsigned char *p) {
+    return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)p)));
+}
+
+// Gather base[index[0..lanes)] into a vector, and scatter a vector back out the same way:
+__attribute__((target("avx2")))
+static inline v256_t v256_gather(const real_t *base, const int *index) {
+    return _mm256_i32gather_ps(base, _mm256_loadu_si256((const __m256i *)index), sizeof(real_t));
+}
+
+__attribute__((target("avx512f")))
+static inline v512_t v512_gather(const real_t *base, const int *index) {
+    return _mm512_i32gather_ps(_mm512_loadu_si512(index), base, sizeof(real_t));
+}
+
+__attribute__((target("avx512f")))
+static inline void v512_scatter(real_t *base, const int *index, v512_t v) {
+    _mm512_i32scatter_ps(base, _mm512_loadu_si512(index), v, sizeof(real_t));
+}
+
+// 2^n for a vector of integral values n (in the normal exponent range), built straight from the exponent bits:
+__attribute__((target("avx2")))
+static inline v256_t v256_pow2i(v256_t n) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23));
+}
+
+// Degree of the Taylor polynomial used for e^r on [-ln2/2, ln2/2] by the vector exp (see kernels.c):
+#define EXP_DEGREE 6
+// |x| beyond which e^x over/underflows, and ln2 split so n * EXP_LN2_HI is exact for the n that can occur:
+#define EXP_LIMIT 87.0
+#define EXP_LN2_HI 0.693359375
+#define EXP_LN2_LO -2.12194440e-4
+#else
+typedef __m128d v128_t;
+typedef __m256d v256_t;
+typedef __m512d v512_t;
+typedef __mmask8 v512_mask_t;
+#define V128_LANES 2
+#define V256_LANES 4
+#define V512_LANES 8
+#define v128_zero _mm_setzero_pd
+#define v128_set1 _mm_set1_pd
+#define v128_loadu _mm_loadu_pd
+#define v128_storeu _mm_storeu_pd
+#define v128_add _mm_add_pd
+#define v128_mul _mm_mul_pd
+#define v256_zero _mm256_setzero_pd
+#define v256_set1 _mm256_set1_pd
+#define v256_load _mm256_load_pd
+#define v256_loadu _mm256_loadu_pd
+#define v256_storeu _mm256_storeu_pd
+#define v256_add _mm256_add_pd
+#define v256_sub _mm256_sub_pd
+#define v256_mul _mm256_mul_pd
+#define v256_div _mm256_div_pd
+#define v256_sqrt _mm256_sqrt_pd
+#define v256_min _mm256_min_pd
+#define v256_max _mm256_max_pd
+#define v256_and _mm256_and_pd
+#define v256_cmp _mm256_cmp_pd
+#define v256_blendv _mm256_blendv_pd
+#define v256_fmadd _mm256_fmadd_pd
+#define v256_fnmadd _mm256_fnmadd_pd
+#define v256_round(v) _mm256_round_pd(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define v512_zero _mm512_setzero_pd
+#define v512_set1 _mm512_set1_pd
+#define v512_load _mm512_load_pd
+#define v512_loadu _mm512_loadu_pd
+#define v512_storeu _mm512_storeu_pd
+#define v512_maskz_loadu _mm512_maskz_loadu_pd
+#define v512_mask_storeu _mm512_mask_storeu_pd
+#define v512_add _mm512_add_pd
+#define v512_sub _mm512_sub_pd
+#define v512_mul _mm512_mul_pd
+#define v512_div _mm512_div_pd
+#define v512_sqrt _mm512_sqrt_pd
+#define v512_min _mm512_min_pd
+#define v512_max _mm512_max_pd
+#define v512_cmp_mask _mm512_cmp_pd_mask
+#define v512_mask_blend _mm512_mask_blend_pd
+#define v512_maskz_mov _mm512_maskz_mov_pd
+#define v512_fmadd _mm512_fmadd_pd
+#define v512_fnmadd _mm512_fnmadd_pd
+#define v512_scalef _mm512_scalef_pd
+#define v512_round(v) _mm512_roundscale_pd(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define v512_reduce_add _mm512_reduce_add_pd
+
+__attribute__((target("sse2")))
+static inline real_t v128_reduce_add(v128_t v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+__attribute__((target("avx2")))
+static inline real_t v256_reduce_add(v256_t v) {
+    return v128_reduce_add(_mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1)));
+}
+
+// Widen one vector's worth of uint8 values (4 for ymm, 8 for zmm) to real_t:
+__attribute__((target("avx2")))
+static inline v256_t v256_loadu_u8(const unsigned char *p) {
+    return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_loadu_si32(p)));
+}
+
+__attribute__((target("avx512f")))
+static inline v512_t v512_loadu_u8(const unsigned char *p) {
+    return _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p)));
+}
+
+// Gather base[index[0..lanes)] into a vector, and scatter a vector back out the same way:
+__attribute__((target("avx2")))
+static inline v256_t v256_gather(const real_t *base, const int *index) {
+    return _mm256_i32gather_pd(base, _mm_loadu_si128((const __m128i *)index), sizeof(real_t));
+}
+
+__attribute__((target("avx512f")))
+static inline v512_t v512_gather(const real_t *base, const int *index) {
+    return _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)index), base, sizeof(real_t));
+}
+
+__attribute__((target("avx512f")))
+static inline void v512_scatter(real_t *base, const int *index, v512_t v) {
+    _mm512_i32scatter_pd(base, _mm256_loadu_si256((const __m256i *)index), v, sizeof(real_t));
+}
+
+// 2^n for a vector of integral values n (in the normal exponent range), built straight from the exponent bits:
+__attribute__((target("avx2")))
+static inline v256_t v256_pow2i(v256_t n) {
+    const __m256i bits = _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n)), _mm256_set1_epi64x(1023));
+    return _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52));
+}
+
+// Degree of the Taylor polynomial used for e^r on [-ln2/2, ln2/2] by the vector exp (see kernels.c):
+#define EXP_DEGREE 12
+// |x| beyond which e^x over/underflows, and ln2 split so n * EXP_LN2_HI is exact for the n that can occur:
+#define EXP_LIMIT 708.0
+#define EXP_LN2_HI 6.93147180369123816490e-01
+#define EXP_LN2_LO 1.90821492927058770002e-10
+#endif
+#endif
+
+#endif
@@ -0,0 +1,527 @@
+// pthread_setaffinity_np, for pinning workers:
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "threadpool.h"
+
+// ////////////////////////////////////  //
+//                Pinning                //
+//  ///////////////////////////////////  //
+
+// Pin a thread to a single CPU, where the platform allows it:
+static void pin_thread_to_cpu(pthread_t thread, int cpu) {
+#ifdef __linux__
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    pthread_setaffinity_np(thread, sizeof(one), &one);
+#else
+    (void)thread;
+    (void)cpu;
+#endif
+}
+
+// Pin a thread to the index-th CPU in the process's affinity mask (wrapping around):
+static void pin_thread(pthread_t thread, int index) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    int target = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+            pin_thread_to_cpu(thread, cpu);
+            return;
+        }
+    }
+#else
+    (void)thread;
+    (void)index;
+#endif
+}
+
+// ////////////////////////////////////  //
+//             Task Deques               //
+//  ///////////////////////////////////  //
+
+// One parallel_for call, which its tasks count down as they finish:
+typedef struct thread_pool_job_t {
+    void (*body)(void *arg, long begin, long end);
+    void *arg;
+    long grain;
+    _Atomic long remaining;
+} thread_pool_job_t;
+
+static void init_deque(thread_pool_deque_t *deque) {
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->capacity = 64;
+    deque->tasks = malloc(sizeof(thread_pool_task_t) * deque->capacity);
+    deque->top = deque->bottom = 0;
+}
+
+static void destroy_deque(thread_pool_deque_t *deque) {
+    pthread_mutex_destroy(&deque->lock);
+    free(deque->tasks);
+}
+
+// The owner pushes and pops at the bottom:
+static void deque_push(thread_pool_deque_t *deque, const thread_pool_task_t *task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        thread_pool_task_t *tasks = malloc(sizeof(thread_pool_task_t) * deque->capacity * 2);
+        for (long i = deque->top; i < deque->bottom; i++) {
+            tasks[i % (deque->capacity * 2)] = deque->tasks[i % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity *= 2;
+    }
+    deque->tasks[deque->bottom++ % deque->capacity] = *task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static int deque_pop(thread_pool_deque_t *deque, thread_pool_task_t *task) {
+    pthread_mutex_lock(&deque->lock);
+    const int found = deque->bottom > deque->top;
+    if (found) {
+        *task = deque->tasks[--deque->bottom % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// And everyone else steals from the top:
+static int deque_steal(thread_pool_deque_t *deque, thread_pool_task_t *task) {
+    pthread_mutex_lock(&deque->lock);
+    const int found = deque->bottom > deque->top;
+    if (found) {
+        *task = deque->tasks[deque->top++ % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// ////////////////////////////////////  //
+//            Work Stealing              //
+//  ///////////////////////////////////  //
+
+// The pool and index of the worker running on this thread, if it is one:
+static _Thread_local thread_pool_t *current_pool = NULL;
+static _Thread_local int current_worker = -1;
+
+typedef struct {
+    thread_pool_t *pool;
+    int thread_index;
+} worker_args_t;
+
+static void notify_work(thread_pool_t *pool) {
+    atomic_fetch_add(&pool->work_epoch, 1);
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// Next task for worker self: anything pinned to it, its own newest, then submitted work, then the oldest of another worker's (trying each
+// in turn, starting from the next one along so thieves spread out). In NUMA mode the workers of our own node are
+// tried first, so work (and the memory it touches) only crosses nodes when a whole node has run dry:
+static int find_task(thread_pool_t *pool, int self, thread_pool_task_t *task) {
+    if (deque_pop(&pool->pinned[self], task) || deque_pop(&pool->deques[self], task) || deque_steal(&pool->injected, task)) {
+        return 1;
+    }
+    for (int pass = pool->numa ? 0 : 1; pass < 2; pass++) {
+        for (int i = 1; i < pool->thread_count; i++) {
+            const int victim = (self + i) % pool->thread_count;
+            if (pool->numa && (pool->worker_nodes[victim] == pool->worker_nodes[self]) != (pass == 0)) {
+                continue;
+            }
+            if (deque_steal(&pool->deques[victim], task)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Split off the upper half of the range onto deque (the runner's own, or the submission deque for a caller from
+// outside the pool) for others to steal while it is bigger than the grain, then run what's left:
+static void run_task(thread_pool_t *pool, thread_pool_deque_t *deque, thread_pool_task_t task) {
+    thread_pool_job_t *job = task.job;
+    while (task.end - task.begin > job->grain) {
+        const long pieces = (task.end - task.begin + job->grain - 1) / job->grain;
+        const thread_pool_task_t upper = {job, task.begin + pieces / 2 * job->grain, task.end};
+        deque_push(deque, &upper);
+        notify_work(pool);
+        task.end = upper.begin;
+    }
+    job->body(job->arg, task.begin, task.end);
+
+    // The last piece of a job wakes whoever submitted it (the job itself may be gone as soon as remaining hits 0):
+    const long count = task.end - task.begin;
+    if (atomic_fetch_sub(&job->remaining, count) == count) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void *worker_main(void *arg) {
+
+    worker_args_t *worker = (worker_args_t *)arg;
+    thread_pool_t *pool = worker->pool;
+    const int self = worker->thread_index;
+    free(worker);
+    current_pool = pool;
+    current_worker = self;
+
+    for (;;) {
+        const unsigned long epoch = atomic_load(&pool->work_epoch);
+        thread_pool_task_t task;
+        if (find_task(pool, self, &task)) {
+            run_task(pool, &pool->deques[self], task);
+            continue;
+        }
+
+        // Nothing anywhere, so sleep until work is posted. Counting ourselves in sleepers before checking the epoch
+        // means a poster either sees us and wakes us, or we see its bump and look again:
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+        if (atomic_load(&pool->work_epoch) == epoch && !atomic_load(&pool->shutdown)) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        pthread_mutex_unlock(&pool->lock);
+
+        if (atomic_load(&pool->shutdown)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+thread_pool_t *init_thread_pool(int thread_count) {
+
+    // Init and zeroise:
+    thread_pool_t *pool = (thread_pool_t *)malloc(sizeof(*pool));
+    memset(pool, 0, sizeof(*pool));
+
+    pool->thread_count = thread_count < 1 ? 1 : thread_count;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->work_epoch, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->shutdown, 0);
+
+    pool->deques = malloc(sizeof(thread_pool_deque_t) * pool->thread_count);
+    pool->pinned = malloc(sizeof(thread_pool_deque_t) * pool->thread_count);
+    for (int i = 0; i < pool->thread_count; i++) {
+        init_deque(&pool->deques[i]);
+        init_deque(&pool->pinned[i]);
+    }
+    init_deque(&pool->injected);
+
+    const char *numa = getenv("MLP_NUMA");
+    if (numa && atoi(numa) > 0) {
+        pool->numa = init_numa_topology();
+        pool->worker_nodes = malloc(sizeof(int) * pool->thread_count);
+        for (int i = 0; i < pool->thread_count; i++) {
+            pool->worker_nodes[i] = numa_worker_node(pool->numa, i, pool->thread_count);
+        }
+    }
+
+    // Callers take a share of their own work, but there may be any number of them, so all thread_count threads are workers:
+    const char *pin = getenv("MLP_PIN");
+    pool->threads = malloc(sizeof(pthread_t) * pool->thread_count);
+    for (int i = 0; i < pool->thread_count; i++) {
+        worker_args_t *worker = malloc(sizeof(*worker));
+        worker->pool = pool;
+        worker->thread_index = i;
+        pthread_create(&pool->threads[i], NULL, worker_main, worker);
+        if (pool->numa) {
+            pin_thread_to_cpu(pool->threads[i], numa_worker_cpu(pool->numa, i, pool->thread_count));
+        } else if (pin && atoi(pin) > 0) {
+            pin_thread(pool->threads[i], i);
+        }
+    }
+
+    return pool;
+}
+
+void destroy_thread_pool(thread_pool_t *pool) {
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&pool->shutdown, 1);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        destroy_deque(&pool->deques[i]);
+        destroy_deque(&pool->pinned[i]);
+    }
+    destroy_deque(&pool->injected);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    if (pool->numa) {
+        destroy_numa_topology(pool->numa);
+        free(pool->worker_nodes);
+    }
+    free(pool->deques);
+    free(pool->pinned);
+    free(pool->threads);
+    free(pool);
+}
+
+// Return once every index of job has run:
+static void wait_for_job(thread_pool_t *pool, thread_pool_job_t *job) {
+
+    // A worker of this pool (a nested call) helps with whatever it finds meanwhile, rather than block a thread the
+    // job may need:
+    if (current_pool == pool) {
+        int spins = 0;
+        while (atomic_load(&job->remaining) > 0) {
+            thread_pool_task_t other;
+            if (find_task(pool, current_worker, &other)) {
+                run_task(pool, &pool->deques[current_worker], other);
+                spins = 0;
+            } else if (++spins > 64) {
+                sched_yield();
+            }
+        }
+        return;
+    }
+
+    // Anyone else sleeps until it is done:
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&job->remaining) > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_parallel_for(thread_pool_t *pool, long count, long grain, void (*body)(void *arg, long begin, long end), void *arg) {
+    if (count <= 0) {
+        return;
+    }
+
+    thread_pool_job_t job;
+    job.body = body;
+    job.arg = arg;
+    job.grain = grain < 1 ? 1 : grain;
+    atomic_init(&job.remaining, count);
+    const thread_pool_task_t task = {&job, 0, count};
+
+    // A worker of this pool works through the range itself. So does anyone else, rather than pay a hand-off to a
+    // worker for work it could have started on: it splits the rest off onto the submission deque as it goes, and only
+    // waits once its own first piece is done. With a single worker there is nobody to share with, so it runs the lot:
+    if (current_pool == pool) {
+        run_task(pool, &pool->deques[current_worker], task);
+    } else if (pool->thread_count == 1) {
+        for (long begin = 0; begin < count; begin += job.grain) {
+            body(arg, begin, (count - begin < job.grain) ? count : begin + job.grain);
+        }
+        return;
+    } else {
+        run_task(pool, &pool->injected, task);
+    }
+    wait_for_job(pool, &job);
+}
+
+typedef struct {
+    void (*task)(void *arg, int thread_index);
+    void *arg;
+} run_job_t;
+
+static void run_body(void *arg, long begin, long end) {
+    run_job_t *job = (run_job_t *)arg;
+    for (long i = begin; i < end; i++) {
+        job->task(job->arg, (int)i);
+    }
+}
+
+void thread_pool_run(thread_pool_t *pool, void (*task)(void *arg, int thread_index), void *arg) {
+    run_job_t run = {task, arg};
+    thread_pool_job_t job;
+    job.body = run_body;
+    job.arg = &run;
+    job.grain = 1;
+    atomic_init(&job.remaining, pool->thread_count);
+
+    // Each index goes on its own worker's deque, where that worker finds it first. A caller from outside the pool
+    // runs index 0 itself (as the calling thread always has), so a single-threaded pool never hands off at all.
+    // In NUMA mode tasks place memory by where they run, so every index is pinned to its worker instead, where a
+    // thief can't take it to another node:
+    const int first = (current_pool == pool || pool->numa) ? 0 : 1;
+    for (int t = first; t < pool->thread_count; t++) {
+        const thread_pool_task_t index = {&job, t, t + 1};
+        deque_push(pool->numa ? &pool->pinned[t] : &pool->deques[t], &index);
+    }
+    if (first < pool->thread_count) {
+        notify_work(pool);
+    }
+    if (first == 1) {
+        const thread_pool_task_t index = {&job, 0, 1};
+        run_task(pool, &pool->injected, index);
+    }
+    wait_for_job(pool, &job);
+}
+
+// ////////////////////////////////////  //
+//            Spinning Pool              //
+//  ///////////////////////////////////  //
+
+// Busy-wait iterations before a spinning thread starts yielding its core on every iteration.
+// Well past the length of a typical task, so a pool in steady use never yields:
+#define SPIN_YIELD_AFTER 100000
+
+// One iteration of a busy-wait loop. The pause hint stops the spinning core hammering the cache line it watches
+// (and frees pipeline resources for a hyperthread sibling); once the wait has gone on long enough, yield instead
+// so a pool with more threads than free cores still makes progress:
+static inline void spin_wait(int *spins) {
+    if (++*spins < SPIN_YIELD_AFTER) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+typedef struct {
+    spin_pool_t *pool;
+    int thread_index;
+} spin_worker_args_t;
+
+static void *spin_worker_main(void *arg) {
+
+    spin_worker_args_t *worker = (spin_worker_args_t *)arg;
+    spin_pool_t *pool = worker->pool;
+    const int thread_index = worker->thread_index;
+    free(worker);
+
+    unsigned long seen = 0;
+    for (;;) {
+        // Spin until a new task is posted (or the pool is torn down):
+        int spins = 0;
+        unsigned long generation;
+        while ((generation = atomic_load_explicit(&pool->generation, memory_order_acquire)) == seen &&
+            !atomic_load_explicit(&pool->shutdown, memory_order_relaxed)) {
+            spin_wait(&spins);
+        }
+        if (generation == seen) {
+            break;
+        }
+        seen = generation;
+
+        pool->task(pool->arg, thread_index);
+        atomic_fetch_sub_explicit(&pool->running, 1, memory_order_release);
+    }
+
+    return NULL;
+}
+
+spin_pool_t *init_spin_pool(int thread_count, int pin) {
+
+    // Init and zeroise:
+    spin_pool_t *pool = (spin_pool_t *)malloc(sizeof(*pool));
+    memset(pool, 0, sizeof(*pool));
+
+    // A spinning thread only helps while it has a core to itself, so never start more than the CPUs available:
+    pool->thread_count = thread_count < 1 ? 1 : thread_count;
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0 && CPU_COUNT(&allowed) < pool->thread_count) {
+        pool->thread_count = CPU_COUNT(&allowed);
+    }
+#endif
+    atomic_init(&pool->generation, 0);
+    atomic_init(&pool->running, 0);
+    atomic_init(&pool->shutdown, 0);
+    atomic_init(&pool->barrier_waiting, 0);
+    atomic_init(&pool->barrier_generation, 0);
+
+    // As with thread_pool_t, the calling thread is thread 0:
+    pool->threads = malloc(sizeof(pthread_t) * pool->thread_count);
+    for (int i = 1; i < pool->thread_count; i++) {
+        spin_worker_args_t *worker = malloc(sizeof(*worker));
+        worker->pool = pool;
+        worker->thread_index = i;
+        pthread_create(&pool->threads[i], NULL, spin_worker_main, worker);
+        if (pin) {
+            pin_thread(pool->threads[i], i);
+        }
+    }
+
+    return pool;
+}
+
+void destroy_spin_pool(spin_pool_t *pool) {
+    atomic_store_explicit(&pool->shutdown, 1, memory_order_relaxed);
+    for (int i = 1; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    free(pool);
+}
+
+void spin_pool_run(spin_pool_t *pool, void (*task)(void *arg, int thread_index), void *arg) {
+
+    // Post the task (the release on generation publishes task and arg):
+    pool->task = task;
+    pool->arg = arg;
+    atomic_store_explicit(&pool->running, pool->thread_count - 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->generation, 1, memory_order_release);
+
+    // Take our own share:
+    task(arg, 0);
+
+    // Wait for everyone else:
+    int spins = 0;
+    while (atomic_load_explicit(&pool->running, memory_order_acquire) > 0) {
+        spin_wait(&spins);
+    }
+}
+
+void spin_pool_barrier(spin_pool_t *pool) {
+    if (pool->thread_count == 1) {
+        return;
+    }
+
+    // The last thread to arrive resets the count before releasing the others, so nobody can reach the next
+    // barrier while this one is still counting:
+    const unsigned long generation = atomic_load_explicit(&pool->barrier_generation, memory_order_acquire);
+    if (atomic_fetch_add_explicit(&pool->barrier_waiting, 1, memory_order_acq_rel) == pool->thread_count - 1) {
+        atomic_store_explicit(&pool->barrier_waiting, 0, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pool->barrier_generation, 1, memory_order_release);
+        return;
+    }
+    int spins = 0;
+    while (atomic_load_explicit(&pool->barrier_generation, memory_order_acquire) == generation) {
+        spin_wait(&spins);
+    }
+}
+
+int default_thread_count(void) {
+    const char *env = getenv("MLP_THREADS");
+    if (env && atoi(env) > 0) {
+        return atoi(env);
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
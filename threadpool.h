@@ -0,0 +1,124 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+
+#include "numa.h"
+
+// A work-stealing task runtime, shared by everything in the process that wants to run in parallel.
+//
+// thread_count workers each own a deque of tasks. A worker runs tasks from the bottom of its own deque, and when that
+// runs dry takes work submitted from outside the pool, then steals from the top of another worker's deque (the
+// oldest, and so largest, pieces of work). Idle workers sleep until new work is posted.
+//
+// thread_pool_parallel_for() splits an index range lazily: the worker holding a range bigger than the grain pushes
+// its upper half for others to steal and carries on with the lower half, so the range spreads over the workers that
+// are free and stays in large pieces where they aren't. A caller from outside the pool works on its own range the same
+// way (splitting onto a shared submission deque) until its first piece is done, and only then sleeps. Calls compose: any number of threads can submit work to the
+// same pool at once (e.g. training and evaluation), and a task may itself call parallel_for, in which case its worker
+// helps run the nested range rather than blocking.
+//
+// Tasks are a grain of work each, coarse enough that a short per-deque lock costs nothing measurable, so the deques
+// are locked rather than lock-free.
+typedef struct thread_pool_task_t {
+    struct thread_pool_job_t *job;
+    long begin;
+    long end;
+} thread_pool_task_t;
+
+typedef struct thread_pool_deque_t {
+    pthread_mutex_t lock;
+    // Ring buffer of capacity tasks (grown as needed), holding [top, bottom):
+    thread_pool_task_t *tasks;
+    long capacity;
+    long top;
+    long bottom;
+} thread_pool_deque_t;
+
+typedef struct thread_pool_t {
+    int thread_count;
+    pthread_t *threads;
+
+    // One deque per worker, and one for work submitted by threads outside the pool:
+    thread_pool_deque_t *deques;
+    thread_pool_deque_t injected;
+    // And one per worker that nobody steals from, for tasks only that worker may run (see thread_pool_run):
+    thread_pool_deque_t *pinned;
+
+    // work_epoch is bumped whenever work is posted, and a worker that found none only sleeps on wake (counted in
+    // sleepers) if it hasn't moved since it started looking. Callers from outside waiting on their work sleep on done:
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    _Atomic unsigned long work_epoch;
+    _Atomic int sleepers;
+    _Atomic int shutdown;
+
+    // NUMA mode: the machine's topology, and the node (an index into it) each worker is pinned to. NULL otherwise:
+    numa_topology_t *numa;
+    int *worker_nodes;
+} thread_pool_t;
+
+// Workers are pinned to a CPU each (in the order of the process's affinity mask) when MLP_PIN=1 is set in the environment.
+//
+// MLP_NUMA=1 instead spreads the workers over the NUMA nodes in contiguous blocks, pins each to a CPU of its node,
+// and has idle workers steal from their own node before crossing to another. Work that cares where its memory lives
+// (e.g. train_mlp_parallel's shards) checks pool->numa and allocates from the worker that will use it, which
+// thread_pool_run guarantees in this mode.
+thread_pool_t *init_thread_pool(int thread_count);
+void destroy_thread_pool(thread_pool_t *pool);
+
+// Run body(arg, begin, end) over every index in [0, count), in pieces of at most grain indices, and return once all
+// of them have run. Pieces run in no particular order or thread.
+void thread_pool_parallel_for(thread_pool_t *pool, long count, long grain, void (*body)(void *arg, long begin, long end), void *arg);
+
+// Run task(arg, thread_index) once for every thread_index in [0, thread_count), and return once all have finished,
+// so each call acts as a barrier. Each index is run exactly once (its own slice of the work, its own buffers).
+// In NUMA mode index t always runs on worker t, and so on that worker's node, so a task may place memory by touching
+// it first. Otherwise index t is queued on worker t, where it normally runs, but an idle worker may steal it, and a
+// caller from outside the pool runs index 0 itself. Indices needn't run at the same time, so tasks must never wait
+// on each other.
+void thread_pool_run(thread_pool_t *pool, void (*task)(void *arg, int thread_index), void *arg);
+
+// ////////////////////////////////////  //
+//            Spinning Pool              //
+//  ///////////////////////////////////  //
+
+// A pool for latency-critical work, where waking a sleeping thread (tens of microseconds) would cost more than the
+// work itself. Workers busy-wait for tasks instead of sleeping on a condition variable, and can be pinned to their own
+// cores so they stay hot. spin_pool_run() works like thread_pool_run(), and a task may synchronise all the threads
+// part way through with spin_pool_barrier().
+// Idle workers keep spinning (yielding their core to anything else runnable after a while), so a spin pool should
+// only live as long as the latency-critical phase it serves.
+typedef struct spin_pool_t {
+    int thread_count;
+    pthread_t *threads;
+
+    // Current task, posted by bumping generation:
+    void (*task)(void *arg, int thread_index);
+    void *arg;
+    _Atomic unsigned long generation;
+    // Workers yet to finish the current task:
+    _Atomic int running;
+    _Atomic int shutdown;
+
+    // Threads waiting at the current barrier, and a counter bumped as each barrier releases:
+    _Atomic int barrier_waiting;
+    _Atomic unsigned long barrier_generation;
+} spin_pool_t;
+
+// Starts at most as many threads as the process has CPUs to run on (check thread_count). With pin set, worker i is
+// pinned to the i-th of those CPUs, leaving the first for the calling thread (which is never moved).
+spin_pool_t *init_spin_pool(int thread_count, int pin);
+void destroy_spin_pool(spin_pool_t *pool);
+
+void spin_pool_run(spin_pool_t *pool, void (*task)(void *arg, int thread_index), void *arg);
+
+// Wait until every thread of the pool running the current task has reached the barrier. Must be called the same
+// number of times by every thread:
+void spin_pool_barrier(spin_pool_t *pool);
+
+// Number of threads to use when the caller has no preference: $MLP_THREADS if set, otherwise the online core count.
+int default_thread_count(void);
+
+#endif